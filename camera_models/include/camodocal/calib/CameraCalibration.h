@@ -49,6 +49,9 @@ public:
 
     void setVerbose(bool verbose);
 
+    // threads used by the ceres solve
+    void setNumThreads(int numThreads);
+
 private:
     bool calibrateHelper(CameraPtr& camera,
                          std::vector<cv::Mat>& rvecs, std::vector<cv::Mat>& tvecs) const;
@@ -74,6 +77,7 @@ private:
     Eigen::Matrix2d m_measurementCovariance;
 
     bool m_verbose;
+    int m_numThreads;
 };
 
 }
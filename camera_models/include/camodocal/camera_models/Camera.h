@@ -92,6 +92,18 @@ class Camera
     virtual void undistToPlane( const Eigen::Vector2d& p_u, Eigen::Vector2d& p ) const = 0;
     //%output p
 
+    // Batch versions of liftProjective and spaceToPlane over contiguous point arrays.
+    // p_u holds the lifted rays on the normalised plane (x/z, y/z). The default
+    // implementations call the per-point functions, models override them with
+    // inlined loops that keep the intrinsics in registers
+    virtual void liftProjectiveBatch( const std::vector< cv::Point2f >& p,
+                                      std::vector< cv::Point2f >& p_u ) const;
+    //%output p_u
+
+    virtual void spaceToPlaneBatch( const std::vector< cv::Point3f >& P,
+                                    std::vector< cv::Point2f >& p ) const;
+    //%output p
+
     // virtual void initUndistortMap(cv::Mat& map1, cv::Mat& map2, double fScale = 1.0)
     // const = 0;
     virtual cv::Mat initUndistortRectifyMap( cv::Mat& map1,
@@ -103,6 +103,11 @@ public:
     void undistToPlane(const Eigen::Vector2d& p_u, Eigen::Vector2d& p) const;
     //%output p
 
+    void liftProjectiveBatch(const std::vector<cv::Point2f>& p,
+                             std::vector<cv::Point2f>& p_u) const;
+    void spaceToPlaneBatch(const std::vector<cv::Point3f>& P,
+                           std::vector<cv::Point2f>& p) const;
+
     template <typename T>
     static void spaceToPlane(const T* const params,
                              const T* const q, const T* const t,
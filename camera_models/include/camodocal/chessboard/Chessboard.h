@@ -18,7 +18,9 @@ class Chessboard
 public:
     Chessboard(cv::Size boardSize, cv::Mat& image);
 
-    void findCorners(bool useOpenCV = false);
+    // coarseToFine: search large images on a downsampled pyramid level and
+    // refine the corners on the full image, falling back to full resolution
+    void findCorners(bool useOpenCV = false, bool coarseToFine = true);
     const std::vector<cv::Point2f>& getCorners(void) const;
     bool cornersFound(void) const;
 
@@ -29,7 +31,12 @@ private:
     bool findChessboardCorners(const cv::Mat& image,
                                const cv::Size& patternSize,
                                std::vector<cv::Point2f>& corners,
-                               int flags, bool useOpenCV);
+                               int flags, bool useOpenCV, bool coarseToFine);
+
+    bool detectChessboardCorners(const cv::Mat& image,
+                                 const cv::Size& patternSize,
+                                 std::vector<cv::Point2f>& corners,
+                                 int flags, bool useOpenCV);
 
     bool findChessboardCornersImproved(const cv::Mat& image,
                                        const cv::Size& patternSize,
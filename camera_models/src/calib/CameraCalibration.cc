@@ -6,6 +6,7 @@
 #include <iostream>
 #include <algorithm>
 #include <fstream>
+#include <thread>
 #include <opencv2/core/core.hpp>
 #include <opencv2/core/eigen.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
@@ -15,6 +16,7 @@
 #include "camodocal/sparse_graph/Transform.h"
 #include "camodocal/gpl/EigenQuaternionParameterization.h"
 #include "camodocal/gpl/EigenUtils.h"
+#include "camodocal/gpl/gpl.h"
 #include "camodocal/camera_models/CostFunctionFactory.h"
 
 #include "ceres/ceres.h"
@@ -25,6 +27,7 @@ CameraCalibration::CameraCalibration()
  : m_boardSize(cv::Size(0,0))
  , m_squareSize(0.0f)
  , m_verbose(false)
+ , m_numThreads(std::max(1, (int)std::thread::hardware_concurrency()))
 {
 
 }
@@ -37,6 +40,7 @@ CameraCalibration::CameraCalibration(const Camera::ModelType modelType,
  : m_boardSize(boardSize)
  , m_squareSize(squareSize)
  , m_verbose(false)
+ , m_numThreads(std::max(1, (int)std::thread::hardware_concurrency()))
 {
     m_camera = CameraFactory::instance()->generateCamera(modelType, cameraName, imageSize);
 }
@@ -421,6 +425,12 @@ CameraCalibration::setVerbose(bool verbose)
     m_verbose = verbose;
 }
 
+void
+CameraCalibration::setNumThreads(int numThreads)
+{
+    m_numThreads = std::max(1, numThreads);
+}
+
 bool
 CameraCalibration::calibrateHelper(CameraPtr& camera,
                                    std::vector<cv::Mat>& rvecs, std::vector<cv::Mat>& tvecs) const
@@ -431,11 +441,14 @@ CameraCalibration::calibrateHelper(CameraPtr& camera,
     // STEP 1: Estimate intrinsics
     camera->estimateIntrinsics(m_boardSize, m_scenePoints, m_imagePoints);
 
-    // STEP 2: Estimate extrinsics
-    for (size_t i = 0; i < m_scenePoints.size(); ++i)
+    // STEP 2: Estimate extrinsics, the views are independent
+    cv::parallel_for_(cv::Range(0, m_scenePoints.size()), [&](const cv::Range& range)
     {
-        camera->estimateExtrinsics(m_scenePoints.at(i), m_imagePoints.at(i), rvecs.at(i), tvecs.at(i));
-    }
+        for (int i = range.start; i < range.end; ++i)
+        {
+            camera->estimateExtrinsics(m_scenePoints.at(i), m_imagePoints.at(i), rvecs.at(i), tvecs.at(i));
+        }
+    });
 
     if (m_verbose)
     {
@@ -512,9 +525,20 @@ CameraCalibration::optimize(CameraPtr& camera,
     }
 
     std::cout << "begin ceres" << std::endl;
+    double startTime = timeInSeconds();
+
+    // the view poses only share the intrinsics, so they are eliminated by the Schur complement
     ceres::Solver::Options options;
+    options.linear_solver_type = ceres::SPARSE_SCHUR;
     options.max_num_iterations = 1000;
-    options.num_threads = 1;
+    options.num_threads = m_numThreads;
+
+    std::string error;
+    if (!options.IsValid(&error))
+    {
+        // no sparse linear algebra library in this ceres build
+        options.linear_solver_type = ceres::DENSE_SCHUR;
+    }
 
     if (m_verbose)
     {
@@ -525,6 +549,11 @@ CameraCalibration::optimize(CameraPtr& camera,
     ceres::Solve(options, &problem, &summary);
     std::cout << "end ceres" << std::endl;
 
+    std::cout << "[" << camera->cameraName() << "] " << "# INFO: Optimized "
+              << rvecs.size() << " views with " << m_numThreads << " threads in "
+              << std::fixed << std::setprecision(3) << timeInSeconds() - startTime
+              << " sec." << std::endl;
+
     if (m_verbose)
     {
         std::cout << summary.FullReport() << std::endl;
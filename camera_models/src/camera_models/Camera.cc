@@ -211,6 +211,32 @@ Camera::reprojectionError(const Eigen::Vector3d& P,
     return (p - observed_p).norm();
 }
 
+void
+Camera::liftProjectiveBatch(const std::vector<cv::Point2f>& p,
+                            std::vector<cv::Point2f>& p_u) const
+{
+    p_u.resize(p.size());
+    for (size_t i = 0; i < p.size(); ++i)
+    {
+        Eigen::Vector3d P;
+        liftProjective(Eigen::Vector2d(p[i].x, p[i].y), P);
+        p_u[i] = cv::Point2f(P(0) / P(2), P(1) / P(2));
+    }
+}
+
+void
+Camera::spaceToPlaneBatch(const std::vector<cv::Point3f>& P,
+                          std::vector<cv::Point2f>& p) const
+{
+    p.resize(P.size());
+    for (size_t i = 0; i < P.size(); ++i)
+    {
+        Eigen::Vector2d p_i;
+        spaceToPlane(Eigen::Vector3d(P[i].x, P[i].y, P[i].z), p_i);
+        p[i] = cv::Point2f(p_i(0), p_i(1));
+    }
+}
+
 void
 Camera::projectPoints(const std::vector<cv::Point3f>& objectPoints,
                       const cv::Mat& rvec,
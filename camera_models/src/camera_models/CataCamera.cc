@@ -728,6 +728,95 @@ CataCamera::spaceToPlane(const Eigen::Vector3d& P, Eigen::Vector2d& p,
 }
 #endif
 
+/**
+ * \brief Lifts a batch of image points to the normalised plane
+ *
+ * Same recursive distortion model and unified projection as liftProjective,
+ * with the intrinsics loaded once for the whole batch
+ */
+void
+CataCamera::liftProjectiveBatch(const std::vector<cv::Point2f>& p,
+                                std::vector<cv::Point2f>& p_u) const
+{
+    const double k1 = m_noDistortion ? 0.0 : mParameters.k1();
+    const double k2 = m_noDistortion ? 0.0 : mParameters.k2();
+    const double p1 = m_noDistortion ? 0.0 : mParameters.p1();
+    const double p2 = m_noDistortion ? 0.0 : mParameters.p2();
+    const int iterations = m_noDistortion ? 0 : 8;
+    const double xi = mParameters.xi();
+    const double inv_K11 = m_inv_K11, inv_K13 = m_inv_K13;
+    const double inv_K22 = m_inv_K22, inv_K23 = m_inv_K23;
+    const int n = p.size();
+    p_u.resize(n);
+
+    for (int i = 0; i < n; ++i)
+    {
+        double mx_d = inv_K11 * p[i].x + inv_K13;
+        double my_d = inv_K22 * p[i].y + inv_K23;
+        double mx_u = mx_d, my_u = my_d;
+        for (int j = 0; j < iterations; ++j)
+        {
+            double mx2_u = mx_u * mx_u;
+            double my2_u = my_u * my_u;
+            double mxy_u = mx_u * my_u;
+            double rho2_u = mx2_u + my2_u;
+            double rad_dist_u = k1 * rho2_u + k2 * rho2_u * rho2_u;
+            double dx = mx_u * rad_dist_u + 2.0 * p1 * mxy_u + p2 * (rho2_u + 2.0 * mx2_u);
+            double dy = my_u * rad_dist_u + 2.0 * p2 * mxy_u + p1 * (rho2_u + 2.0 * my2_u);
+            mx_u = mx_d - dx;
+            my_u = my_d - dy;
+        }
+
+        double rho2 = mx_u * mx_u + my_u * my_u;
+        double z;
+        if (xi == 1.0)
+        {
+            z = (1.0 - rho2) / 2.0;
+        }
+        else
+        {
+            z = 1.0 - xi * (rho2 + 1.0) / (xi + sqrt(1.0 + (1.0 - xi * xi) * rho2));
+        }
+        p_u[i].x = mx_u / z;
+        p_u[i].y = my_u / z;
+    }
+}
+
+/**
+ * \brief Projects a batch of 3D points to the image plane
+ */
+void
+CataCamera::spaceToPlaneBatch(const std::vector<cv::Point3f>& P,
+                              std::vector<cv::Point2f>& p) const
+{
+    const double k1 = m_noDistortion ? 0.0 : mParameters.k1();
+    const double k2 = m_noDistortion ? 0.0 : mParameters.k2();
+    const double p1 = m_noDistortion ? 0.0 : mParameters.p1();
+    const double p2 = m_noDistortion ? 0.0 : mParameters.p2();
+    const double xi = mParameters.xi();
+    const double gamma1 = mParameters.gamma1(), gamma2 = mParameters.gamma2();
+    const double u0 = mParameters.u0(), v0 = mParameters.v0();
+    const int n = P.size();
+    p.resize(n);
+
+    for (int i = 0; i < n; ++i)
+    {
+        double x = P[i].x, y = P[i].y, z = P[i].z;
+        double inv_z = 1.0 / (z + xi * sqrt(x * x + y * y + z * z));
+        double mx_u = x * inv_z;
+        double my_u = y * inv_z;
+        double mx2_u = mx_u * mx_u;
+        double my2_u = my_u * my_u;
+        double mxy_u = mx_u * my_u;
+        double rho2_u = mx2_u + my2_u;
+        double rad_dist_u = k1 * rho2_u + k2 * rho2_u * rho2_u;
+        double mx_d = mx_u + mx_u * rad_dist_u + 2.0 * p1 * mxy_u + p2 * (rho2_u + 2.0 * mx2_u);
+        double my_d = my_u + my_u * rad_dist_u + 2.0 * p2 * mxy_u + p1 * (rho2_u + 2.0 * my2_u);
+        p[i].x = gamma1 * mx_d + u0;
+        p[i].y = gamma2 * my_d + v0;
+    }
+}
+
 /** 
  * \brief Projects an undistorted 2D point p_u to the image plane
  *
@@ -890,6 +979,9 @@ CataCamera::initUndistortRectifyMap(cv::Mat& map1, cv::Mat& map2,
     cv::cv2eigen(rmat, R);
     R_inv = R.inverse();
 
+    // project the rays of one image row at a time
+    std::vector<cv::Point3f> rays(imageSize.width);
+    std::vector<cv::Point2f> p;
     for (int v = 0; v < imageSize.height; ++v)
     {
         for (int u = 0; u < imageSize.width; ++u)
@@ -898,12 +990,15 @@ CataCamera::initUndistortRectifyMap(cv::Mat& map1, cv::Mat& map2,
             xo << u, v, 1;
 
             Eigen::Vector3f uo = R_inv * K_rect_inv * xo;
+            rays[u] = cv::Point3f(uo(0), uo(1), uo(2));
+        }
 
-            Eigen::Vector2d p;
-            spaceToPlane(uo.cast<double>(), p);
+        spaceToPlaneBatch(rays, p);
 
-            mapX.at<float>(v,u) = p(0);
-            mapY.at<float>(v,u) = p(1);
+        for (int u = 0; u < imageSize.width; ++u)
+        {
+            mapX.at<float>(v,u) = p[u].x;
+            mapY.at<float>(v,u) = p[u].y;
         }
     }
 
@@ -481,6 +481,97 @@ EquidistantCamera::spaceToPlane(const Eigen::Vector3d& P, Eigen::Vector2d& p,
          mParameters.mv() * p_u(1) + mParameters.v0();
 }
 
+/**
+ * \brief Lifts a batch of image points to the normalised plane
+ *
+ * theta is found with Newton's method on r(theta) = |p_u| starting from
+ * theta = |p_u|, instead of the eigenvalues of the companion matrix used by
+ * backprojectSymmetric. Points where it does not converge fall back to it
+ */
+void
+EquidistantCamera::liftProjectiveBatch(const std::vector<cv::Point2f>& p,
+                                       std::vector<cv::Point2f>& p_u) const
+{
+    const double k2 = mParameters.k2();
+    const double k3 = mParameters.k3();
+    const double k4 = mParameters.k4();
+    const double k5 = mParameters.k5();
+    const double inv_K11 = m_inv_K11, inv_K13 = m_inv_K13;
+    const double inv_K22 = m_inv_K22, inv_K23 = m_inv_K23;
+    const int n = p.size();
+    p_u.resize(n);
+
+    for (int i = 0; i < n; ++i)
+    {
+        double mx = inv_K11 * p[i].x + inv_K13;
+        double my = inv_K22 * p[i].y + inv_K23;
+        double r_d = sqrt(mx * mx + my * my);
+
+        double theta = r_d;
+        bool converged = false;
+        for (int j = 0; j < 10; ++j)
+        {
+            double t2 = theta * theta;
+            double f = theta * (1.0 + t2 * (k2 + t2 * (k3 + t2 * (k4 + t2 * k5)))) - r_d;
+            double df = 1.0 + t2 * (3.0 * k2 + t2 * (5.0 * k3 + t2 * (7.0 * k4 + t2 * 9.0 * k5)));
+            if (df <= 0.0)
+            {
+                break;
+            }
+            double step = f / df;
+            theta -= step;
+            if (fabs(step) < 1e-12)
+            {
+                converged = theta >= 0.0;
+                break;
+            }
+        }
+        if (!converged)
+        {
+            double phi;
+            backprojectSymmetric(Eigen::Vector2d(mx, my), theta, phi);
+        }
+
+        double scale = r_d < 1e-10 ? 1.0 : tan(theta) / r_d;
+        p_u[i].x = mx * scale;
+        p_u[i].y = my * scale;
+    }
+}
+
+/**
+ * \brief Projects a batch of 3D points to the image plane
+ */
+void
+EquidistantCamera::spaceToPlaneBatch(const std::vector<cv::Point3f>& P,
+                                     std::vector<cv::Point2f>& p) const
+{
+    const double k2 = mParameters.k2();
+    const double k3 = mParameters.k3();
+    const double k4 = mParameters.k4();
+    const double k5 = mParameters.k5();
+    const double mu = mParameters.mu(), mv = mParameters.mv();
+    const double u0 = mParameters.u0(), v0 = mParameters.v0();
+    const int n = P.size();
+    p.resize(n);
+
+    for (int i = 0; i < n; ++i)
+    {
+        double x = P[i].x, y = P[i].y, z = P[i].z;
+        double rxy = sqrt(x * x + y * y);
+        double theta = atan2(rxy, z);
+        double t2 = theta * theta;
+        double r = theta * (1.0 + t2 * (k2 + t2 * (k3 + t2 * (k4 + t2 * k5))));
+        double c = 1.0, s = 0.0;
+        if (rxy > 0.0)
+        {
+            c = x / rxy;
+            s = y / rxy;
+        }
+        p[i].x = mu * r * c + u0;
+        p[i].y = mv * r * s + v0;
+    }
+}
+
 /** 
  * \brief Projects an undistorted 2D point p_u to the image plane
  *
@@ -583,6 +674,9 @@ EquidistantCamera::initUndistortRectifyMap(cv::Mat& map1, cv::Mat& map2,
     cv::cv2eigen(rmat, R);
     R_inv = R.inverse();
 
+    // project the rays of one image row at a time
+    std::vector<cv::Point3f> rays(imageSize.width);
+    std::vector<cv::Point2f> p;
     for (int v = 0; v < imageSize.height; ++v)
     {
         for (int u = 0; u < imageSize.width; ++u)
@@ -591,12 +685,15 @@ EquidistantCamera::initUndistortRectifyMap(cv::Mat& map1, cv::Mat& map2,
             xo << u, v, 1;
 
             Eigen::Vector3f uo = R_inv * K_rect_inv * xo;
+            rays[u] = cv::Point3f(uo(0), uo(1), uo(2));
+        }
 
-            Eigen::Vector2d p;
-            spaceToPlane(uo.cast<double>(), p);
+        spaceToPlaneBatch(rays, p);
 
-            mapX.at<float>(v,u) = p(0);
-            mapY.at<float>(v,u) = p(1);
+        for (int u = 0; u < imageSize.width; ++u)
+        {
+            mapX.at<float>(v,u) = p[u].x;
+            mapY.at<float>(v,u) = p[u].y;
         }
     }
 
@@ -608,6 +608,90 @@ PinholeCamera::spaceToPlane(const Eigen::Vector3d& P, Eigen::Vector2d& p,
 }
 #endif
 
+/**
+ * \brief Lifts a batch of image points to the normalised plane
+ *
+ * Same recursive distortion model as liftProjective, with the intrinsics
+ * loaded once for the whole batch
+ */
+void
+PinholeCamera::liftProjectiveBatch(const std::vector<cv::Point2f>& p,
+                                   std::vector<cv::Point2f>& p_u) const
+{
+    const double k1 = mParameters.k1();
+    const double k2 = mParameters.k2();
+    const double p1 = mParameters.p1();
+    const double p2 = mParameters.p2();
+    const double inv_K11 = m_inv_K11, inv_K13 = m_inv_K13;
+    const double inv_K22 = m_inv_K22, inv_K23 = m_inv_K23;
+    const int n = p.size();
+    p_u.resize(n);
+
+    if (m_noDistortion)
+    {
+        for (int i = 0; i < n; ++i)
+        {
+            p_u[i].x = inv_K11 * p[i].x + inv_K13;
+            p_u[i].y = inv_K22 * p[i].y + inv_K23;
+        }
+        return;
+    }
+
+    for (int i = 0; i < n; ++i)
+    {
+        double mx_d = inv_K11 * p[i].x + inv_K13;
+        double my_d = inv_K22 * p[i].y + inv_K23;
+        double mx_u = mx_d, my_u = my_d;
+        for (int j = 0; j < 8; ++j)
+        {
+            double mx2_u = mx_u * mx_u;
+            double my2_u = my_u * my_u;
+            double mxy_u = mx_u * my_u;
+            double rho2_u = mx2_u + my2_u;
+            double rad_dist_u = k1 * rho2_u + k2 * rho2_u * rho2_u;
+            double dx = mx_u * rad_dist_u + 2.0 * p1 * mxy_u + p2 * (rho2_u + 2.0 * mx2_u);
+            double dy = my_u * rad_dist_u + 2.0 * p2 * mxy_u + p1 * (rho2_u + 2.0 * my2_u);
+            mx_u = mx_d - dx;
+            my_u = my_d - dy;
+        }
+        p_u[i].x = mx_u;
+        p_u[i].y = my_u;
+    }
+}
+
+/**
+ * \brief Projects a batch of 3D points to the image plane
+ */
+void
+PinholeCamera::spaceToPlaneBatch(const std::vector<cv::Point3f>& P,
+                                 std::vector<cv::Point2f>& p) const
+{
+    const double k1 = m_noDistortion ? 0.0 : mParameters.k1();
+    const double k2 = m_noDistortion ? 0.0 : mParameters.k2();
+    const double p1 = m_noDistortion ? 0.0 : mParameters.p1();
+    const double p2 = m_noDistortion ? 0.0 : mParameters.p2();
+    const double fx = mParameters.fx(), fy = mParameters.fy();
+    const double cx = mParameters.cx(), cy = mParameters.cy();
+    const int n = P.size();
+    p.resize(n);
+
+    for (int i = 0; i < n; ++i)
+    {
+        double inv_z = 1.0 / P[i].z;
+        double mx_u = P[i].x * inv_z;
+        double my_u = P[i].y * inv_z;
+        double mx2_u = mx_u * mx_u;
+        double my2_u = my_u * my_u;
+        double mxy_u = mx_u * my_u;
+        double rho2_u = mx2_u + my2_u;
+        double rad_dist_u = k1 * rho2_u + k2 * rho2_u * rho2_u;
+        double mx_d = mx_u + mx_u * rad_dist_u + 2.0 * p1 * mxy_u + p2 * (rho2_u + 2.0 * mx2_u);
+        double my_d = my_u + my_u * rad_dist_u + 2.0 * p2 * mxy_u + p1 * (rho2_u + 2.0 * my2_u);
+        p[i].x = fx * mx_d + cx;
+        p[i].y = fy * my_d + cy;
+    }
+}
+
 /**
  * \brief Projects an undistorted 2D point p_u to the image plane
  *
@@ -768,6 +852,9 @@ PinholeCamera::initUndistortRectifyMap(cv::Mat& map1, cv::Mat& map2,
 
     Eigen::Matrix3f K_rect_inv = K_rect.inverse();
 
+    // project the rays of one image row at a time
+    std::vector<cv::Point3f> rays(imageSize.width);
+    std::vector<cv::Point2f> p;
     for (int v = 0; v < imageSize.height; ++v)
     {
         for (int u = 0; u < imageSize.width; ++u)
@@ -776,12 +863,15 @@ PinholeCamera::initUndistortRectifyMap(cv::Mat& map1, cv::Mat& map2,
             xo << u, v, 1;
 
             Eigen::Vector3f uo = R_inv * K_rect_inv * xo;
+            rays[u] = cv::Point3f(uo(0), uo(1), uo(2));
+        }
 
-            Eigen::Vector2d p;
-            spaceToPlane(uo.cast<double>(), p);
+        spaceToPlaneBatch(rays, p);
 
-            mapX.at<float>(v,u) = p(0);
-            mapY.at<float>(v,u) = p(1);
+        for (int u = 0; u < imageSize.width; ++u)
+        {
+            mapX.at<float>(v,u) = p[u].x;
+            mapY.at<float>(v,u) = p[u].y;
         }
     }
 
@@ -653,6 +653,77 @@ OCAMCamera::spaceToPlane(const Eigen::Vector3d& P, Eigen::Vector2d& p) const
 }
 
 
+/** 
+ * \brief Lifts a batch of image points to the normalised plane
+ */
+void
+OCAMCamera::liftProjectiveBatch(const std::vector<cv::Point2f>& p,
+                                std::vector<cv::Point2f>& p_u) const
+{
+    double poly[SCARAMUZZA_POLY_SIZE];
+    for (int j = 0; j < SCARAMUZZA_POLY_SIZE; j++)
+    {
+        poly[j] = mParameters.poly(j);
+    }
+    const double cx = mParameters.center_x(), cy = mParameters.center_y();
+    const double C = mParameters.C(), D = mParameters.D(), E = mParameters.E();
+    const double inv_scale = m_inv_scale;
+    const int n = p.size();
+    p_u.resize(n);
+
+    for (int i = 0; i < n; ++i)
+    {
+        double xc0 = p[i].x - cx, xc1 = p[i].y - cy;
+        double xa0 = inv_scale * (xc0 - D * xc1);
+        double xa1 = inv_scale * (-E * xc0 + C * xc1);
+        double phi = std::sqrt(xa0 * xa0 + xa1 * xa1);
+
+        // Horner form of the polynomial in liftProjective
+        double z = poly[SCARAMUZZA_POLY_SIZE - 1];
+        for (int j = SCARAMUZZA_POLY_SIZE - 2; j >= 0; j--)
+        {
+            z = z * phi + poly[j];
+        }
+        p_u[i].x = xc0 / -z;
+        p_u[i].y = xc1 / -z;
+    }
+}
+
+/** 
+ * \brief Projects a batch of 3D points to the image plane
+ */
+void
+OCAMCamera::spaceToPlaneBatch(const std::vector<cv::Point3f>& P,
+                              std::vector<cv::Point2f>& p) const
+{
+    double inv_poly[SCARAMUZZA_INV_POLY_SIZE];
+    for (int j = 0; j < SCARAMUZZA_INV_POLY_SIZE; j++)
+    {
+        inv_poly[j] = mParameters.inv_poly(j);
+    }
+    const double cx = mParameters.center_x(), cy = mParameters.center_y();
+    const double C = mParameters.C(), D = mParameters.D(), E = mParameters.E();
+    const int n = P.size();
+    p.resize(n);
+
+    for (int i = 0; i < n; ++i)
+    {
+        double norm = std::sqrt(P[i].x * P[i].x + P[i].y * P[i].y);
+        double theta = std::atan2(-P[i].z, norm);
+
+        double rho = inv_poly[SCARAMUZZA_INV_POLY_SIZE - 1];
+        for (int j = SCARAMUZZA_INV_POLY_SIZE - 2; j >= 0; j--)
+        {
+            rho = rho * theta + inv_poly[j];
+        }
+
+        double scale = rho / norm;
+        double xn0 = P[i].x * scale, xn1 = P[i].y * scale;
+        p[i].x = xn0 * C + xn1 * D + cx;
+        p[i].y = xn0 * E + xn1 + cy;
+    }
+}
+
 /** 
  * \brief Projects an undistorted 2D point p_u to the image plane
  *
@@ -733,6 +804,9 @@ OCAMCamera::initUndistortRectifyMap(cv::Mat& map1, cv::Mat& map2,
     cv::cv2eigen(rmat, R);
     R_inv = R.inverse();
 
+    // project the rays of one image row at a time
+    std::vector<cv::Point3f> rays(imageSize.width);
+    std::vector<cv::Point2f> p;
     for (int v = 0; v < imageSize.height; ++v)
     {
         for (int u = 0; u < imageSize.width; ++u)
@@ -741,12 +815,15 @@ OCAMCamera::initUndistortRectifyMap(cv::Mat& map1, cv::Mat& map2,
             xo << u, v, 1;
 
             Eigen::Vector3f uo = R_inv * K_rect_inv * xo;
+            rays[u] = cv::Point3f(uo(0), uo(1), uo(2));
+        }
 
-            Eigen::Vector2d p;
-            spaceToPlane(uo.cast<double>(), p);
+        spaceToPlaneBatch(rays, p);
 
-            mapX.at<float>(v,u) = p(0);
-            mapY.at<float>(v,u) = p(1);
+        for (int u = 0; u < imageSize.width; ++u)
+        {
+            mapX.at<float>(v,u) = p[u].x;
+            mapY.at<float>(v,u) = p[u].y;
         }
     }
 
@@ -7,6 +7,7 @@
 #include "camodocal/chessboard/Spline.h"
 
 #define MAX_CONTOUR_APPROX  7
+#define COARSE_IMAGE_SIZE   1024    // larger images are first searched at a pyramid level below this size
 
 namespace camodocal
 {
@@ -28,14 +29,14 @@ Chessboard::Chessboard(cv::Size boardSize, cv::Mat& image)
 }
 
 void
-Chessboard::findCorners(bool useOpenCV)
+Chessboard::findCorners(bool useOpenCV, bool coarseToFine)
 {
     mCornersFound = findChessboardCorners(mImage, mBoardSize, mCorners,
                                           cv::CALIB_CB_ADAPTIVE_THRESH +
                                           cv::CALIB_CB_NORMALIZE_IMAGE +
                                           cv::CALIB_CB_FILTER_QUADS +
                                           cv::CALIB_CB_FAST_CHECK,
-                                          useOpenCV);
+                                          useOpenCV, coarseToFine);
 
     if (mCornersFound)
     {
@@ -72,7 +73,59 @@ bool
 Chessboard::findChessboardCorners(const cv::Mat& image,
                                   const cv::Size& patternSize,
                                   std::vector<cv::Point2f>& corners,
-                                  int flags, bool useOpenCV)
+                                  int flags, bool useOpenCV, bool coarseToFine)
+{
+    int levels = 0;
+    while (coarseToFine && (std::max(image.cols, image.rows) >> levels) > COARSE_IMAGE_SIZE)
+    {
+        ++levels;
+    }
+
+    if (levels > 0)
+    {
+        cv::Mat coarse;
+        cv::pyrDown(image, coarse);
+        for (int i = 1; i < levels; ++i)
+        {
+            cv::pyrDown(coarse, coarse);
+        }
+
+        if (detectChessboardCorners(coarse, patternSize, corners, flags, useOpenCV))
+        {
+            // pyrDown centers pixel i of a level on pixel 2i of the level below
+            float scale = 1 << levels;
+            for (size_t i = 0; i < corners.size(); ++i)
+            {
+                corners[i] *= scale;
+            }
+
+            // keep the refinement window within half of the smallest square
+            float minDist = FLT_MAX;
+            for (int i = 0; i < patternSize.height; ++i)
+            {
+                for (int j = 0; j + 1 < patternSize.width; ++j)
+                {
+                    const cv::Point2f& p = corners[i * patternSize.width + j];
+                    minDist = std::min(minDist, (float)cv::norm(p - corners[i * patternSize.width + j + 1]));
+                }
+            }
+            int winSize = std::max(2, std::min(11, (int)(minDist * 0.5f) - 1));
+
+            cv::cornerSubPix(image, corners, cv::Size(winSize, winSize), cv::Size(-1,-1),
+                             cv::TermCriteria(cv::TermCriteria::EPS + cv::TermCriteria::MAX_ITER, 30, 0.1));
+
+            return true;
+        }
+    }
+
+    return detectChessboardCorners(image, patternSize, corners, flags, useOpenCV);
+}
+
+bool
+Chessboard::detectChessboardCorners(const cv::Mat& image,
+                                    const cv::Size& patternSize,
+                                    std::vector<cv::Point2f>& corners,
+                                    int flags, bool useOpenCV)
 {
     if (useOpenCV)
     {
@@ -177,6 +230,20 @@ Chessboard::findChessboardCornersImproved(const cv::Mat& image,
     bool found = false;
     std::vector<ChessboardCornerPtr> outputCorners;
 
+    // MARTIN's Code
+    // Use both a rectangular and a cross kernel. In this way, a more
+    // homogeneous dilation is performed, which is crucial for small,
+    // distorted checkers. Use the CROSS kernel first, since its action
+    // on the image is more subtle
+    cv::Mat kernel1 = cv::getStructuringElement(cv::MORPH_CROSS, cv::Size(3,3), cv::Point(1,1));
+    cv::Mat kernel2 = cv::getStructuringElement(cv::MORPH_RECT, cv::Size(3,3), cv::Point(1,1));
+
+    // Buffers reused across attempts. The binary image only depends on the
+    // threshold parameters, so it is recomputed when they change and is
+    // otherwise dilated further from the previous attempt.
+    cv::Mat bin_img, dilated_img, thresh_img;
+    int binBlockSize = -1, binDelta = -1, dilatedLevel = -1;
+
     for (int k = 0; k < 6; ++k)
     {
         for (int dilations = minDilations; dilations <= maxDilations; ++dilations)
@@ -186,47 +253,47 @@ Chessboard::findChessboardCornersImproved(const cv::Mat& image,
                 break;
             }
 
-            cv::Mat thresh_img;
-
             // convert the input grayscale image to binary (black-n-white)
             if (flags & cv::CALIB_CB_ADAPTIVE_THRESH)
             {
                 int blockSize = lround(prevSqrSize == 0 ?
                     std::min(img.cols,img.rows)*(k%2 == 0 ? 0.2 : 0.1): prevSqrSize*2)|1;
+                int delta = (k/2)*5;
 
-                // convert to binary
-                cv::adaptiveThreshold(img, thresh_img, 255, cv::ADAPTIVE_THRESH_MEAN_C, cv::THRESH_BINARY, blockSize, (k/2)*5);
+                if (blockSize != binBlockSize || delta != binDelta)
+                {
+                    // convert to binary
+                    cv::adaptiveThreshold(img, bin_img, 255, cv::ADAPTIVE_THRESH_MEAN_C, cv::THRESH_BINARY, blockSize, delta);
+                    binBlockSize = blockSize;
+                    binDelta = delta;
+                    dilatedLevel = -1;
+                }
             }
-            else
+            else if (bin_img.empty())
             {
                 // empiric threshold level
                 double mean = (cv::mean(img))[0];
                 int thresh_level = lround(mean - 10);
                 thresh_level = std::max(thresh_level, 10);
 
-                cv::threshold(img, thresh_img, thresh_level, 255, cv::THRESH_BINARY);
+                cv::threshold(img, bin_img, thresh_level, 255, cv::THRESH_BINARY);
+            }
+
+            // at most 6 dilations are applied, odd ones with the cross kernel
+            // and even ones with the rectangular kernel
+            int dilationLevel = std::min(dilations, 6);
+            if (dilatedLevel < 0 || dilatedLevel > dilationLevel)
+            {
+                bin_img.copyTo(dilated_img);
+                dilatedLevel = 0;
             }
 
-            // MARTIN's Code
-            // Use both a rectangular and a cross kernel. In this way, a more
-            // homogeneous dilation is performed, which is crucial for small,
-            // distorted checkers. Use the CROSS kernel first, since its action
-            // on the image is more subtle
-            cv::Mat kernel1 = cv::getStructuringElement(cv::MORPH_CROSS, cv::Size(3,3), cv::Point(1,1));
-            cv::Mat kernel2 = cv::getStructuringElement(cv::MORPH_RECT, cv::Size(3,3), cv::Point(1,1));
-
-            if (dilations >= 1)
-                cv::dilate(thresh_img, thresh_img, kernel1);
-            if (dilations >= 2)
-                cv::dilate(thresh_img, thresh_img, kernel2);
-            if (dilations >= 3)
-                cv::dilate(thresh_img, thresh_img, kernel1);
-            if (dilations >= 4)
-                cv::dilate(thresh_img, thresh_img, kernel2);
-            if (dilations >= 5)
-                cv::dilate(thresh_img, thresh_img, kernel1);
-            if (dilations >= 6)
-                cv::dilate(thresh_img, thresh_img, kernel2);
+            while (dilatedLevel < dilationLevel)
+            {
+                ++dilatedLevel;
+                cv::dilate(dilated_img, dilated_img, dilatedLevel % 2 == 1 ? kernel1 : kernel2);
+            }
+            dilated_img.copyTo(thresh_img);
 
             // In order to find rectangles that go to the edge, we draw a white
             // line around the image edge. Otherwise FindContours will miss those
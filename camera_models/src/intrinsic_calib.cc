@@ -1,12 +1,15 @@
 #include <algorithm>
+#include <atomic>
 #include <boost/algorithm/string.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/program_options.hpp>
 #include <iomanip>
 #include <iostream>
+#include <mutex>
 #include <opencv2/core/core.hpp>
 #include <opencv2/highgui/highgui.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
+#include <thread>
 
 #include "camodocal/calib/CameraCalibration.h"
 #include "camodocal/chessboard/Chessboard.h"
@@ -25,6 +28,7 @@ main( int argc, char** argv )
     bool useOpenCV;
     bool viewResults;
     bool verbose;
+    int numThreads;
 
     //========= Handling Program options =========
     boost::program_options::options_description desc( "Allowed options" );
@@ -55,7 +59,9 @@ main( int argc, char** argv )
                         "Use OpenCV to detect corners" )(
     "view-results",
     boost::program_options::bool_switch( &viewResults )->default_value( false ),
-    "View results" )( "verbose,v",
+    "View results" )( "threads,t",
+                      boost::program_options::value< int >( &numThreads )->default_value( 0 ),
+                      "Number of threads for detection and optimization, 0 for all cores" )( "verbose,v",
                       boost::program_options::bool_switch( &verbose )->default_value( true ),
                       "Verbose output" );
 
@@ -185,37 +191,89 @@ main( int argc, char** argv )
     camodocal::CameraCalibration calibration( modelType, cameraName, frameSize, boardSize, squareSize );
     calibration.setVerbose( verbose );
 
-    std::vector< bool > chessboardFound( imageFilenames.size( ), false );
-    for ( size_t i = 0; i < imageFilenames.size( ); ++i )
+    if ( numThreads <= 0 )
     {
-        image = cv::imread( imageFilenames.at( i ), -1 );
+        numThreads = std::max( 1, static_cast< int >( std::thread::hardware_concurrency( ) ) );
+    }
+    calibration.setNumThreads( numThreads );
+
+    // detect the chessboards with a pool of workers, each one taking the next unprocessed image
+    double detectStartTime = camodocal::timeInSeconds( );
 
-        camodocal::Chessboard chessboard( boardSize, image );
+    std::vector< char > cornersFound( imageFilenames.size( ), 0 );
+    std::vector< std::vector< cv::Point2f > > corners( imageFilenames.size( ) );
+    std::vector< cv::Mat > sketches( imageFilenames.size( ) );
+    std::atomic< size_t > nextImage( 0 );
+    size_t processedCount = 0;
+    std::mutex outputMutex;
 
-        chessboard.findCorners( useOpenCV );
-        if ( chessboard.cornersFound( ) )
+    auto detectChessboards = [&]( ) {
+        for ( size_t i = nextImage++; i < imageFilenames.size( ); i = nextImage++ )
         {
-            if ( verbose )
+            cv::Mat workerImage = cv::imread( imageFilenames.at( i ), -1 );
+
+            camodocal::Chessboard chessboard( boardSize, workerImage );
+
+            chessboard.findCorners( useOpenCV );
+            cornersFound.at( i ) = chessboard.cornersFound( );
+            if ( cornersFound.at( i ) )
             {
-                std::cerr << "# INFO: Detected chessboard in image " << i + 1 << ", "
-                          << imageFilenames.at( i ) << std::endl;
+                corners.at( i ) = chessboard.getCorners( );
+                if ( viewResults )
+                {
+                    chessboard.getSketch( ).copyTo( sketches.at( i ) );
+                }
             }
 
-            calibration.addChessboardData( chessboard.getCorners( ) );
+            std::lock_guard< std::mutex > lock( outputMutex );
+            ++processedCount;
+            if ( verbose )
+            {
+                std::cerr << "# INFO: [" << processedCount << "/" << imageFilenames.size( ) << "] "
+                          << ( cornersFound.at( i ) ? "Detected" : "Did not detect" )
+                          << " chessboard in image " << i + 1 << ", " << imageFilenames.at( i ) << std::endl;
+            }
+        }
+    };
 
-            cv::Mat sketch;
-            chessboard.getSketch( ).copyTo( sketch );
+    std::vector< std::thread > workers;
+    for ( int k = 0; k < numThreads; ++k )
+    {
+        workers.push_back( std::thread( detectChessboards ) );
+    }
+    for ( size_t k = 0; k < workers.size( ); ++k )
+    {
+        workers.at( k ).join( );
+    }
 
-            cv::imshow( "Image", sketch );
-            cv::waitKey( 50 );
+    // add the detections in image order so the result does not depend on the scheduling
+    std::vector< bool > chessboardFound( imageFilenames.size( ), false );
+    for ( size_t i = 0; i < imageFilenames.size( ); ++i )
+    {
+        chessboardFound.at( i ) = cornersFound.at( i );
+        if ( !chessboardFound.at( i ) )
+        {
+            continue;
         }
-        else if ( verbose )
+
+        calibration.addChessboardData( corners.at( i ) );
+
+        if ( viewResults )
         {
-            std::cerr << "# INFO: Did not detect chessboard in image " << i + 1 << std::endl;
+            cv::imshow( "Image", sketches.at( i ) );
+            cv::waitKey( 50 );
         }
-        chessboardFound.at( i ) = chessboard.cornersFound( );
     }
-    cv::destroyWindow( "Image" );
+    if ( viewResults )
+    {
+        cv::destroyWindow( "Image" );
+    }
+    sketches.clear( );
+
+    double detectTime = camodocal::timeInSeconds( ) - detectStartTime;
+    std::cout << "# INFO: Detected chessboards in " << calibration.sampleCount( ) << " of "
+              << imageFilenames.size( ) << " images with " << numThreads << " threads in "
+              << std::fixed << std::setprecision( 3 ) << detectTime << " sec." << std::endl;
 
     if ( calibration.sampleCount( ) < 10 )
     {
@@ -238,6 +296,8 @@ main( int argc, char** argv )
     {
         std::cout << "# INFO: Calibration took a total time of " << std::fixed
                   << std::setprecision( 3 ) << camodocal::timeInSeconds( ) - startTime << " sec.\n";
+        std::cout << "# INFO: Detection and calibration took " << std::fixed << std::setprecision( 3 )
+                  << camodocal::timeInSeconds( ) - detectStartTime << " sec.\n";
     }
 
     if ( verbose )
@@ -0,0 +1,145 @@
+#include <algorithm>
+#include <boost/program_options.hpp>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <opencv2/core/core.hpp>
+#include <vector>
+
+#include "camodocal/camera_models/CameraFactory.h"
+
+// Throughput of the per-point and batch projection paths of each camera model,
+// and the largest difference between the two.
+
+static double
+elapsedMs( const std::chrono::steady_clock::time_point& start )
+{
+    return std::chrono::duration< double, std::milli >( std::chrono::steady_clock::now( ) - start ).count( );
+}
+
+static void
+benchmarkCamera( const camodocal::CameraPtr& camera, int nPoints, int nRuns )
+{
+    // pixels spread over the whole image, repeated up to nPoints
+    int width  = camera->imageWidth( );
+    int height = camera->imageHeight( );
+    std::vector< cv::Point2f > pixels( nPoints );
+    for ( int i = 0; i < nPoints; ++i )
+    {
+        int idx   = i % ( width * height );
+        pixels[i] = cv::Point2f( idx % width + 0.5f, idx / width + 0.5f );
+    }
+
+    std::vector< cv::Point2f > rays_single( nPoints ), rays_batch;
+    double t_single = 1e12, t_batch = 1e12;
+    for ( int run = 0; run < nRuns; ++run )
+    {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now( );
+        for ( int i = 0; i < nPoints; ++i )
+        {
+            Eigen::Vector3d P;
+            camera->liftProjective( Eigen::Vector2d( pixels[i].x, pixels[i].y ), P );
+            rays_single[i] = cv::Point2f( P( 0 ) / P( 2 ), P( 1 ) / P( 2 ) );
+        }
+        t_single = std::min( t_single, elapsedMs( start ) );
+
+        start = std::chrono::steady_clock::now( );
+        camera->liftProjectiveBatch( pixels, rays_batch );
+        t_batch = std::min( t_batch, elapsedMs( start ) );
+    }
+
+    double lift_err = 0;
+    for ( int i = 0; i < nPoints; ++i )
+        if ( std::isfinite( rays_single[i].x ) && std::isfinite( rays_single[i].y ) )
+            lift_err = std::max( lift_err, cv::norm( rays_single[i] - rays_batch[i] ) );
+
+    std::cout << "  liftProjective: " << nPoints / t_single * 1e-3 << " Mpts/s, batch "
+              << nPoints / t_batch * 1e-3 << " Mpts/s, max ray difference " << lift_err << std::endl;
+
+    std::vector< cv::Point3f > rays( nPoints );
+    for ( int i = 0; i < nPoints; ++i )
+        rays[i] = cv::Point3f( rays_single[i].x, rays_single[i].y, 1.f );
+
+    std::vector< cv::Point2f > proj_single( nPoints ), proj_batch;
+    t_single = 1e12, t_batch = 1e12;
+    for ( int run = 0; run < nRuns; ++run )
+    {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now( );
+        for ( int i = 0; i < nPoints; ++i )
+        {
+            Eigen::Vector2d p;
+            camera->spaceToPlane( Eigen::Vector3d( rays[i].x, rays[i].y, rays[i].z ), p );
+            proj_single[i] = cv::Point2f( p( 0 ), p( 1 ) );
+        }
+        t_single = std::min( t_single, elapsedMs( start ) );
+
+        start = std::chrono::steady_clock::now( );
+        camera->spaceToPlaneBatch( rays, proj_batch );
+        t_batch = std::min( t_batch, elapsedMs( start ) );
+    }
+
+    double proj_err = 0, round_trip_err = 0;
+    for ( int i = 0; i < nPoints; ++i )
+    {
+        if ( !std::isfinite( proj_single[i].x ) || !std::isfinite( proj_single[i].y ) )
+            continue;
+        proj_err       = std::max( proj_err, cv::norm( proj_single[i] - proj_batch[i] ) );
+        round_trip_err = std::max( round_trip_err, cv::norm( pixels[i] - proj_batch[i] ) );
+    }
+
+    std::cout << "  spaceToPlane:   " << nPoints / t_single * 1e-3 << " Mpts/s, batch "
+              << nPoints / t_batch * 1e-3 << " Mpts/s, max pixel difference " << proj_err
+              << ", max round trip error " << round_trip_err << " px" << std::endl;
+}
+
+int
+main( int argc, char** argv )
+{
+    std::vector< std::string > cameraFiles;
+    int nPoints;
+    int nRuns;
+
+    //========= Handling Program options =========
+    boost::program_options::options_description desc( "Allowed options" );
+    desc.add_options( )( "help", "produce help message" )(
+    "camera,c",
+    boost::program_options::value< std::vector< std::string > >( &cameraFiles ),
+    "Camera calibration file(s)" )(
+    "points,n",
+    boost::program_options::value< int >( &nPoints )->default_value( 1000000 ),
+    "Number of points per run" )(
+    "runs,r",
+    boost::program_options::value< int >( &nRuns )->default_value( 5 ),
+    "Number of runs, the fastest one is reported" );
+
+    boost::program_options::positional_options_description pdesc;
+    pdesc.add( "camera", -1 );
+
+    boost::program_options::variables_map vm;
+    boost::program_options::store(
+    boost::program_options::command_line_parser( argc, argv ).options( desc ).positional( pdesc ).run( ), vm );
+    boost::program_options::notify( vm );
+
+    if ( vm.count( "help" ) || cameraFiles.empty( ) )
+    {
+        std::cout << desc << std::endl;
+        return 1;
+    }
+
+    for ( size_t i = 0; i < cameraFiles.size( ); ++i )
+    {
+        camodocal::CameraPtr camera
+        = camodocal::CameraFactory::instance( )->generateCameraFromYamlFile( cameraFiles[i] );
+        if ( !camera )
+        {
+            std::cerr << "# ERROR: Unable to read " << cameraFiles[i] << std::endl;
+            continue;
+        }
+
+        std::cout << "# INFO: " << cameraFiles[i] << " (" << camera->cameraName( ) << ", "
+                  << camera->imageWidth( ) << "x" << camera->imageHeight( ) << ")" << std::endl;
+        benchmarkCamera( camera, nPoints, nRuns );
+    }
+
+    return 0;
+}
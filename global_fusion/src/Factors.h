@@ -12,6 +12,7 @@
 #pragma once
 #include <ceres/ceres.h>
 #include <ceres/rotation.h>
+#include <eigen3/Eigen/Dense>
 
 template <typename T> inline
 void QuaternionInverse(const T q[4], T q_inverse[4])
@@ -111,4 +112,77 @@ struct RelativeRTError
 	double q_w, q_x, q_y, q_z;
 	double t_var, q_var;
 
-};
\ No newline at end of file
+};
+
+// prior on the first pose of the sliding window, left by the marginalized poses.
+// The rotation error lives in the tangent space of ceres::QuaternionParameterization (q = exp(d) * q0)
+struct PriorError
+{
+	PriorError(const double *_pose, const double *_sqrt_info)
+	{
+		for (int i = 0; i < 7; i++)
+			pose[i] = _pose[i];
+		for (int i = 0; i < 36; i++)
+			sqrt_info[i] = _sqrt_info[i];
+	}
+
+	template <typename T>
+	bool operator()(const T* const w_q_i, const T* ti, T* residuals) const
+	{
+		T prior_q_inv[4];
+		prior_q_inv[0] = T(pose[3]);
+		prior_q_inv[1] = T(-pose[4]);
+		prior_q_inv[2] = T(-pose[5]);
+		prior_q_inv[3] = T(-pose[6]);
+
+		T error_q[4];
+		ceres::QuaternionProduct(w_q_i, prior_q_inv, error_q);
+		T sign = error_q[0] < T(0) ? T(-1) : T(1);
+
+		T error[6];
+		error[0] = sign * error_q[1];
+		error[1] = sign * error_q[2];
+		error[2] = sign * error_q[3];
+		error[3] = ti[0] - T(pose[0]);
+		error[4] = ti[1] - T(pose[1]);
+		error[5] = ti[2] - T(pose[2]);
+
+		for (int r = 0; r < 6; r++)
+		{
+			residuals[r] = T(0);
+			for (int c = 0; c < 6; c++)
+				residuals[r] += T(sqrt_info[r * 6 + c]) * error[c];
+		}
+		return true;
+	}
+
+	static ceres::CostFunction* Create(const double *pose, const double *sqrt_info) 
+	{
+	  return (new ceres::AutoDiffCostFunction<
+	          PriorError, 6, 4, 3>(
+	          	new PriorError(pose, sqrt_info)));
+	}
+
+	double pose[7];             // tx,ty,tz,qw,qx,qy,qz
+	double sqrt_info[36];       // row major, rotation error first
+
+};
+
+// relative pose between two vio poses as a factor between the matching global poses
+inline ceres::CostFunction* relativeFactor(const double *poseI, const double *poseJ)
+{
+	Eigen::Matrix4d wTi = Eigen::Matrix4d::Identity();
+	Eigen::Matrix4d wTj = Eigen::Matrix4d::Identity();
+	wTi.block<3, 3>(0, 0) = Eigen::Quaterniond(poseI[3], poseI[4], poseI[5], poseI[6]).toRotationMatrix();
+	wTi.block<3, 1>(0, 3) = Eigen::Vector3d(poseI[0], poseI[1], poseI[2]);
+	wTj.block<3, 3>(0, 0) = Eigen::Quaterniond(poseJ[3], poseJ[4], poseJ[5], poseJ[6]).toRotationMatrix();
+	wTj.block<3, 1>(0, 3) = Eigen::Vector3d(poseJ[0], poseJ[1], poseJ[2]);
+	Eigen::Matrix4d iTj = wTi.inverse() * wTj;
+	Eigen::Quaterniond iQj;
+	iQj = iTj.block<3, 3>(0, 0);
+	Eigen::Vector3d iPj = iTj.block<3, 1>(0, 3);
+
+	return RelativeRTError::Create(iPj.x(), iPj.y(), iPj.z(),
+	                               iQj.w(), iQj.x(), iQj.y(), iQj.z(),
+	                               0.1, 0.01);
+}
@@ -0,0 +1,91 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ * 
+ * This file is part of VINS.
+ * 
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#include "geoConverter.h"
+#include <algorithm>
+
+GeoConverter::GeoConverter()
+{
+    initialized = false;
+    double f = GeographicLib::Constants::WGS84_f();
+    a = GeographicLib::Constants::WGS84_a();
+    e2 = f * (2 - f);
+    e2m = (1 - f) * (1 - f);
+}
+
+void GeoConverter::Reset(double _lat0, double _lon0, double _h0)
+{
+    lat0 = _lat0;
+    lon0 = _lon0;
+    h0 = _h0;
+    double phi = lat0 * M_PI / 180.0, lam = lon0 * M_PI / 180.0;
+    double sphi = sin(phi), cphi = cos(phi), slam = sin(lam), clam = cos(lam);
+    double n = a / sqrt(1 - e2 * sphi * sphi);
+    origin << (n + h0) * cphi * clam, (n + h0) * cphi * slam, (e2m * n + h0) * sphi;
+    R << -slam,         clam,         0,
+         -sphi * clam, -sphi * slam,  cphi,
+          cphi * clam,  cphi * slam,  sphi;
+    initialized = true;
+}
+
+void GeoConverter::Forward(double lat, double lon, double h, double *xyz) const
+{
+    forwardBlock(1, &lat, &lon, &h, xyz);
+}
+
+void GeoConverter::Forward(int n, const double *lat, const double *lon, const double *h, double *xyz) const
+{
+    for (int i = 0; i < n; i += GEO_BATCH_SIZE)
+    {
+        int m = std::min(GEO_BATCH_SIZE, n - i);
+        forwardBlock(m, lat + i, lon + i, h + i, xyz + 3 * i);
+    }
+}
+
+void GeoConverter::forwardBlock(int n, const double *lat, const double *lon, const double *h, double *xyz) const
+{
+    Eigen::Map<const Eigen::ArrayXd> latA(lat, n), lonA(lon, n), hA(h, n);
+    Eigen::ArrayXd phi = latA * (M_PI / 180.0);
+    Eigen::ArrayXd lam = lonA * (M_PI / 180.0);
+    Eigen::ArrayXd sphi = phi.sin(), cphi = phi.cos();
+    Eigen::ArrayXd slam = lam.sin(), clam = lam.cos();
+    Eigen::ArrayXd N = a / (1 - e2 * sphi.square()).sqrt();
+
+    Eigen::Matrix3Xd ecef(3, n);
+    ecef.row(0) = ((N + hA) * cphi * clam - origin(0)).matrix().transpose();
+    ecef.row(1) = ((N + hA) * cphi * slam - origin(1)).matrix().transpose();
+    ecef.row(2) = ((e2m * N + hA) * sphi - origin(2)).matrix().transpose();
+    Eigen::Map<Eigen::Matrix3Xd>(xyz, 3, n).noalias() = R * ecef;
+}
+
+double GeoConverter::checkAccuracy(double radius_deg, int steps) const
+{
+    GeographicLib::LocalCartesian reference(lat0, lon0, h0);
+    int n = (2 * steps + 1) * (2 * steps + 1);
+    Eigen::ArrayXd lat(n), lon(n), h(n);
+    int k = 0;
+    for (int i = -steps; i <= steps; i++)
+        for (int j = -steps; j <= steps; j++, k++)
+        {
+            lat(k) = lat0 + radius_deg * i / steps;
+            lon(k) = lon0 + radius_deg * j / steps;
+            h(k) = h0 + 100.0 * (i + j);
+        }
+    Eigen::Matrix3Xd xyz(3, n);
+    Forward(n, lat.data(), lon.data(), h.data(), xyz.data());
+
+    double max_err = 0;
+    for (k = 0; k < n; k++)
+    {
+        double x, y, z;
+        reference.Forward(lat(k), lon(k), h(k), x, y, z);
+        max_err = std::max(max_err, (xyz.col(k) - Eigen::Vector3d(x, y, z)).norm());
+    }
+    return max_err;
+}
@@ -0,0 +1,41 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ * 
+ * This file is part of VINS.
+ * 
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#pragma once
+#include <eigen3/Eigen/Dense>
+#include "LocalCartesian.hpp"
+
+#define GEO_BATCH_SIZE 1024         // fixes converted per block in the batch path
+
+// WGS84 latitude/longitude/altitude to the local ENU frame of a reference point,
+// same result as GeographicLib::LocalCartesian::Forward but for arrays of fixes.
+// The reference rotation and ECEF origin are computed once in Reset, the trig of
+// each block runs through Eigen array expressions so it is vectorized where Eigen
+// has packet kernels
+class GeoConverter
+{
+public:
+	GeoConverter();
+	void Reset(double lat0, double lon0, double h0);
+	bool isInitialized() const { return initialized; }
+	void Forward(double lat, double lon, double h, double *xyz) const;
+	// xyz holds n fixes as x0,y0,z0,x1,y1,z1,...
+	void Forward(int n, const double *lat, const double *lon, const double *h, double *xyz) const;
+	// max distance (m) to GeographicLib::LocalCartesian over a grid around the reference point
+	double checkAccuracy(double radius_deg = 0.5, int steps = 20) const;
+
+private:
+	void forwardBlock(int n, const double *lat, const double *lon, const double *h, double *xyz) const;
+
+	bool initialized;
+	double a, e2, e2m;
+	double lat0, lon0, h0;
+	Eigen::Vector3d origin;     // reference point in ECEF
+	Eigen::Matrix3d R;          // ECEF to ENU
+};
@@ -12,11 +12,62 @@
 #include "globalOpt.h"
 #include "Factors.h"
 
+// accumulate J^T J and J^T r of one residual block, in the local tangent space of its parameter blocks
+static void linearize(ceres::CostFunction *cost_function, ceres::LossFunction *loss_function,
+                      double **para, const int *offset,
+                      Eigen::Matrix<double, 12, 12> &H, Eigen::Matrix<double, 12, 1> &b)
+{
+    const vector<int> &sizes = cost_function->parameter_block_sizes();
+    int num_blocks = sizes.size();
+    int num_residuals = cost_function->num_residuals();
+    Eigen::VectorXd residual(num_residuals);
+    vector<Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>> jacobians(num_blocks);
+    vector<double*> jacobian_ptr(num_blocks);
+    for (int k = 0; k < num_blocks; k++)
+    {
+        jacobians[k].resize(num_residuals, sizes[k]);
+        jacobian_ptr[k] = jacobians[k].data();
+    }
+    cost_function->Evaluate(para, residual.data(), jacobian_ptr.data());
+
+    double scale = 1.0;
+    if (loss_function)
+    {
+        double rho[3];
+        loss_function->Evaluate(residual.squaredNorm(), rho);
+        scale = sqrt(rho[1]);
+    }
+
+    ceres::QuaternionParameterization local_parameterization;
+    vector<Eigen::MatrixXd> local_jacobians(num_blocks);
+    for (int k = 0; k < num_blocks; k++)
+    {
+        if (sizes[k] == 4)
+        {
+            Eigen::Matrix<double, 4, 3, Eigen::RowMajor> plus_jacobian;
+            local_parameterization.ComputeJacobian(para[k], plus_jacobian.data());
+            local_jacobians[k] = scale * jacobians[k] * plus_jacobian;
+        }
+        else
+            local_jacobians[k] = scale * jacobians[k];
+    }
+    residual *= scale;
+    for (int k = 0; k < num_blocks; k++)
+    {
+        for (int l = 0; l < num_blocks; l++)
+            H.block<3, 3>(offset[k], offset[l]) += local_jacobians[k].transpose() * local_jacobians[l];
+        b.segment<3>(offset[k]) += local_jacobians[k].transpose() * residual;
+    }
+}
+
 GlobalOptimization::GlobalOptimization()
 {
-	initGPS = false;
     newGPS = false;
 	WGPS_T_WVIO = Eigen::Matrix4d::Identity();
+    margTime = -1;
+    hasPrior = false;
+    maxOptRate = GLOBAL_OPT_MAX_RATE;
+    pathUpdateStart = 0;
     threadOpt = std::thread(&GlobalOptimization::optimize, this);
 }
 
@@ -27,12 +78,13 @@ GlobalOptimization::~GlobalOptimization()
 
 void GlobalOptimization::GPS2XYZ(double latitude, double longitude, double altitude, double* xyz)
 {
-    if(!initGPS)
+    if(!geoConverter.isInitialized())
     {
         geoConverter.Reset(latitude, longitude, altitude);
-        initGPS = true;
+        printf("gps origin la: %f lo: %f al: %f, conversion error %e m\n", latitude, longitude, altitude, 
+               geoConverter.checkAccuracy());
     }
-    geoConverter.Forward(latitude, longitude, altitude, xyz[0], xyz[1], xyz[2]);
+    geoConverter.Forward(latitude, longitude, altitude, xyz);
     //printf("la: %f lo: %f al: %f\n", latitude, longitude, altitude);
     //printf("gps x: %f y: %f z: %f\n", xyz[0], xyz[1], xyz[2]);
 }
@@ -40,60 +92,137 @@ void GlobalOptimization::GPS2XYZ(double latitude, double longitude, double altit
 void GlobalOptimization::inputOdom(double t, Eigen::Vector3d OdomP, Eigen::Quaterniond OdomQ)
 {
 	mPoseMap.lock();
-    vector<double> localPose{OdomP.x(), OdomP.y(), OdomP.z(), 
-    					     OdomQ.w(), OdomQ.x(), OdomQ.y(), OdomQ.z()};
-    localPoseMap[t] = localPose;
+    PoseRecord record;
+    record.t = t;
+    record.localPose[0] = OdomP.x();
+    record.localPose[1] = OdomP.y();
+    record.localPose[2] = OdomP.z();
+    record.localPose[3] = OdomQ.w();
+    record.localPose[4] = OdomQ.x();
+    record.localPose[5] = OdomQ.y();
+    record.localPose[6] = OdomQ.z();
+    record.hasGPS = false;
+    alignGlobalPose(record);
+    lastP = Eigen::Vector3d(record.globalPose[0], record.globalPose[1], record.globalPose[2]);
+    lastQ = Eigen::Quaterniond(record.globalPose[3], record.globalPose[4], record.globalPose[5], record.globalPose[6]);
 
-
-    Eigen::Quaterniond globalQ;
-    globalQ = WGPS_T_WVIO.block<3, 3>(0, 0) * OdomQ;
-    Eigen::Vector3d globalP = WGPS_T_WVIO.block<3, 3>(0, 0) * OdomP + WGPS_T_WVIO.block<3, 1>(0, 3);
-    vector<double> globalPose{globalP.x(), globalP.y(), globalP.z(),
-                              globalQ.w(), globalQ.x(), globalQ.y(), globalQ.z()};
-    globalPoseMap[t] = globalPose;
-    lastP = globalP;
-    lastQ = globalQ;
-
-    geometry_msgs::PoseStamped pose_stamped;
-    pose_stamped.header.stamp = ros::Time(t);
-    pose_stamped.header.frame_id = "world";
-    pose_stamped.pose.position.x = lastP.x();
-    pose_stamped.pose.position.y = lastP.y();
-    pose_stamped.pose.position.z = lastP.z();
-    pose_stamped.pose.orientation.x = lastQ.x();
-    pose_stamped.pose.orientation.y = lastQ.y();
-    pose_stamped.pose.orientation.z = lastQ.z();
-    pose_stamped.pose.orientation.w = lastQ.w();
-    global_path.header = pose_stamped.header;
-    global_path.poses.push_back(pose_stamped);
+    // odometry comes in order, an older or repeated stamp is put in place
+    if (poseSeries.empty() || t > poseSeries.back().t)
+    {
+        poseSeries.push_back(record);
+        updateGlobalPath(poseSeries.size() - 1);
+    }
+    else
+    {
+        int i = lower_bound(poseSeries.begin(), poseSeries.end(), t,
+                            [](const PoseRecord &r, double t) { return r.t < t; }) - poseSeries.begin();
+        if (poseSeries[i].t == t)
+        {
+            record.hasGPS = poseSeries[i].hasGPS;
+            memcpy(record.GPSPosition, poseSeries[i].GPSPosition, sizeof(record.GPSPosition));
+            poseSeries[i] = record;
+        }
+        else
+            poseSeries.insert(poseSeries.begin() + i, record);
+        updateGlobalPath(i);
+    }
 
     mPoseMap.unlock();
 }
 
+void GlobalOptimization::setMaxOptRate(double rate)
+{
+    if (rate > 0)
+        maxOptRate = rate;
+}
+
 void GlobalOptimization::getGlobalOdom(Eigen::Vector3d &odomP, Eigen::Quaterniond &odomQ)
 {
     odomP = lastP;
     odomQ = lastQ;
 }
 
+// global poses changed since the last call, in time order; a subscriber keeps the full path
+// by dropping its poses from the first stamp of the update on and appending the update
+bool GlobalOptimization::getPathUpdate(nav_msgs::Path &update)
+{
+    mPoseMap.lock();
+    fillPath(update, min(pathUpdateStart, (int)poseSeries.size()));
+    pathUpdateStart = poseSeries.size();
+    mPoseMap.unlock();
+    return !update.poses.empty();
+}
+
+// the newest size global poses
+void GlobalOptimization::getRecentPath(nav_msgs::Path &path, int size)
+{
+    mPoseMap.lock();
+    fillPath(path, poseSeries.size() - min(size, (int)poseSeries.size()));
+    mPoseMap.unlock();
+}
+
 void GlobalOptimization::inputGPS(double t, double latitude, double longitude, double altitude, double posAccuracy)
 {
 	double xyz[3];
+    mPoseMap.lock();
 	GPS2XYZ(latitude, longitude, altitude, xyz);
-	vector<double> tmp{xyz[0], xyz[1], xyz[2], posAccuracy};
-    //printf("new gps: t: %f x: %f y: %f z:%f \n", t, tmp[0], tmp[1], tmp[2]);
-	GPSPositionMap[t] = tmp;
-    newGPS = true;
+    //printf("new gps: t: %f x: %f y: %f z:%f \n", t, xyz[0], xyz[1], xyz[2]);
+    if (attachGPS(t, xyz, posAccuracy))
+        newGPS = true;
+    mPoseMap.unlock();
+    conGPS.notify_one();
+}
+
+// bulk import, the fixes are converted together and trigger a single optimization
+void GlobalOptimization::inputGPS(const vector<double> &t, const vector<double> &latitude, const vector<double> &longitude,
+                                  const vector<double> &altitude, const vector<double> &posAccuracy)
+{
+    int n = t.size();
+    if (n == 0)
+        return;
+    vector<double> xyz(3 * n);
+    mPoseMap.lock();
+    if(!geoConverter.isInitialized())
+        GPS2XYZ(latitude[0], longitude[0], altitude[0], xyz.data());
+    geoConverter.Forward(n, latitude.data(), longitude.data(), altitude.data(), xyz.data());
+    for (int i = 0; i < n; i++)
+        if (attachGPS(t[i], &xyz[3 * i], posAccuracy[i]))
+            newGPS = true;
+    mPoseMap.unlock();
+    conGPS.notify_one();
+}
 
+// put a converted fix on the pose with the same stamp, called with mPoseMap held
+bool GlobalOptimization::attachGPS(double t, const double *xyz, double posAccuracy)
+{
+    int i = findPose(t);
+    if (i < 0)
+        return false;
+    PoseRecord &record = poseSeries[i];
+    record.hasGPS = true;
+    record.GPSPosition[0] = xyz[0];
+    record.GPSPosition[1] = xyz[1];
+    record.GPSPosition[2] = xyz[2];
+    record.GPSPosition[3] = posAccuracy;
+    return true;
 }
 
 void GlobalOptimization::optimize()
 {
     while(true)
     {
-        if(newGPS)
+        // wake up on a new gps fix, no faster than maxOptRate; fixes coming in
+        // while waiting or solving are coalesced into the next solve
+        std::unique_lock<std::mutex> lock(mPoseMap);
+        conGPS.wait(lock, [&]{ return newGPS; });
+        lock.unlock();
+        std::chrono::duration<double> sinceLast = std::chrono::steady_clock::now() - lastOptTime;
+        std::chrono::duration<double> minInterval(1.0 / maxOptRate);
+        if (sinceLast < minInterval)
+            std::this_thread::sleep_for(minInterval - sinceLast);
+        lastOptTime = std::chrono::steady_clock::now();
+
         {
-            newGPS = false;
             printf("global optimization\n");
             TicToc globalOptimizationTime;
 
@@ -108,162 +237,227 @@ void GlobalOptimization::optimize()
             loss_function = new ceres::HuberLoss(1.0);
             ceres::LocalParameterization* local_parameterization = new ceres::QuaternionParameterization();
 
-            //add param
+            // copy the window out, the lock is not held while solving
+            // the window holds the last GLOBAL_WINDOW_SIZE poses, the ones that slid out of it
+            // since the last solve are marginalized into the prior on its first pose
             mPoseMap.lock();
-            int length = localPoseMap.size();
-            // w^t_i   w^q_i
-            double t_array[length][3];
-            double q_array[length][4];
-            map<double, vector<double>>::iterator iter;
-            iter = globalPoseMap.begin();
-            for (int i = 0; i < length; i++, iter++)
+            newGPS = false;
+            bool firstOpt = margTime < 0;
+            int windowStart = max(0, (int)poseSeries.size() - GLOBAL_WINDOW_SIZE);
+            int start = windowStart;
+            if (!firstOpt)
             {
-                t_array[i][0] = iter->second[0];
-                t_array[i][1] = iter->second[1];
-                t_array[i][2] = iter->second[2];
-                q_array[i][0] = iter->second[3];
-                q_array[i][1] = iter->second[4];
-                q_array[i][2] = iter->second[5];
-                q_array[i][3] = iter->second[6];
-                problem.AddParameterBlock(q_array[i], 4, local_parameterization);
-                problem.AddParameterBlock(t_array[i], 3);
+                int margIndex = findPose(margTime);
+                if (margIndex < 0)
+                    hasPrior = false;
+                else if (margIndex < windowStart)
+                    start = margIndex;
+                else
+                    start = windowStart = margIndex;
             }
+            // w^t_i   w^q_i
+            vector<PoseRecord> window(poseSeries.begin() + start, poseSeries.end());
+            mPoseMap.unlock();
+            int length = window.size();
+            int marg_num = windowStart - start;
 
-            map<double, vector<double>>::iterator iterVIO, iterVIONext, iterGPS;
-            int i = 0;
-            for (iterVIO = localPoseMap.begin(); iterVIO != localPoseMap.end(); iterVIO++, i++)
+            if (length > 0)
             {
-                //vio factor
-                iterVIONext = iterVIO;
-                iterVIONext++;
-                if(iterVIONext != localPoseMap.end())
+                for (int i = 0; i < marg_num; i++)
+                    marginalizePose(window[i], window[i + 1]);
+                margTime = window[marg_num].t;
+
+                //add param
+                for (int i = marg_num; i < length; i++)
+                {
+                    problem.AddParameterBlock(window[i].globalPose + 3, 4, local_parameterization);
+                    problem.AddParameterBlock(window[i].globalPose, 3);
+                }
+
+                if (hasPrior)
                 {
-                    Eigen::Matrix4d wTi = Eigen::Matrix4d::Identity();
-                    Eigen::Matrix4d wTj = Eigen::Matrix4d::Identity();
-                    wTi.block<3, 3>(0, 0) = Eigen::Quaterniond(iterVIO->second[3], iterVIO->second[4], 
-                                                               iterVIO->second[5], iterVIO->second[6]).toRotationMatrix();
-                    wTi.block<3, 1>(0, 3) = Eigen::Vector3d(iterVIO->second[0], iterVIO->second[1], iterVIO->second[2]);
-                    wTj.block<3, 3>(0, 0) = Eigen::Quaterniond(iterVIONext->second[3], iterVIONext->second[4], 
-                                                               iterVIONext->second[5], iterVIONext->second[6]).toRotationMatrix();
-                    wTj.block<3, 1>(0, 3) = Eigen::Vector3d(iterVIONext->second[0], iterVIONext->second[1], iterVIONext->second[2]);
-                    Eigen::Matrix4d iTj = wTi.inverse() * wTj;
-                    Eigen::Quaterniond iQj;
-                    iQj = iTj.block<3, 3>(0, 0);
-                    Eigen::Vector3d iPj = iTj.block<3, 1>(0, 3);
-
-                    ceres::CostFunction* vio_function = RelativeRTError::Create(iPj.x(), iPj.y(), iPj.z(),
-                                                                                iQj.w(), iQj.x(), iQj.y(), iQj.z(),
-                                                                                0.1, 0.01);
-                    problem.AddResidualBlock(vio_function, NULL, q_array[i], t_array[i], q_array[i+1], t_array[i+1]);
-
-                    /*
-                    double **para = new double *[4];
-                    para[0] = q_array[i];
-                    para[1] = t_array[i];
-                    para[3] = q_array[i+1];
-                    para[4] = t_array[i+1];
-
-                    double *tmp_r = new double[6];
-                    double **jaco = new double *[4];
-                    jaco[0] = new double[6 * 4];
-                    jaco[1] = new double[6 * 3];
-                    jaco[2] = new double[6 * 4];
-                    jaco[3] = new double[6 * 3];
-                    vio_function->Evaluate(para, tmp_r, jaco);
-
-                    std::cout << Eigen::Map<Eigen::Matrix<double, 6, 1>>(tmp_r).transpose() << std::endl
-                        << std::endl;
-                    std::cout << Eigen::Map<Eigen::Matrix<double, 6, 4, Eigen::RowMajor>>(jaco[0]) << std::endl
-                        << std::endl;
-                    std::cout << Eigen::Map<Eigen::Matrix<double, 6, 3, Eigen::RowMajor>>(jaco[1]) << std::endl
-                        << std::endl;
-                    std::cout << Eigen::Map<Eigen::Matrix<double, 6, 4, Eigen::RowMajor>>(jaco[2]) << std::endl
-                        << std::endl;
-                    std::cout << Eigen::Map<Eigen::Matrix<double, 6, 3, Eigen::RowMajor>>(jaco[3]) << std::endl
-                        << std::endl;
-                    */
+                    ceres::CostFunction* prior_function = PriorError::Create(priorPose, priorSqrtInfo);
+                    problem.AddResidualBlock(prior_function, NULL, window[marg_num].globalPose + 3, window[marg_num].globalPose);
+                }
 
+                for (int i = marg_num; i < length; i++)
+                {
+                    //vio factor
+                    if (i + 1 < length)
+                    {
+                        ceres::CostFunction* vio_function = relativeFactor(window[i].localPose, window[i + 1].localPose);
+                        problem.AddResidualBlock(vio_function, NULL, window[i].globalPose + 3, window[i].globalPose, 
+                                                 window[i + 1].globalPose + 3, window[i + 1].globalPose);
+                    }
+                    //gps factor
+                    if (window[i].hasGPS)
+                    {
+                        ceres::CostFunction* gps_function = TError::Create(window[i].GPSPosition[0], window[i].GPSPosition[1], 
+                                                                           window[i].GPSPosition[2], window[i].GPSPosition[3]);
+                        //printf("inverse weight %f \n", window[i].GPSPosition[3]);
+                        problem.AddResidualBlock(gps_function, loss_function, window[i].globalPose);
+                    }
                 }
-                //gps factor
-                double t = iterVIO->first;
-                iterGPS = GPSPositionMap.find(t);
-                if (iterGPS != GPSPositionMap.end())
+                ceres::Solve(options, &problem, &summary);
+                //std::cout << summary.BriefReport() << "\n";
+
+                // update global pose
+                mPoseMap.lock();
+                int k = findPose(window[marg_num].t);
+                for (int i = marg_num; i < length && k >= 0; i++, k++)
                 {
-                    ceres::CostFunction* gps_function = TError::Create(iterGPS->second[0], iterGPS->second[1], 
-                                                                       iterGPS->second[2], iterGPS->second[3]);
-                    //printf("inverse weight %f \n", iterGPS->second[3]);
-                    problem.AddResidualBlock(gps_function, loss_function, t_array[i]);
-
-                    /*
-                    double **para = new double *[1];
-                    para[0] = t_array[i];
-
-                    double *tmp_r = new double[3];
-                    double **jaco = new double *[1];
-                    jaco[0] = new double[3 * 3];
-                    gps_function->Evaluate(para, tmp_r, jaco);
-
-                    std::cout << Eigen::Map<Eigen::Matrix<double, 3, 1>>(tmp_r).transpose() << std::endl
-                        << std::endl;
-                    std::cout << Eigen::Map<Eigen::Matrix<double, 3, 3, Eigen::RowMajor>>(jaco[0]) << std::endl
-                        << std::endl;
-                    */
+                    if (k >= (int)poseSeries.size() || poseSeries[k].t != window[i].t)
+                        k = findPose(window[i].t);
+                    if (k < 0)
+                        break;
+                    memcpy(poseSeries[k].globalPose, window[i].globalPose, sizeof(window[i].globalPose));
                 }
 
+                PoseRecord &lastPose = window[length - 1];
+                Eigen::Matrix4d WVIO_T_body = Eigen::Matrix4d::Identity(); 
+                Eigen::Matrix4d WGPS_T_body = Eigen::Matrix4d::Identity();
+                WVIO_T_body.block<3, 3>(0, 0) = Eigen::Quaterniond(lastPose.localPose[3], lastPose.localPose[4], 
+                                                                   lastPose.localPose[5], lastPose.localPose[6]).toRotationMatrix();
+                WVIO_T_body.block<3, 1>(0, 3) = Eigen::Vector3d(lastPose.localPose[0], lastPose.localPose[1], lastPose.localPose[2]);
+                WGPS_T_body.block<3, 3>(0, 0) = Eigen::Quaterniond(lastPose.globalPose[3], lastPose.globalPose[4], 
+                                                                    lastPose.globalPose[5], lastPose.globalPose[6]).toRotationMatrix();
+                WGPS_T_body.block<3, 1>(0, 3) = Eigen::Vector3d(lastPose.globalPose[0], lastPose.globalPose[1], lastPose.globalPose[2]);
+                WGPS_T_WVIO = WGPS_T_body * WVIO_T_body.inverse();
+
+                // poses received during the solve, and on the first solve the ones before the window,
+                // follow the new alignment
+                int windowIndex = findPose(window[marg_num].t);
+                for (int i = findPose(lastPose.t) + 1; i > 0 && i < (int)poseSeries.size(); i++)
+                    alignGlobalPose(poseSeries[i]);
+                if (firstOpt)
+                {
+                    for (int i = 0; i < windowIndex; i++)
+                        alignGlobalPose(poseSeries[i]);
+                    windowIndex = 0;
+                }
+                updateGlobalPath(max(windowIndex, 0));
+                printf("global optimization %d poses, %d marginalized, time %f \n", length - marg_num, marg_num, 
+                       globalOptimizationTime.toc());
+                mPoseMap.unlock();
             }
-            //mPoseMap.unlock();
-            ceres::Solve(options, &problem, &summary);
-            //std::cout << summary.BriefReport() << "\n";
-
-            // update global pose
-            //mPoseMap.lock();
-            iter = globalPoseMap.begin();
-            for (int i = 0; i < length; i++, iter++)
+            else
             {
-            	vector<double> globalPose{t_array[i][0], t_array[i][1], t_array[i][2],
-            							  q_array[i][0], q_array[i][1], q_array[i][2], q_array[i][3]};
-            	iter->second = globalPose;
-            	if(i == length - 1)
-            	{
-            	    Eigen::Matrix4d WVIO_T_body = Eigen::Matrix4d::Identity(); 
-            	    Eigen::Matrix4d WGPS_T_body = Eigen::Matrix4d::Identity();
-            	    double t = iter->first;
-            	    WVIO_T_body.block<3, 3>(0, 0) = Eigen::Quaterniond(localPoseMap[t][3], localPoseMap[t][4], 
-            	                                                       localPoseMap[t][5], localPoseMap[t][6]).toRotationMatrix();
-            	    WVIO_T_body.block<3, 1>(0, 3) = Eigen::Vector3d(localPoseMap[t][0], localPoseMap[t][1], localPoseMap[t][2]);
-            	    WGPS_T_body.block<3, 3>(0, 0) = Eigen::Quaterniond(globalPose[3], globalPose[4], 
-            	                                                        globalPose[5], globalPose[6]).toRotationMatrix();
-            	    WGPS_T_body.block<3, 1>(0, 3) = Eigen::Vector3d(globalPose[0], globalPose[1], globalPose[2]);
-            	    WGPS_T_WVIO = WGPS_T_body * WVIO_T_body.inverse();
-            	}
+                delete loss_function;
+                delete local_parameterization;
             }
-            updateGlobalPath();
-            //printf("global time %f \n", globalOptimizationTime.toc());
-            mPoseMap.unlock();
         }
-        std::chrono::milliseconds dura(2000);
-        std::this_thread::sleep_for(dura);
     }
 	return;
 }
 
+void GlobalOptimization::alignGlobalPose(PoseRecord &pose)
+{
+    Eigen::Quaterniond globalQ;
+    globalQ = WGPS_T_WVIO.block<3, 3>(0, 0) * Eigen::Quaterniond(pose.localPose[3], pose.localPose[4], pose.localPose[5], pose.localPose[6]);
+    Eigen::Vector3d globalP = WGPS_T_WVIO.block<3, 3>(0, 0) * Eigen::Vector3d(pose.localPose[0], pose.localPose[1], pose.localPose[2]) + 
+                              WGPS_T_WVIO.block<3, 1>(0, 3);
+    pose.globalPose[0] = globalP.x();
+    pose.globalPose[1] = globalP.y();
+    pose.globalPose[2] = globalP.z();
+    pose.globalPose[3] = globalQ.w();
+    pose.globalPose[4] = globalQ.x();
+    pose.globalPose[5] = globalQ.y();
+    pose.globalPose[6] = globalQ.z();
+}
+
+// binary search for the pose stamped t, -1 if there is none
+int GlobalOptimization::findPose(double t)
+{
+    vector<PoseRecord>::iterator it = lower_bound(poseSeries.begin(), poseSeries.end(), t,
+                                                  [](const PoseRecord &r, double t) { return r.t < t; });
+    if (it == poseSeries.end() || it->t != t)
+        return -1;
+    return it - poseSeries.begin();
+}
+
+// fold pose i (its prior, gps factor and vio factor to pose j) into a new prior on pose j
+void GlobalOptimization::marginalizePose(PoseRecord &pose_i, PoseRecord &pose_j)
+{
+    // normal equation in the tangent space of [q_i, t_i, q_j, t_j]
+    Eigen::Matrix<double, 12, 12> H = Eigen::Matrix<double, 12, 12>::Zero();
+    Eigen::Matrix<double, 12, 1> b = Eigen::Matrix<double, 12, 1>::Zero();
+
+    double *q_i = pose_i.globalPose + 3, *t_i = pose_i.globalPose;
+    double *q_j = pose_j.globalPose + 3, *t_j = pose_j.globalPose;
+    if (hasPrior)
+    {
+        ceres::CostFunction* prior_function = PriorError::Create(priorPose, priorSqrtInfo);
+        double *para[2] = {q_i, t_i};
+        int offset[2] = {0, 3};
+        linearize(prior_function, NULL, para, offset, H, b);
+        delete prior_function;
+    }
+    if (pose_i.hasGPS)
+    {
+        ceres::CostFunction* gps_function = TError::Create(pose_i.GPSPosition[0], pose_i.GPSPosition[1], 
+                                                           pose_i.GPSPosition[2], pose_i.GPSPosition[3]);
+        ceres::HuberLoss loss_function(1.0);
+        double *para[1] = {t_i};
+        int offset[1] = {3};
+        linearize(gps_function, &loss_function, para, offset, H, b);
+        delete gps_function;
+    }
+    ceres::CostFunction* vio_function = relativeFactor(pose_i.localPose, pose_j.localPose);
+    double *para[4] = {q_i, t_i, q_j, t_j};
+    int offset[4] = {0, 3, 6, 9};
+    linearize(vio_function, NULL, para, offset, H, b);
+    delete vio_function;
+
+    // schur complement onto pose j
+    double eps = 1e-8;
+    Eigen::Matrix<double, 6, 6> Amm = 0.5 * (H.topLeftCorner<6, 6>() + H.topLeftCorner<6, 6>().transpose());
+    Eigen::SelfAdjointEigenSolver<Eigen::Matrix<double, 6, 6>> saes(Amm);
+    Eigen::Matrix<double, 6, 6> Amm_inv = saes.eigenvectors() * Eigen::Matrix<double, 6, 1>((saes.eigenvalues().array() > eps).select(saes.eigenvalues().array().inverse(), 0)).asDiagonal() * saes.eigenvectors().transpose();
+    Eigen::Matrix<double, 6, 6> A = H.bottomRightCorner<6, 6>() - H.bottomLeftCorner<6, 6>() * Amm_inv * H.topRightCorner<6, 6>();
+    Eigen::Matrix<double, 6, 1> g = b.tail<6>() - H.bottomLeftCorner<6, 6>() * Amm_inv * b.head<6>();
+
+    Eigen::SelfAdjointEigenSolver<Eigen::Matrix<double, 6, 6>> saes2(0.5 * (A + A.transpose()));
+    Eigen::Matrix<double, 6, 1> S = Eigen::Matrix<double, 6, 1>((saes2.eigenvalues().array() > eps).select(saes2.eigenvalues().array(), 0));
+    Eigen::Matrix<double, 6, 1> S_inv = Eigen::Matrix<double, 6, 1>((saes2.eigenvalues().array() > eps).select(saes2.eigenvalues().array().inverse(), 0));
+    hasPrior = (S.array() > 0).any();
+    if (!hasPrior)
+        return;
+
+    // the linear term moves the prior mean: dx = -A^-1 g
+    Eigen::Matrix<double, 6, 1> dx = -saes2.eigenvectors() * S_inv.asDiagonal() * saes2.eigenvectors().transpose() * g;
+    ceres::QuaternionParameterization local_parameterization;
+    local_parameterization.Plus(q_j, dx.data(), priorPose + 3);
+    for (int k = 0; k < 3; k++)
+        priorPose[k] = t_j[k] + dx(3 + k);
+    Eigen::Map<Eigen::Matrix<double, 6, 6, Eigen::RowMajor>> sqrt_info(priorSqrtInfo);
+    sqrt_info = S.cwiseSqrt().asDiagonal() * saes2.eigenvectors().transpose();
+}
+
 
-void GlobalOptimization::updateGlobalPath()
+// global poses from start on changed, the next getPathUpdate sends them
+void GlobalOptimization::updateGlobalPath(int start)
 {
-    global_path.poses.clear();
-    map<double, vector<double>>::iterator iter;
-    for (iter = globalPoseMap.begin(); iter != globalPoseMap.end(); iter++)
+    pathUpdateStart = min(pathUpdateStart, start);
+}
+
+// poses of poseSeries from begin on as a path, messages are only built for what is published
+void GlobalOptimization::fillPath(nav_msgs::Path &path, int begin)
+{
+    path.header.frame_id = "world";
+    path.poses.resize(poseSeries.size() - begin);
+    if (!poseSeries.empty())
+        path.header.stamp = ros::Time(poseSeries.back().t);
+    for (int i = begin; i < (int)poseSeries.size(); i++)
     {
-        geometry_msgs::PoseStamped pose_stamped;
-        pose_stamped.header.stamp = ros::Time(iter->first);
+        geometry_msgs::PoseStamped &pose_stamped = path.poses[i - begin];
+        pose_stamped.header.stamp = ros::Time(poseSeries[i].t);
         pose_stamped.header.frame_id = "world";
-        pose_stamped.pose.position.x = iter->second[0];
-        pose_stamped.pose.position.y = iter->second[1];
-        pose_stamped.pose.position.z = iter->second[2];
-        pose_stamped.pose.orientation.w = iter->second[3];
-        pose_stamped.pose.orientation.x = iter->second[4];
-        pose_stamped.pose.orientation.y = iter->second[5];
-        pose_stamped.pose.orientation.z = iter->second[6];
-        global_path.poses.push_back(pose_stamped);
+        pose_stamped.pose.position.x = poseSeries[i].globalPose[0];
+        pose_stamped.pose.position.y = poseSeries[i].globalPose[1];
+        pose_stamped.pose.position.z = poseSeries[i].globalPose[2];
+        pose_stamped.pose.orientation.w = poseSeries[i].globalPose[3];
+        pose_stamped.pose.orientation.x = poseSeries[i].globalPose[4];
+        pose_stamped.pose.orientation.y = poseSeries[i].globalPose[5];
+        pose_stamped.pose.orientation.z = poseSeries[i].globalPose[6];
     }
-}
\ No newline at end of file
+}
@@ -11,46 +11,72 @@
 
 #pragma once
 #include <vector>
+#include <array>
+#include <algorithm>
+#include <cstring>
 #include <map>
 #include <iostream>
 #include <mutex>
 #include <thread>
+#include <chrono>
+#include <condition_variable>
 #include <eigen3/Eigen/Dense>
 #include <eigen3/Eigen/Geometry>
 #include <ceres/ceres.h>
 #include <nav_msgs/Odometry.h>
 #include <nav_msgs/Path.h>
-#include "LocalCartesian.hpp"
+#include "geoConverter.h"
+#include "poseRecord.h"
 #include "tic_toc.h"
 
 using namespace std;
 
+#define GLOBAL_WINDOW_SIZE 300      // poses optimized per GPS update, older ones are marginalized
+#define GLOBAL_OPT_MAX_RATE 5.0     // default upper bound of solves per second
+#define GLOBAL_PATH_RECENT_SIZE 1000    // poses of the published full path, the rest only goes out as updates
+
 class GlobalOptimization
 {
 public:
 	GlobalOptimization();
 	~GlobalOptimization();
 	void inputGPS(double t, double latitude, double longitude, double altitude, double posAccuracy);
+	void inputGPS(const vector<double> &t, const vector<double> &latitude, const vector<double> &longitude,
+	              const vector<double> &altitude, const vector<double> &posAccuracy);
 	void inputOdom(double t, Eigen::Vector3d OdomP, Eigen::Quaterniond OdomQ);
 	void getGlobalOdom(Eigen::Vector3d &odomP, Eigen::Quaterniond &odomQ);
-	nav_msgs::Path global_path;
+	void setMaxOptRate(double rate);
+	bool getPathUpdate(nav_msgs::Path &update);
+	void getRecentPath(nav_msgs::Path &path, int size);
 
 private:
 	void GPS2XYZ(double latitude, double longitude, double altitude, double* xyz);
+	bool attachGPS(double t, const double *xyz, double posAccuracy);
 	void optimize();
-	void updateGlobalPath();
-
-	// format t, tx,ty,tz,qw,qx,qy,qz
-	map<double, vector<double>> localPoseMap;
-	map<double, vector<double>> globalPoseMap;
-	map<double, vector<double>> GPSPositionMap;
-	bool initGPS;
-	bool newGPS;
-	GeographicLib::LocalCartesian geoConverter;
+	void updateGlobalPath(int start);
+	void fillPath(nav_msgs::Path &path, int begin);
+	void marginalizePose(PoseRecord &pose_i, PoseRecord &pose_j);
+	void alignGlobalPose(PoseRecord &pose);
+	int findPose(double t);
+	int pathUpdateStart;        // first pose of poseSeries changed since the last getPathUpdate
+
+	// time ordered, appended by inputOdom; the only copy of the global path, messages are built from it
+	vector<PoseRecord> poseSeries;
+	bool newGPS;                // guarded by mPoseMap, signalled through conGPS
+	std::condition_variable conGPS;
+	double maxOptRate;
+	std::chrono::steady_clock::time_point lastOptTime;
+	GeoConverter geoConverter;
 	std::mutex mPoseMap;
 	Eigen::Matrix4d WGPS_T_WVIO;
 	Eigen::Vector3d lastP;
 	Eigen::Quaterniond lastQ;
 	std::thread threadOpt;
 
+	// prior left by the marginalized poses, on the first pose of the window (margTime)
+	double margTime;
+	bool hasPrior;
+	double priorPose[7];
+	double priorSqrtInfo[36];
+
 };
\ No newline at end of file
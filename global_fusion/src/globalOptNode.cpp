@@ -25,9 +25,10 @@
 #include <mutex>
 
 GlobalOptimization globalEstimator;
-ros::Publisher pub_global_odometry, pub_global_path, pub_car;
-nav_msgs::Path *global_path;
+ros::Publisher pub_global_odometry, pub_global_path, pub_global_path_update, pub_car;
+nav_msgs::Path global_path_update, recent_global_path;
 double last_vio_t = -1;
+double last_path_t = -1;
 std::queue<sensor_msgs::NavSatFixConstPtr> gpsQueue;
 std::mutex m_buf;
 
@@ -138,7 +139,16 @@ void vio_callback(const nav_msgs::Odometry::ConstPtr &pose_msg)
     odometry.pose.pose.orientation.z = global_q.z();
     odometry.pose.pose.orientation.w = global_q.w();
     pub_global_odometry.publish(odometry);
-    pub_global_path.publish(*global_path);
+    // only the poses changed since the last publish, the full history is never sent again
+    if (globalEstimator.getPathUpdate(global_path_update))
+        pub_global_path_update.publish(global_path_update);
+    // global_path is a bounded recent path for visualization at 1Hz, not the full history
+    if (t - last_path_t >= 1.0)
+    {
+        globalEstimator.getRecentPath(recent_global_path, GLOBAL_PATH_RECENT_SIZE);
+        pub_global_path.publish(recent_global_path);
+        last_path_t = t;
+    }
     publish_car_model(t, global_t, global_q);
 
 
@@ -163,11 +173,14 @@ int main(int argc, char **argv)
     ros::init(argc, argv, "globalEstimator");
     ros::NodeHandle n("~");
 
-    global_path = &globalEstimator.global_path;
+    double max_opt_rate;
+    n.param("max_optimization_rate", max_opt_rate, GLOBAL_OPT_MAX_RATE);
+    globalEstimator.setMaxOptRate(max_opt_rate);
 
     ros::Subscriber sub_GPS = n.subscribe("/gps", 100, GPS_callback);
     ros::Subscriber sub_vio = n.subscribe("/vins_estimator/odometry", 100, vio_callback);
     pub_global_path = n.advertise<nav_msgs::Path>("global_path", 100);
+    pub_global_path_update = n.advertise<nav_msgs::Path>("global_path_update", 100);
     pub_global_odometry = n.advertise<nav_msgs::Odometry>("global_odometry", 100);
     pub_car = n.advertise<visualization_msgs::MarkerArray>("car_model", 1000);
     ros::spin();
@@ -0,0 +1,261 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+// Batch global fusion of a recorded session, without ROS.
+// usage: global_fusion_offline vio.csv gps.csv output.csv [num_threads]
+//   vio.csv:    t_ns,x,y,z,qw,qx,qy,qz[,...]      (vins_estimator VINS_RESULT_PATH)
+//   gps.csv:    t,latitude,longitude,altitude,pos_accuracy      (t in s, or ns as in vio.csv)
+//   output.csv: t_ns,x,y,z,qw,qx,qy,qz           (same as the online vio_global.csv)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <algorithm>
+#include <eigen3/Eigen/Dense>
+#include <ceres/ceres.h>
+#include "Factors.h"
+#include "geoConverter.h"
+#include "poseRecord.h"
+#include "tic_toc.h"
+
+using namespace std;
+
+#define GPS_SYNC_TOLERANCE 0.01     // max stamp difference (s) between a fix and its vio pose
+
+static bool readCSV(const string &path, int min_cols, vector<vector<double>> &rows)
+{
+    ifstream fin(path);
+    if (!fin.is_open())
+    {
+        printf("cannot open %s\n", path.c_str());
+        return false;
+    }
+    string line;
+    while (getline(fin, line))
+    {
+        if (line.empty() || line[0] == '#')
+            continue;
+        vector<double> row;
+        stringstream ss(line);
+        string cell;
+        while (getline(ss, cell, ','))
+        {
+            if (cell.empty())
+                continue;
+            char *end;
+            double v = strtod(cell.c_str(), &end);
+            if (end == cell.c_str())
+                break;
+            row.push_back(v);
+        }
+        if ((int)row.size() >= min_cols)
+            rows.push_back(row);
+    }
+    return true;
+}
+
+static double toSec(double t)
+{
+    // nanosecond stamps as written by the estimator
+    return t > 1e13 ? t * 1e-9 : t;
+}
+
+// yaw and translation taking the vio positions onto the gps positions, the
+// rest of the rotation is observable by the vio through gravity
+static Eigen::Matrix4d alignYaw(const vector<PoseRecord> &poses)
+{
+    Eigen::Vector3d mean_l = Eigen::Vector3d::Zero(), mean_g = Eigen::Vector3d::Zero();
+    int n = 0;
+    for (const PoseRecord &p : poses)
+        if (p.hasGPS)
+        {
+            mean_l += Eigen::Vector3d(p.localPose[0], p.localPose[1], p.localPose[2]);
+            mean_g += Eigen::Vector3d(p.GPSPosition[0], p.GPSPosition[1], p.GPSPosition[2]);
+            n++;
+        }
+    Eigen::Matrix4d T = Eigen::Matrix4d::Identity();
+    if (n == 0)
+        return T;
+    mean_l /= n;
+    mean_g /= n;
+
+    double s = 0, c = 0;
+    for (const PoseRecord &p : poses)
+        if (p.hasGPS)
+        {
+            double lx = p.localPose[0] - mean_l.x(), ly = p.localPose[1] - mean_l.y();
+            double gx = p.GPSPosition[0] - mean_g.x(), gy = p.GPSPosition[1] - mean_g.y();
+            c += lx * gx + ly * gy;
+            s += lx * gy - ly * gx;
+        }
+    double yaw = n > 1 ? atan2(s, c) : 0;
+    T.block<3, 3>(0, 0) = Eigen::AngleAxisd(yaw, Eigen::Vector3d::UnitZ()).toRotationMatrix();
+    T.block<3, 1>(0, 3) = mean_g - T.block<3, 3>(0, 0) * mean_l;
+    return T;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 4)
+    {
+        printf("usage: global_fusion_offline vio.csv gps.csv output.csv [num_threads]\n");
+        return 1;
+    }
+    int num_threads = argc > 4 ? atoi(argv[4]) : std::thread::hardware_concurrency();
+    num_threads = max(num_threads, 1);
+
+    TicToc t_load;
+    vector<vector<double>> vio_rows, gps_rows;
+    if (!readCSV(argv[1], 8, vio_rows) || !readCSV(argv[2], 5, gps_rows))
+        return 1;
+
+    vector<PoseRecord> poses(vio_rows.size());
+    for (size_t i = 0; i < vio_rows.size(); i++)
+    {
+        PoseRecord &p = poses[i];
+        p.t = toSec(vio_rows[i][0]);
+        for (int k = 0; k < 7; k++)
+            p.localPose[k] = vio_rows[i][k + 1];
+        p.hasGPS = false;
+    }
+    sort(poses.begin(), poses.end(), [](const PoseRecord &a, const PoseRecord &b) { return a.t < b.t; });
+
+    // all fixes are converted in one batch around the first one
+    int num_gps = gps_rows.size();
+    vector<double> lat(num_gps), lon(num_gps), alt(num_gps), xyz(3 * num_gps);
+    for (int i = 0; i < num_gps; i++)
+    {
+        lat[i] = gps_rows[i][1];
+        lon[i] = gps_rows[i][2];
+        alt[i] = gps_rows[i][3];
+    }
+    GeoConverter geoConverter;
+    if (num_gps > 0)
+    {
+        geoConverter.Reset(lat[0], lon[0], alt[0]);
+        geoConverter.Forward(num_gps, lat.data(), lon.data(), alt.data(), xyz.data());
+        printf("gps origin la: %f lo: %f al: %f, conversion error %e m\n", lat[0], lon[0], alt[0],
+               geoConverter.checkAccuracy());
+    }
+
+    // synchronize each fix to the nearest vio pose, as the node does online
+    int num_synced = 0;
+    for (int i = 0; i < num_gps; i++)
+    {
+        double t = toSec(gps_rows[i][0]);
+        vector<PoseRecord>::iterator it = lower_bound(poses.begin(), poses.end(), t,
+                                                      [](const PoseRecord &r, double t) { return r.t < t; });
+        if (it != poses.begin() && (it == poses.end() || t - (it - 1)->t < it->t - t))
+            it--;
+        if (it == poses.end() || fabs(it->t - t) > GPS_SYNC_TOLERANCE)
+            continue;
+        double pos_accuracy = gps_rows[i][4];
+        if (pos_accuracy <= 0)
+            pos_accuracy = 1;
+        it->hasGPS = true;
+        it->GPSPosition[0] = xyz[3 * i];
+        it->GPSPosition[1] = xyz[3 * i + 1];
+        it->GPSPosition[2] = xyz[3 * i + 2];
+        it->GPSPosition[3] = pos_accuracy;
+        num_synced++;
+    }
+    printf("loaded %d vio poses, %d of %d gps fixes synchronized, %f ms\n", (int)poses.size(), num_synced, num_gps,
+           t_load.toc());
+    if (poses.empty())
+        return 1;
+
+    // initial global poses from a yaw and translation alignment of the whole trajectory
+    Eigen::Matrix4d WGPS_T_WVIO = alignYaw(poses);
+    for (PoseRecord &p : poses)
+    {
+        Eigen::Quaterniond globalQ;
+        globalQ = WGPS_T_WVIO.block<3, 3>(0, 0) * Eigen::Quaterniond(p.localPose[3], p.localPose[4], p.localPose[5], p.localPose[6]);
+        Eigen::Vector3d globalP = WGPS_T_WVIO.block<3, 3>(0, 0) * Eigen::Vector3d(p.localPose[0], p.localPose[1], p.localPose[2]) +
+                                  WGPS_T_WVIO.block<3, 1>(0, 3);
+        p.globalPose[0] = globalP.x();
+        p.globalPose[1] = globalP.y();
+        p.globalPose[2] = globalP.z();
+        p.globalPose[3] = globalQ.w();
+        p.globalPose[4] = globalQ.x();
+        p.globalPose[5] = globalQ.y();
+        p.globalPose[6] = globalQ.z();
+    }
+
+    TicToc t_solve;
+    ceres::Problem problem;
+    ceres::Solver::Options options;
+    options.linear_solver_type = ceres::SPARSE_NORMAL_CHOLESKY;
+    options.num_threads = num_threads;
+    options.max_num_iterations = 100;
+    options.minimizer_progress_to_stdout = true;
+    ceres::Solver::Summary summary;
+    ceres::LossFunction *loss_function = new ceres::HuberLoss(1.0);
+    ceres::LocalParameterization* local_parameterization = new ceres::QuaternionParameterization();
+
+    int length = poses.size();
+    for (int i = 0; i < length; i++)
+    {
+        problem.AddParameterBlock(poses[i].globalPose + 3, 4, local_parameterization);
+        problem.AddParameterBlock(poses[i].globalPose, 3);
+    }
+    for (int i = 0; i < length; i++)
+    {
+        //vio factor
+        if (i + 1 < length)
+        {
+            ceres::CostFunction* vio_function = relativeFactor(poses[i].localPose, poses[i + 1].localPose);
+            problem.AddResidualBlock(vio_function, NULL, poses[i].globalPose + 3, poses[i].globalPose,
+                                     poses[i + 1].globalPose + 3, poses[i + 1].globalPose);
+        }
+        //gps factor
+        if (poses[i].hasGPS)
+        {
+            ceres::CostFunction* gps_function = TError::Create(poses[i].GPSPosition[0], poses[i].GPSPosition[1],
+                                                               poses[i].GPSPosition[2], poses[i].GPSPosition[3]);
+            problem.AddResidualBlock(gps_function, loss_function, poses[i].globalPose);
+        }
+    }
+    // without any fix the trajectory is only fixed up to a rigid transform
+    if (num_synced == 0)
+    {
+        problem.SetParameterBlockConstant(poses[0].globalPose + 3);
+        problem.SetParameterBlockConstant(poses[0].globalPose);
+    }
+    ceres::Solve(options, &problem, &summary);
+    std::cout << summary.BriefReport() << "\n";
+    printf("global optimization %d poses, %d threads, time %f ms\n", length, num_threads, t_solve.toc());
+
+    ofstream foutC(argv[3], ios::out);
+    if (!foutC.is_open())
+    {
+        printf("cannot open %s\n", argv[3]);
+        return 1;
+    }
+    foutC.setf(ios::fixed, ios::floatfield);
+    for (const PoseRecord &p : poses)
+    {
+        foutC.precision(0);
+        foutC << p.t * 1e9 << ",";
+        foutC.precision(5);
+        foutC << p.globalPose[0] << ","
+              << p.globalPose[1] << ","
+              << p.globalPose[2] << ","
+              << p.globalPose[3] << ","
+              << p.globalPose[4] << ","
+              << p.globalPose[5] << ","
+              << p.globalPose[6] << endl;
+    }
+    return 0;
+}
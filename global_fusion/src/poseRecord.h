@@ -0,0 +1,20 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ * 
+ * This file is part of VINS.
+ * 
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#pragma once
+
+// one vio pose with its global estimate and the gps fix synchronized to it, format tx,ty,tz,qw,qx,qy,qz
+struct PoseRecord
+{
+	double t;
+	double localPose[7];
+	double globalPose[7];
+	bool hasGPS;
+	double GPSPosition[4];      // x,y,z,posAccuracy
+};
@@ -10,6 +10,7 @@
 #include <vector>
 #include <string>
 #include <sstream>
+#include <cassert>
 
 #include "FBrief.h"
 
@@ -56,6 +57,16 @@ double FBrief::distance(const FBrief::TDescriptor &a,
   return (double)DVision::BRIEF::distance(a, b);
 }
 
+// --------------------------------------------------------------------------
+
+void FBrief::pack(const FBrief::TDescriptor &a, FBrief::TPacked &p)
+{
+  assert(a.size() <= 64 * PACKED_WORDS);
+  for(int k = 0; k < PACKED_WORDS; ++k) p.bits[k] = 0;
+  for(size_t i = a.find_first(); i != TDescriptor::npos; i = a.find_next(i))
+    p.bits[i >> 6] |= (uint64_t)1 << (i & 63);
+}
+
 // --------------------------------------------------------------------------
   
 std::string FBrief::toString(const FBrief::TDescriptor &a)
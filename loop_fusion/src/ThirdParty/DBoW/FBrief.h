@@ -13,6 +13,7 @@
 #include <opencv2/opencv.hpp>
 #include <vector>
 #include <string>
+#include <stdint.h>
 
 #include "FClass.h"
 #include "../DVision/DVision.h"
@@ -27,6 +28,15 @@ public:
   typedef DVision::BRIEF::bitset TDescriptor;
   typedef const TDescriptor *pDescriptor;
 
+  /// Number of 64-bit words of a packed descriptor
+  static const int PACKED_WORDS = 4;
+
+  /// Descriptor packed into a contiguous 256-bit block for popcount distances
+  struct TPacked
+  {
+    uint64_t bits[PACKED_WORDS];
+  };
+
   /**
    * Calculates the mean value of a set of descriptors
    * @param descriptors
@@ -42,6 +52,27 @@ public:
    * @return distance
    */
   static double distance(const TDescriptor &a, const TDescriptor &b);
+
+  /**
+   * Packs a descriptor of at most 256 bits, bit i goes to bits[i/64]
+   * @param a descriptor
+   * @param p (out) packed descriptor
+   */
+  static void pack(const TDescriptor &a, TPacked &p);
+
+  /**
+   * Calculates the Hamming distance between two packed descriptors
+   * @param a
+   * @param b
+   * @return distance
+   */
+  static inline int distance(const TPacked &a, const TPacked &b)
+  {
+    return __builtin_popcountll(a.bits[0] ^ b.bits[0]) +
+      __builtin_popcountll(a.bits[1] ^ b.bits[1]) +
+      __builtin_popcountll(a.bits[2] ^ b.bits[2]) +
+      __builtin_popcountll(a.bits[3] ^ b.bits[3]);
+  }
   
   /**
    * Returns a string version of the descriptor
@@ -16,6 +16,9 @@
 #include <string>
 #include <list>
 #include <set>
+#include <cstdio>
+#include <cstring>
+#include <stdint.h>
 
 #include "TemplatedVocabulary.h"
 #include "QueryResults.h"
@@ -225,6 +228,24 @@ public:
   virtual void load(const cv::FileStorage &fs, 
     const std::string &name = "database");
 
+  /**
+   * Writes the inverted index, and the direct index if used, in binary form.
+   * The vocabulary is not included
+   * @param f file opened for binary writing
+   * @return true iff every write succeeded
+   */
+  bool saveBinary(FILE *f) const;
+
+  /**
+   * Restores the indices written by saveBinary. The current vocabulary and
+   * direct index settings must be the ones the indices were built with
+   * @param data
+   * @param size bytes available from data
+   * @return true iff the indices were restored, otherwise the database is
+   *   left empty
+   */
+  bool loadBinary(const char *data, size_t size);
+
 protected:
   
   /// Query with L1 scoring
@@ -1364,6 +1385,158 @@ void TemplatedDatabase<TDescriptor, F>::load(const cv::FileStorage &fs,
 
 // --------------------------------------------------------------------------
 
+template<class TDescriptor, class F>
+bool TemplatedDatabase<TDescriptor, F>::saveBinary(FILE *f) const
+{
+  // Format:
+  // nEntries usingDI diLevels nWords (uint32)
+  // invertedIndex: for each word, rowSize (uint32) + rowSize x { imageId (uint32), weight (double) }
+  // directIndex (if usingDI): for each entry,
+  //   bowSize (uint32) + bowSize x { wordId (uint32), weight (double) }
+  //   nodes (uint32) + nodes x { nodeId (uint32), nFeatures (uint32), features (uint32) }
+
+  #define DBOW_WRITE(src, size, n) \
+    if(fwrite(src, size, n, f) != (size_t)(n)) return false;
+
+  uint32_t head[4] = { (uint32_t)m_nentries, (uint32_t)(m_use_di ? 1 : 0),
+    (uint32_t)m_dilevels, (uint32_t)m_ifile.size() };
+  DBOW_WRITE(head, sizeof(uint32_t), 4);
+
+  typename InvertedFile::const_iterator iit;
+  typename IFRow::const_iterator irit;
+  for(iit = m_ifile.begin(); iit != m_ifile.end(); ++iit)
+  {
+    uint32_t n = iit->size();
+    DBOW_WRITE(&n, sizeof(n), 1);
+    for(irit = iit->begin(); irit != iit->end(); ++irit)
+    {
+      uint32_t eid = irit->entry_id;
+      DBOW_WRITE(&eid, sizeof(eid), 1);
+      DBOW_WRITE(&irit->word_weight, sizeof(WordValue), 1);
+    }
+  }
+
+  if(m_use_di)
+  {
+    for(int eid = 0; eid < m_nentries; ++eid)
+    {
+      const BowVector &v = m_dBowfile[eid];
+      uint32_t n = v.size();
+      DBOW_WRITE(&n, sizeof(n), 1);
+      for(BowVector::const_iterator vit = v.begin(); vit != v.end(); ++vit)
+      {
+        uint32_t wid = vit->first;
+        DBOW_WRITE(&wid, sizeof(wid), 1);
+        DBOW_WRITE(&vit->second, sizeof(WordValue), 1);
+      }
+
+      const FeatureVector &fv = m_dfile[eid];
+      n = fv.size();
+      DBOW_WRITE(&n, sizeof(n), 1);
+      for(FeatureVector::const_iterator fit = fv.begin(); fit != fv.end(); ++fit)
+      {
+        uint32_t node[2] = { fit->first, (uint32_t)fit->second.size() };
+        DBOW_WRITE(node, sizeof(uint32_t), 2);
+        for(unsigned int i = 0; i < fit->second.size(); ++i)
+        {
+          uint32_t feature = fit->second[i];
+          DBOW_WRITE(&feature, sizeof(feature), 1);
+        }
+      }
+    }
+  }
+
+  #undef DBOW_WRITE
+
+  return true;
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F>
+bool TemplatedDatabase<TDescriptor, F>::loadBinary(const char *data, 
+  size_t size)
+{
+  clear();
+
+  size_t pos = 0;
+  #define DBOW_READ(dst, n) \
+    if(pos + (n) > size) { clear(); return false; } \
+    memcpy(dst, data + pos, n); pos += (n);
+
+  uint32_t head[4];
+  DBOW_READ(head, sizeof(head));
+  if(head[3] != m_ifile.size())
+  {
+    // built with another vocabulary
+    clear();
+    return false;
+  }
+  if((head[1] != 0) != m_use_di || (m_use_di && (int)head[2] != m_dilevels))
+  {
+    // built with other direct index settings, the caller rebuilds
+    clear();
+    return false;
+  }
+  m_nentries = head[0];
+
+  for(WordId wid = 0; wid < head[3]; ++wid)
+  {
+    uint32_t n;
+    DBOW_READ(&n, sizeof(n));
+    IFRow &ifrow = m_ifile[wid];
+    for(uint32_t i = 0; i < n; ++i)
+    {
+      uint32_t eid;
+      WordValue weight;
+      DBOW_READ(&eid, sizeof(eid));
+      DBOW_READ(&weight, sizeof(weight));
+      ifrow.push_back(IFPair(eid, weight));
+    }
+  }
+
+  if(m_use_di)
+  {
+    m_dfile.resize(m_nentries);
+    m_dBowfile.resize(m_nentries);
+    for(int eid = 0; eid < m_nentries; ++eid)
+    {
+      uint32_t n;
+      DBOW_READ(&n, sizeof(n));
+      BowVector &v = m_dBowfile[eid];
+      for(uint32_t i = 0; i < n; ++i)
+      {
+        uint32_t wid;
+        WordValue weight;
+        DBOW_READ(&wid, sizeof(wid));
+        DBOW_READ(&weight, sizeof(weight));
+        v.insert(v.end(), std::make_pair(wid, weight));
+      }
+
+      DBOW_READ(&n, sizeof(n));
+      FeatureVector &fv = m_dfile[eid];
+      for(uint32_t i = 0; i < n; ++i)
+      {
+        uint32_t node[2];
+        DBOW_READ(node, sizeof(node));
+        FeatureVector::iterator dit = fv.insert(fv.end(), 
+          std::make_pair(node[0], std::vector<unsigned int>(node[1])));
+        for(uint32_t k = 0; k < node[1]; ++k)
+        {
+          uint32_t feature;
+          DBOW_READ(&feature, sizeof(feature));
+          dit->second[k] = feature;
+        }
+      }
+    }
+  }
+  #undef DBOW_READ
+
+  return true;
+}
+
+// --------------------------------------------------------------------------
+
 /**
  * Writes printable information of the database
  * @param os stream to write to
@@ -17,6 +17,7 @@
 #include <fstream>
 #include <string>
 #include <algorithm>
+#include <stdint.h>
 #include <opencv2/opencv.hpp>
 
 #include "FeatureVector.h"
@@ -146,6 +147,15 @@ public:
    * @return word id
    */
   virtual WordId transform(const TDescriptor& feature) const;
+
+  /**
+   * Transforms a set of packed descriptors into a bow vector, this is
+   * the same as transform(features, v) without packing every descriptor
+   * @param features packed descriptors (see F::pack)
+   * @param v (out) bow vector of weighted words
+   */
+  void transform(const std::vector<typename F::TPacked>& features, 
+    BowVector &v) const;
   
   /**
    * Returns the score of two vectors
@@ -348,6 +358,18 @@ protected:
    * @param id (out) word id
    */
   virtual void transform(const TDescriptor &feature, WordId &id) const;
+
+  /**
+   * Returns the word id associated to a packed feature by descending the
+   * flat tree
+   * @param feature
+   * @param id (out) word id
+   * @param weight (out) word weight
+   * @param nid (out) if given, id of the node "levelsup" levels up
+   * @param levelsup
+   */
+  void transform(const typename F::TPacked &feature, 
+    WordId &id, WordValue &weight, NodeId* nid = NULL, int levelsup = 0) const;
       
   /**
    * Creates a level in the tree, under the parent, by running kmeans with
@@ -380,6 +402,12 @@ protected:
    * Create the words of the vocabulary once the tree has been built
    */
   void createWords();
+
+  /**
+   * Creates the flat copy of the tree used by transform. It must be called
+   * again whenever m_nodes changes
+   */
+  void createFlatTree();
   
   /**
    * Sets the weights of the nodes of tree according to the given features.
@@ -412,6 +440,25 @@ protected:
   /// Words of the vocabulary (tree leaves)
   /// this condition holds: m_words[wid]->word_id == wid
   std::vector<Node*> m_words;
+
+  /// Node of the flat tree. The children of a node are stored contiguously
+  /// in m_flat_nodes, and their packed descriptors at the same positions
+  /// in m_flat_descriptors, so one level is a linear scan of k blocks
+  struct FlatNode
+  {
+    /// Index of the first child in m_flat_nodes
+    uint32_t first_child;
+    /// Number of children, 0 for words
+    uint32_t num_children;
+    /// Id of the node in m_nodes
+    NodeId node_id;
+  };
+
+  /// Flat tree, root first
+  std::vector<FlatNode> m_flat_nodes;
+
+  /// Packed descriptors of the flat tree nodes
+  std::vector<typename F::TPacked> m_flat_descriptors;
   
 };
 
@@ -934,6 +981,50 @@ void TemplatedVocabulary<TDescriptor,F>::createWords()
       }
     }
   }
+
+  createFlatTree();
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F>
+void TemplatedVocabulary<TDescriptor,F>::createFlatTree()
+{
+  m_flat_nodes.clear();
+  m_flat_descriptors.clear();
+
+  if(m_nodes.empty()) return;
+
+  m_flat_nodes.reserve(m_nodes.size());
+  m_flat_descriptors.reserve(m_nodes.size());
+
+  FlatNode root;
+  root.first_child = 0;
+  root.num_children = 0;
+  root.node_id = 0;
+  m_flat_nodes.push_back(root);
+  m_flat_descriptors.push_back(typename F::TPacked());
+
+  // breadth first, so that siblings end up next to each other
+  for(size_t i = 0; i < m_flat_nodes.size(); ++i)
+  {
+    const std::vector<NodeId> &children = m_nodes[m_flat_nodes[i].node_id].children;
+    m_flat_nodes[i].first_child = m_flat_nodes.size();
+    m_flat_nodes[i].num_children = children.size();
+
+    for(size_t c = 0; c < children.size(); ++c)
+    {
+      FlatNode node;
+      node.first_child = 0;
+      node.num_children = 0;
+      node.node_id = children[c];
+      m_flat_nodes.push_back(node);
+
+      typename F::TPacked packed;
+      F::pack(m_nodes[children[c]].descriptor, packed);
+      m_flat_descriptors.push_back(packed);
+    }
+  }
 }
 
 // --------------------------------------------------------------------------
@@ -1122,6 +1213,56 @@ void TemplatedVocabulary<TDescriptor,F>::transform(
 
 // --------------------------------------------------------------------------
 
+template<class TDescriptor, class F>
+void TemplatedVocabulary<TDescriptor,F>::transform(
+  const std::vector<typename F::TPacked>& features, BowVector &v) const
+{
+  v.clear();
+  
+  if(empty())
+  {
+    return;
+  }
+
+  // normalize 
+  LNorm norm;
+  bool must = m_scoring_object->mustNormalize(norm);
+
+  typename std::vector<typename F::TPacked>::const_iterator fit;
+
+  if(m_weighting == TF || m_weighting == TF_IDF)
+  {
+    for(fit = features.begin(); fit < features.end(); ++fit)
+    {
+      WordId id;
+      WordValue w; 
+      transform(*fit, id, w);
+      if(w > 0) v.addWeight(id, w);
+    }
+    
+    if(!v.empty() && !must)
+    {
+      const double nd = v.size();
+      for(BowVector::iterator vit = v.begin(); vit != v.end(); vit++) 
+        vit->second /= nd;
+    }
+  }
+  else // IDF || BINARY
+  {
+    for(fit = features.begin(); fit < features.end(); ++fit)
+    {
+      WordId id;
+      WordValue w;
+      transform(*fit, id, w);
+      if(w > 0) v.addIfNotExist(id, w);
+    }
+  }
+  
+  if(must) v.normalize(norm);
+}
+
+// --------------------------------------------------------------------------
+
 template<class TDescriptor, class F> 
 void TemplatedVocabulary<TDescriptor,F>::transform(
   const std::vector<TDescriptor>& features,
@@ -1217,44 +1358,54 @@ template<class TDescriptor, class F>
 void TemplatedVocabulary<TDescriptor,F>::transform(const TDescriptor &feature, 
   WordId &word_id, WordValue &weight, NodeId *nid, int levelsup) const
 { 
-  // propagate the feature down the tree
-  std::vector<NodeId> nodes;
-  typename std::vector<NodeId>::const_iterator nit;
+  typename F::TPacked packed;
+  F::pack(feature, packed);
+  transform(packed, word_id, weight, nid, levelsup);
+}
+
+// --------------------------------------------------------------------------
 
+template<class TDescriptor, class F>
+void TemplatedVocabulary<TDescriptor,F>::transform(
+  const typename F::TPacked &feature, 
+  WordId &word_id, WordValue &weight, NodeId *nid, int levelsup) const
+{ 
   // level at which the node must be stored in nid, if given
   const int nid_level = m_L - levelsup;
   if(nid_level <= 0 && nid != NULL) *nid = 0; // root
 
-  NodeId final_id = 0; // root
+  // propagate the feature down the flat tree
+  uint32_t final_idx = 0; // root
   int current_level = 0;
 
   do
   {
     ++current_level;
-    nodes = m_nodes[final_id].children;
-    final_id = nodes[0];
- 
-    double best_d = F::distance(feature, m_nodes[final_id].descriptor);
+    const FlatNode &node = m_flat_nodes[final_idx];
+    const uint32_t end = node.first_child + node.num_children;
+    final_idx = node.first_child;
+
+    int best_d = F::distance(feature, m_flat_descriptors[final_idx]);
 
-    for(nit = nodes.begin() + 1; nit != nodes.end(); ++nit)
+    for(uint32_t i = final_idx + 1; i < end; ++i)
     {
-      NodeId id = *nit;
-      double d = F::distance(feature, m_nodes[id].descriptor);
+      int d = F::distance(feature, m_flat_descriptors[i]);
       if(d < best_d)
       {
         best_d = d;
-        final_id = id;
+        final_idx = i;
       }
     }
     
     if(nid != NULL && current_level == nid_level)
-      *nid = final_id;
+      *nid = m_flat_nodes[final_idx].node_id;
     
-  } while( !m_nodes[final_id].isLeaf() );
+  } while( m_flat_nodes[final_idx].num_children > 0 );
 
   // turn node id into word id
-  word_id = m_nodes[final_id].word_id;
-  weight = m_nodes[final_id].weight;
+  const Node &word = m_nodes[m_flat_nodes[final_idx].node_id];
+  word_id = word.word_id;
+  weight = word.weight;
 }
 
 // --------------------------------------------------------------------------
@@ -1502,6 +1653,8 @@ void TemplatedVocabulary<TDescriptor,F>::load(const cv::FileStorage &fs,
     m_nodes[nid].word_id = wid;
     m_words[wid] = &m_nodes[nid];
   }
+
+  createFlatTree();
 }
     
 // Added by VINS [[[
@@ -1558,6 +1711,8 @@ void TemplatedVocabulary<TDescriptor,F>::loadBin(const std::string &filename) {
     m_nodes[nid].word_id = wid;
     m_words[wid] = &m_nodes[nid];
   }
+
+  createFlatTree();
 }
     
 // Added by VINS ]]]
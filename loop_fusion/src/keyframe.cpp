@@ -28,6 +28,7 @@ KeyFrame::KeyFrame(double _time_stamp, int _index, Vector3d &_vio_T_w_i, Matrix3
 {
 	time_stamp = _time_stamp;
 	index = _index;
+	local_index = -1;
 	vio_T_w_i = _vio_T_w_i;
 	vio_R_w_i = _vio_R_w_i;
 	T_w_i = vio_T_w_i;
@@ -45,19 +46,37 @@ KeyFrame::KeyFrame(double _time_stamp, int _index, Vector3d &_vio_T_w_i, Matrix3
 	has_fast_point = false;
 	loop_info << 0, 0, 0, 0, 0, 0, 0, 0;
 	sequence = _sequence;
-	computeWindowBRIEFPoint();
-	computeBRIEFPoint();
-	if(!DEBUG_IMAGE)
-		image.release();
+	features_spilled = false;
+	spill_offset = -1;
+	spill_num = 0;
+	map_features = NULL;
+	evictable = false;
+}
+
+static vector<PackedBRIEF> packedBRIEF(const vector<BRIEF::bitset> &descriptors)
+{
+	vector<PackedBRIEF> packed;
+	packBRIEF(descriptors, packed);
+	return packed;
 }
 
 // load previous keyframe
 KeyFrame::KeyFrame(double _time_stamp, int _index, Vector3d &_vio_T_w_i, Matrix3d &_vio_R_w_i, Vector3d &_T_w_i, Matrix3d &_R_w_i,
 					cv::Mat &_image, int _loop_index, Eigen::Matrix<double, 8, 1 > &_loop_info,
 					vector<cv::KeyPoint> &_keypoints, vector<cv::KeyPoint> &_keypoints_norm, vector<BRIEF::bitset> &_brief_descriptors)
+	: KeyFrame(_time_stamp, _index, _vio_T_w_i, _vio_R_w_i, _T_w_i, _R_w_i, _image, _loop_index, _loop_info,
+	           _keypoints, _keypoints_norm, packedBRIEF(_brief_descriptors))
+{
+}
+
+// load previous keyframe with packed descriptors, e.g. straight from the binary map
+KeyFrame::KeyFrame(double _time_stamp, int _index, Vector3d &_vio_T_w_i, Matrix3d &_vio_R_w_i, Vector3d &_T_w_i, Matrix3d &_R_w_i,
+					cv::Mat &_image, int _loop_index, Eigen::Matrix<double, 8, 1 > &_loop_info,
+					vector<cv::KeyPoint> &_keypoints, vector<cv::KeyPoint> &_keypoints_norm, const vector<PackedBRIEF> &_packed_brief_descriptors)
 {
 	time_stamp = _time_stamp;
 	index = _index;
+	local_index = -1;
 	//vio_T_w_i = _vio_T_w_i;
 	//vio_R_w_i = _vio_R_w_i;
 	vio_T_w_i = _T_w_i;
@@ -79,10 +98,60 @@ KeyFrame::KeyFrame(double _time_stamp, int _index, Vector3d &_vio_T_w_i, Matrix3
 	sequence = 0;
 	keypoints = _keypoints;
 	keypoints_norm = _keypoints_norm;
-	brief_descriptors = _brief_descriptors;
+	packed_brief_descriptors = _packed_brief_descriptors;
+	buildKeypointGrid();
+	features_spilled = false;
+	spill_offset = -1;
+	spill_num = 0;
+	map_features = NULL;
+	evictable = false;
 }
 
 
+// FAST + BRIEF on the full image, run by the pose graph's extraction thread instead of the constructor
+void KeyFrame::extractFeatures()
+{
+	computeWindowBRIEFPoint();
+	computeBRIEFPoint();
+	has_fast_point = true;
+	// matching only uses the packed descriptors
+	vector<BRIEF::bitset>().swap(brief_descriptors);
+	vector<BRIEF::bitset>().swap(window_brief_descriptors);
+	if(!DEBUG_IMAGE)
+		image.release();
+}
+
+// bytes held by the keypoints and descriptors that can be spilled to disk
+size_t KeyFrame::featureMemory() const
+{
+	size_t bytes = (keypoints.capacity() + keypoints_norm.capacity()) * sizeof(cv::KeyPoint) +
+	               packed_brief_descriptors.capacity() * sizeof(PackedBRIEF) +
+	               keypoint_grid.capacity() * sizeof(vector<int>);
+	for (int i = 0; i < (int)keypoint_grid.size(); i++)
+		bytes += keypoint_grid[i].capacity() * sizeof(int);
+	return bytes;
+}
+
+void KeyFrame::releaseFeatures()
+{
+	vector<cv::KeyPoint>().swap(keypoints);
+	vector<cv::KeyPoint>().swap(keypoints_norm);
+	vector<PackedBRIEF>().swap(packed_brief_descriptors);
+	vector<vector<int> >().swap(keypoint_grid);
+}
+
+// the VIO window points are only matched while this keyframe is the current one in loop closure
+void KeyFrame::releaseWindowFeatures()
+{
+	vector<cv::Point3f>().swap(point_3d);
+	vector<cv::Point2f>().swap(point_2d_uv);
+	vector<cv::Point2f>().swap(point_2d_norm);
+	vector<double>().swap(point_id);
+	vector<cv::KeyPoint>().swap(window_keypoints);
+	vector<BRIEF::bitset>().swap(window_brief_descriptors);
+	vector<PackedBRIEF>().swap(packed_window_brief_descriptors);
+}
+
 void KeyFrame::computeWindowBRIEFPoint()
 {
 	BriefExtractor extractor(BRIEF_PATTERN_FILE.c_str());
@@ -93,6 +162,7 @@ void KeyFrame::computeWindowBRIEFPoint()
 	    window_keypoints.push_back(key);
 	}
 	extractor(image, window_keypoints, window_brief_descriptors);
+	packBRIEF(window_brief_descriptors, packed_window_brief_descriptors);
 }
 
 void KeyFrame::computeBRIEFPoint()
@@ -113,12 +183,16 @@ void KeyFrame::computeBRIEFPoint()
 		}
 	}
 	extractor(image, keypoints, brief_descriptors);
+	packBRIEF(brief_descriptors, packed_brief_descriptors);
+	buildKeypointGrid();
+	vector<cv::Point2f> pts(keypoints.size()), pts_norm;
+	for (int i = 0; i < (int)keypoints.size(); i++)
+		pts[i] = keypoints[i].pt;
+	m_camera->liftProjectiveBatch(pts, pts_norm);
 	for (int i = 0; i < (int)keypoints.size(); i++)
 	{
-		Eigen::Vector3d tmp_p;
-		m_camera->liftProjective(Eigen::Vector2d(keypoints[i].pt.x, keypoints[i].pt.y), tmp_p);
 		cv::KeyPoint tmp_norm;
-		tmp_norm.pt = cv::Point2f(tmp_p.x()/tmp_p.z(), tmp_p.y()/tmp_p.z());
+		tmp_norm.pt = pts_norm[i];
 		keypoints_norm.push_back(tmp_norm);
 	}
 }
@@ -129,28 +203,100 @@ void BriefExtractor::operator() (const cv::Mat &im, vector<cv::KeyPoint> &keys,
 }
 
 
-bool KeyFrame::searchInAera(const BRIEF::bitset window_descriptor,
-                            const std::vector<BRIEF::bitset> &descriptors_old,
+void packBRIEF(const vector<BRIEF::bitset> &descriptors, vector<PackedBRIEF> &packed)
+{
+    packed.resize(descriptors.size());
+    for (int i = 0; i < (int)descriptors.size(); i++)
+        DBoW2::FBrief::pack(descriptors[i], packed[i]);
+}
+
+void KeyFrame::buildKeypointGrid()
+{
+    grid_cols = (COL + MATCH_GRID_SIZE - 1) / MATCH_GRID_SIZE;
+    grid_rows = (ROW + MATCH_GRID_SIZE - 1) / MATCH_GRID_SIZE;
+    keypoint_grid.assign(grid_cols * grid_rows, vector<int>());
+    for (int i = 0; i < (int)keypoints.size(); i++)
+    {
+        int c = min(max((int)(keypoints[i].pt.x / MATCH_GRID_SIZE), 0), grid_cols - 1);
+        int r = min(max((int)(keypoints[i].pt.y / MATCH_GRID_SIZE), 0), grid_rows - 1);
+        keypoint_grid[r * grid_cols + c].push_back(i);
+    }
+}
+
+void KeyFrame::getKeypointsInArea(const cv::Point2f &pt, float radius, vector<int> &indices) const
+{
+    indices.clear();
+    int c_min = max((int)((pt.x - radius) / MATCH_GRID_SIZE), 0);
+    int c_max = min((int)((pt.x + radius) / MATCH_GRID_SIZE), grid_cols - 1);
+    int r_min = max((int)((pt.y - radius) / MATCH_GRID_SIZE), 0);
+    int r_max = min((int)((pt.y + radius) / MATCH_GRID_SIZE), grid_rows - 1);
+    for (int r = r_min; r <= r_max; r++)
+        for (int c = c_min; c <= c_max; c++)
+        {
+            const vector<int> &cell = keypoint_grid[r * grid_cols + c];
+            for (int k = 0; k < (int)cell.size(); k++)
+            {
+                const cv::Point2f &kp = keypoints[cell[k]].pt;
+                if ((kp.x - pt.x) * (kp.x - pt.x) + (kp.y - pt.y) * (kp.y - pt.y) <= radius * radius)
+                    indices.push_back(cell[k]);
+            }
+        }
+}
+
+// project window points into the old keyframe with its VIO pose, only meaningful within one sequence
+void KeyFrame::predictMatchArea(const KeyFrame* old_kf, vector<cv::Point2f> &predicted_uv, vector<uchar> &predicted_status)
+{
+    predicted_uv.assign(point_3d.size(), cv::Point2f(0.f, 0.f));
+    predicted_status.assign(point_3d.size(), 0);
+    if (old_kf->sequence != sequence)
+        return;
+    Matrix3d R_w_c_old = old_kf->origin_vio_R * qic;
+    Vector3d T_w_c_old = old_kf->origin_vio_T + old_kf->origin_vio_R * tic;
+    for (int i = 0; i < (int)point_3d.size(); i++)
+    {
+        Vector3d pts_w(point_3d[i].x, point_3d[i].y, point_3d[i].z);
+        Vector3d pts_c = R_w_c_old.transpose() * (pts_w - T_w_c_old);
+        if (pts_c.z() < 0.1)
+            continue;
+        Vector2d uv;
+        m_camera->spaceToPlane(pts_c, uv);
+        if (uv.x() < 0 || uv.x() >= COL || uv.y() < 0 || uv.y() >= ROW)
+            continue;
+        predicted_uv[i] = cv::Point2f(uv.x(), uv.y());
+        predicted_status[i] = 1;
+    }
+}
+
+bool KeyFrame::searchInAera(const PackedBRIEF &window_descriptor,
+                            const std::vector<PackedBRIEF> &descriptors_old,
+                            const std::vector<int> *candidates,
                             const std::vector<cv::KeyPoint> &keypoints_old,
                             const std::vector<cv::KeyPoint> &keypoints_old_norm,
                             cv::Point2f &best_match,
                             cv::Point2f &best_match_norm)
 {
     cv::Point2f best_pt;
-    int bestDist = 128;
+    // true best and second best distances, 256 is no candidate yet
+    int bestDist = 256;
+    int secondDist = 256;
     int bestIndex = -1;
-    for(int i = 0; i < (int)descriptors_old.size(); i++)
+    int num = candidates ? (int)candidates->size() : (int)descriptors_old.size();
+    for(int k = 0; k < num; k++)
     {
-
+        int i = candidates ? (*candidates)[k] : k;
         int dis = HammingDis(window_descriptor, descriptors_old[i]);
         if(dis < bestDist)
         {
+            secondDist = bestDist;
             bestDist = dis;
             bestIndex = i;
         }
+        else if (dis < secondDist)
+            secondDist = dis;
     }
     //printf("best dist %d", bestDist);
-    if (bestIndex != -1 && bestDist < 80)
+    // absolute gate, then the ratio test when a second candidate exists
+    if (bestIndex != -1 && bestDist < 80 && (secondDist == 256 || bestDist < MATCH_RATIO * secondDist))
     {
       best_match = keypoints_old[bestIndex].pt;
       best_match_norm = keypoints_old_norm[bestIndex].pt;
@@ -163,15 +309,29 @@ bool KeyFrame::searchInAera(const BRIEF::bitset window_descriptor,
 void KeyFrame::searchByBRIEFDes(std::vector<cv::Point2f> &matched_2d_old,
 								std::vector<cv::Point2f> &matched_2d_old_norm,
                                 std::vector<uchar> &status,
-                                const std::vector<BRIEF::bitset> &descriptors_old,
-                                const std::vector<cv::KeyPoint> &keypoints_old,
-                                const std::vector<cv::KeyPoint> &keypoints_old_norm)
+                                const KeyFrame* old_kf)
 {
-    for(int i = 0; i < (int)window_brief_descriptors.size(); i++)
+    vector<cv::Point2f> predicted_uv;
+    vector<uchar> predicted_status;
+    predictMatchArea(old_kf, predicted_uv, predicted_status);
+    vector<int> candidates;
+    for(int i = 0; i < (int)packed_window_brief_descriptors.size(); i++)
     {
         cv::Point2f pt(0.f, 0.f);
         cv::Point2f pt_norm(0.f, 0.f);
-        if (searchInAera(window_brief_descriptors[i], descriptors_old, keypoints_old, keypoints_old_norm, pt, pt_norm))
+        bool found = false;
+        // search around the predicted location first, fall back to all old keypoints
+        if (predicted_status[i])
+        {
+            old_kf->getKeypointsInArea(predicted_uv[i], MATCH_SEARCH_RADIUS, candidates);
+            if (!candidates.empty())
+                found = searchInAera(packed_window_brief_descriptors[i], old_kf->packed_brief_descriptors, &candidates,
+                                     old_kf->keypoints, old_kf->keypoints_norm, pt, pt_norm);
+        }
+        if (!found)
+            found = searchInAera(packed_window_brief_descriptors[i], old_kf->packed_brief_descriptors, NULL,
+                                 old_kf->keypoints, old_kf->keypoints_norm, pt, pt_norm);
+        if (found)
           status.push_back(1);
         else
           status.push_back(0);
@@ -208,6 +368,61 @@ void KeyFrame::FundmantalMatrixRANSAC(const std::vector<cv::Point2f> &matched_2d
     }
 }
 
+// 2D-2D check before PnP: the matches of a true loop agree with the epipolar geometry of the
+// viewpoint change whatever its translation, random descriptor matches do not
+bool KeyFrame::EpipolarPrefilter(const std::vector<cv::Point2f> &matched_2d_cur_norm,
+                                 const std::vector<cv::Point2f> &matched_2d_old_norm)
+{
+    if ((int)matched_2d_cur_norm.size() < max(8, PREFILTER_MIN_NUM))
+        return false;
+    // on normalized coordinates the fundamental matrix is the essential matrix
+    vector<uchar> mask;
+    cv::Mat E = cv::findFundamentalMat(matched_2d_cur_norm, matched_2d_old_norm, cv::FM_RANSAC, PREFILTER_THRESHOLD, 0.99, mask);
+    if (E.empty())
+        return false;
+    return count(mask.begin(), mask.end(), 1) >= PREFILTER_MIN_NUM;
+}
+
+// Number of matches reprojected within PNP_THRESHOLD by the camera pose (R, t) (world to camera).
+// With epsilon > 0 the hypothesis is scored by a sequential probability ratio test against the
+// expected inlier ratio epsilon and -1 is returned as soon as it is rejected.
+static int scorePnPHypothesis(const Matrix3d &R, const Vector3d &t,
+                              const std::vector<cv::Point3f> &matched_3d,
+                              const std::vector<cv::Point2f> &matched_2d_old_norm,
+                              double epsilon, vector<uchar> *inlier_mask)
+{
+    const double threshold2 = PNP_THRESHOLD * PNP_THRESHOLD;
+    const double accept_ratio = epsilon > 0 ? SPRT_DELTA / epsilon : 1.0;
+    const double reject_ratio = epsilon > 0 ? (1.0 - SPRT_DELTA) / (1.0 - epsilon) : 1.0;
+    double lambda = 1.0;
+    int inlier_cnt = 0;
+    for (int i = 0; i < (int)matched_3d.size(); i++)
+    {
+        Vector3d p = R * Vector3d(matched_3d[i].x, matched_3d[i].y, matched_3d[i].z) + t;
+        bool inlier = false;
+        if (p.z() > 0)
+        {
+            double du = p.x() / p.z() - matched_2d_old_norm[i].x;
+            double dv = p.y() / p.z() - matched_2d_old_norm[i].y;
+            inlier = du * du + dv * dv < threshold2;
+        }
+        if (inlier_mask != NULL)
+            (*inlier_mask)[i] = inlier;
+        if (inlier)
+        {
+            inlier_cnt++;
+            lambda *= accept_ratio;
+        }
+        else
+        {
+            lambda *= reject_ratio;
+            if (epsilon > 0 && lambda > SPRT_THRESHOLD)
+                return -1;
+        }
+    }
+    return inlier_cnt;
+}
+
 void KeyFrame::PnPRANSAC(const vector<cv::Point2f> &matched_2d_old_norm,
                          const std::vector<cv::Point3f> &matched_3d,
                          std::vector<uchar> &status,
@@ -226,39 +441,113 @@ void KeyFrame::PnPRANSAC(const vector<cv::Point2f> &matched_2d_old_norm,
     R_inital = R_w_c.inverse();
     P_inital = -(R_inital * T_w_c);
 
-    cv::eigen2cv(R_inital, tmp_r);
-    cv::Rodrigues(tmp_r, rvec);
-    cv::eigen2cv(P_inital, t);
+    int n = (int)matched_3d.size();
+    status.assign(n, 0);
 
-    cv::Mat inliers;
+    // P3P hypotheses are generated and scored in parallel batches, the number of hypotheses
+    // shrinks with the best inlier ratio found so far
     TicToc t_pnp_ransac;
-
-    if (CV_MAJOR_VERSION < 3)
-        solvePnPRansac(matched_3d, matched_2d_old_norm, K, D, rvec, t, true, 100, 10.0 / 460.0, 100, inliers);
-    else
+    Matrix3d R_pnp = R_inital;
+    Vector3d T_pnp = P_inital;
+    int best_cnt = 0;
+    int max_iterations = PNP_MAX_ITERATIONS;
+    vector<Matrix3d> hypothesis_R(PNP_BATCH);
+    vector<Vector3d> hypothesis_t(PNP_BATCH);
+    vector<int> hypothesis_cnt(PNP_BATCH);
+    for (int iter = 0; iter < max_iterations && n >= 4; iter += PNP_BATCH)
     {
-        if (CV_MINOR_VERSION < 2)
-            solvePnPRansac(matched_3d, matched_2d_old_norm, K, D, rvec, t, true, 100, sqrt(10.0 / 460.0), 0.99, inliers);
-        else
-            solvePnPRansac(matched_3d, matched_2d_old_norm, K, D, rvec, t, true, 100, 10.0 / 460.0, 0.99, inliers);
-
+        double epsilon = best_cnt > 0 ? min(0.95, (double)best_cnt / n) : 0.1;
+        cv::parallel_for_(cv::Range(0, PNP_BATCH), [&](const cv::Range &range)
+        {
+            for (int h = range.start; h < range.end; h++)
+            {
+                hypothesis_cnt[h] = -1;
+                // seeded per hypothesis, the result does not depend on the thread schedule
+                cv::RNG rng((uint64)index * PNP_MAX_ITERATIONS + iter + h);
+                int sample[4];
+                for (int k = 0; k < 4; k++)
+                {
+                    bool repeated = true;
+                    while (repeated)
+                    {
+                        sample[k] = rng.uniform(0, n);
+                        repeated = false;
+                        for (int l = 0; l < k; l++)
+                            repeated = repeated || sample[l] == sample[k];
+                    }
+                }
+                vector<cv::Point3f> sample_3d(4);
+                vector<cv::Point2f> sample_2d(4);
+                for (int k = 0; k < 4; k++)
+                {
+                    sample_3d[k] = matched_3d[sample[k]];
+                    sample_2d[k] = matched_2d_old_norm[sample[k]];
+                }
+                cv::Mat sample_rvec, sample_t, sample_r;
+                if (!cv::solvePnP(sample_3d, sample_2d, K, D, sample_rvec, sample_t, false, cv::SOLVEPNP_P3P))
+                    continue;
+                cv::Rodrigues(sample_rvec, sample_r);
+                cv::cv2eigen(sample_r, hypothesis_R[h]);
+                cv::cv2eigen(sample_t, hypothesis_t[h]);
+                hypothesis_cnt[h] = scorePnPHypothesis(hypothesis_R[h], hypothesis_t[h], matched_3d, matched_2d_old_norm, epsilon, NULL);
+            }
+        });
+        for (int h = 0; h < PNP_BATCH; h++)
+        {
+            if (hypothesis_cnt[h] > best_cnt)
+            {
+                best_cnt = hypothesis_cnt[h];
+                R_pnp = hypothesis_R[h];
+                T_pnp = hypothesis_t[h];
+            }
+        }
+        if (best_cnt > 0)
+        {
+            double outlier_prob = 1.0 - pow((double)best_cnt / n, 4);
+            if (outlier_prob <= 0)
+                break;
+            max_iterations = min(PNP_MAX_ITERATIONS, (int)ceil(log(1.0 - PNP_CONFIDENCE) / log(outlier_prob)));
+        }
     }
+    verify_time.ransac = t_pnp_ransac.toc();
 
-    for (int i = 0; i < (int)matched_2d_old_norm.size(); i++)
-        status.push_back(0);
-
-    for( int i = 0; i < inliers.rows; i++)
+    // refine the best hypothesis on its inliers
+    TicToc t_refine;
+    if (best_cnt >= 4)
     {
-        int n = inliers.at<int>(i);
-        status[n] = 1;
+        scorePnPHypothesis(R_pnp, T_pnp, matched_3d, matched_2d_old_norm, 0, &status);
+        vector<cv::Point3f> inlier_3d;
+        vector<cv::Point2f> inlier_2d;
+        for (int i = 0; i < n; i++)
+            if (status[i])
+            {
+                inlier_3d.push_back(matched_3d[i]);
+                inlier_2d.push_back(matched_2d_old_norm[i]);
+            }
+        cv::eigen2cv(R_pnp, tmp_r);
+        cv::Rodrigues(tmp_r, rvec);
+        cv::eigen2cv(T_pnp, t);
+        if (cv::solvePnP(inlier_3d, inlier_2d, K, D, rvec, t, true, cv::SOLVEPNP_ITERATIVE))
+        {
+            Matrix3d R_refined;
+            Vector3d T_refined;
+            cv::Rodrigues(rvec, r);
+            cv::cv2eigen(r, R_refined);
+            cv::cv2eigen(t, T_refined);
+            vector<uchar> refined_status(n, 0);
+            if (scorePnPHypothesis(R_refined, T_refined, matched_3d, matched_2d_old_norm, 0, &refined_status) >= best_cnt)
+            {
+                R_pnp = R_refined;
+                T_pnp = T_refined;
+                status.swap(refined_status);
+            }
+        }
     }
+    verify_time.refine = t_refine.toc();
 
-    cv::Rodrigues(rvec, r);
-    Matrix3d R_pnp, R_w_c_old;
-    cv::cv2eigen(r, R_pnp);
+    Matrix3d R_w_c_old;
     R_w_c_old = R_pnp.transpose();
-    Vector3d T_pnp, T_w_c_old;
-    cv::cv2eigen(t, T_pnp);
+    Vector3d T_w_c_old;
     T_w_c_old = R_w_c_old * (-T_pnp);
 
     PnP_R_old = R_w_c_old * qic.transpose();
@@ -267,7 +556,9 @@ void KeyFrame::PnPRANSAC(const vector<cv::Point2f> &matched_2d_old_norm,
 }
 
 
-bool KeyFrame::findConnection(KeyFrame* old_kf)
+// relative pose to old_kf on success; the keyframe may already be in the pose graph, the caller
+// sets the loop fields under its lock
+bool KeyFrame::findConnection(KeyFrame* old_kf, Eigen::Matrix<double, 8, 1 > &_loop_info)
 {
 	TicToc tmp_t;
 	//printf("find Connection\n");
@@ -281,6 +572,7 @@ bool KeyFrame::findConnection(KeyFrame* old_kf)
 	matched_2d_cur = point_2d_uv;
 	matched_2d_cur_norm = point_2d_norm;
 	matched_id = point_id;
+	verify_time.match = verify_time.prefilter = verify_time.ransac = verify_time.refine = 0;
 
 	TicToc t_match;
 	#if 0
@@ -309,13 +601,14 @@ bool KeyFrame::findConnection(KeyFrame* old_kf)
 	    }
 	#endif
 	//printf("search by des\n");
-	searchByBRIEFDes(matched_2d_old, matched_2d_old_norm, status, old_kf->brief_descriptors, old_kf->keypoints, old_kf->keypoints_norm);
+	searchByBRIEFDes(matched_2d_old, matched_2d_old_norm, status, old_kf);
 	reduceVector(matched_2d_cur, status);
 	reduceVector(matched_2d_old, status);
 	reduceVector(matched_2d_cur_norm, status);
 	reduceVector(matched_2d_old_norm, status);
 	reduceVector(matched_3d, status);
 	reduceVector(matched_id, status);
+	verify_time.match = t_match.toc();
 	//printf("search by des finish\n");
 
 	#if 0 
@@ -416,6 +709,11 @@ bool KeyFrame::findConnection(KeyFrame* old_kf)
 	double relative_yaw;
 	if ((int)matched_2d_cur.size() > MIN_LOOP_NUM)
 	{
+		TicToc t_prefilter;
+		bool consistent = EpipolarPrefilter(matched_2d_cur_norm, matched_2d_old_norm);
+		verify_time.prefilter = t_prefilter.toc();
+		if (!consistent)
+			return false;
 		status.clear();
 	    PnPRANSAC(matched_2d_old_norm, matched_3d, status, PnP_T_old, PnP_R_old);
 	    reduceVector(matched_2d_cur, status);
@@ -491,9 +789,7 @@ bool KeyFrame::findConnection(KeyFrame* old_kf)
 	    if (abs(relative_yaw) < 30.0 && relative_t.norm() < 20.0)
 	    {
 
-	    	has_loop = true;
-	    	loop_index = old_kf->index;
-	    	loop_info << relative_t.x(), relative_t.y(), relative_t.z(),
+	    	_loop_info << relative_t.x(), relative_t.y(), relative_t.z(),
 	    	             relative_q.w(), relative_q.x(), relative_q.y(), relative_q.z(),
 	    	             relative_yaw;
 	    	//cout << "pnp relative_t " << relative_t.transpose() << endl;
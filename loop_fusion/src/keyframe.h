@@ -12,6 +12,8 @@
 #pragma once
 
 #include <vector>
+#include <list>
+#include <stdint.h>
 #include <eigen3/Eigen/Dense>
 #include <opencv2/opencv.hpp>
 #include <opencv2/core/eigen.hpp>
@@ -25,12 +27,39 @@
 #include "ThirdParty/DVision/DVision.h"
 
 #define MIN_LOOP_NUM 25
+#define BRIEF_WORDS 4   // 256-bit BRIEF descriptor in 64-bit words
+#define MATCH_GRID_SIZE 40          // cell size (pixel) of the old keypoint grid
+#define MATCH_SEARCH_RADIUS 60.0    // search radius (pixel) around the predicted location
+#define MATCH_RATIO 0.9             // max ratio of best to second best Hamming distance
+#define PREFILTER_THRESHOLD (3.0 / 460.0)   // max epipolar distance in normalized coordinates
+#define PREFILTER_MIN_NUM (MIN_LOOP_NUM / 2)
+#define PNP_MAX_ITERATIONS 100      // max P3P hypotheses
+#define PNP_BATCH 16                // P3P hypotheses scored in parallel between termination checks
+#define PNP_THRESHOLD (10.0 / 460.0)    // reprojection threshold in normalized coordinates
+#define PNP_CONFIDENCE 0.99
+#define SPRT_DELTA 0.05             // probability of an outlier to agree with a hypothesis
+#define SPRT_THRESHOLD 100.0        // likelihood ratio at which a hypothesis is rejected
 
 using namespace Eigen;
 using namespace std;
 using namespace DVision;
 
 
+// BRIEF descriptor packed into one contiguous 32-byte block for popcount matching,
+// shared with the vocabulary so that the packed descriptors can be transformed directly
+typedef DBoW2::FBrief::TPacked PackedBRIEF;
+
+void packBRIEF(const vector<BRIEF::bitset> &descriptors, vector<PackedBRIEF> &packed);
+
+// stage times (ms) of the last KeyFrame::findConnection
+struct LoopVerifyTime
+{
+	double match;
+	double prefilter;
+	double ransac;
+	double refine;
+};
+
 class BriefExtractor
 {
 public:
@@ -49,13 +78,31 @@ public:
 	KeyFrame(double _time_stamp, int _index, Vector3d &_vio_T_w_i, Matrix3d &_vio_R_w_i, Vector3d &_T_w_i, Matrix3d &_R_w_i,
 			 cv::Mat &_image, int _loop_index, Eigen::Matrix<double, 8, 1 > &_loop_info,
 			 vector<cv::KeyPoint> &_keypoints, vector<cv::KeyPoint> &_keypoints_norm, vector<BRIEF::bitset> &_brief_descriptors);
-	bool findConnection(KeyFrame* old_kf);
+	KeyFrame(double _time_stamp, int _index, Vector3d &_vio_T_w_i, Matrix3d &_vio_R_w_i, Vector3d &_T_w_i, Matrix3d &_R_w_i,
+			 cv::Mat &_image, int _loop_index, Eigen::Matrix<double, 8, 1 > &_loop_info,
+			 vector<cv::KeyPoint> &_keypoints, vector<cv::KeyPoint> &_keypoints_norm, const vector<PackedBRIEF> &_packed_brief_descriptors);
+	bool findConnection(KeyFrame* old_kf, Eigen::Matrix<double, 8, 1 > &_loop_info);
+	void extractFeatures();
+	size_t featureMemory() const;
+	void releaseFeatures();
+	void releaseWindowFeatures();
 	void computeWindowBRIEFPoint();
 	void computeBRIEFPoint();
 	//void extractBrief();
 	int HammingDis(const BRIEF::bitset &a, const BRIEF::bitset &b);
-	bool searchInAera(const BRIEF::bitset window_descriptor,
-	                  const std::vector<BRIEF::bitset> &descriptors_old,
+	static inline int HammingDis(const PackedBRIEF &a, const PackedBRIEF &b)
+	{
+		int dis = 0;
+		for (int k = 0; k < BRIEF_WORDS; k++)
+			dis += __builtin_popcountll(a.bits[k] ^ b.bits[k]);
+		return dis;
+	}
+	void buildKeypointGrid();
+	void getKeypointsInArea(const cv::Point2f &pt, float radius, vector<int> &indices) const;
+	void predictMatchArea(const KeyFrame* old_kf, vector<cv::Point2f> &predicted_uv, vector<uchar> &predicted_status);
+	bool searchInAera(const PackedBRIEF &window_descriptor,
+	                  const std::vector<PackedBRIEF> &descriptors_old,
+	                  const std::vector<int> *candidates,
 	                  const std::vector<cv::KeyPoint> &keypoints_old,
 	                  const std::vector<cv::KeyPoint> &keypoints_old_norm,
 	                  cv::Point2f &best_match,
@@ -63,12 +110,12 @@ public:
 	void searchByBRIEFDes(std::vector<cv::Point2f> &matched_2d_old,
 						  std::vector<cv::Point2f> &matched_2d_old_norm,
                           std::vector<uchar> &status,
-                          const std::vector<BRIEF::bitset> &descriptors_old,
-                          const std::vector<cv::KeyPoint> &keypoints_old,
-                          const std::vector<cv::KeyPoint> &keypoints_old_norm);
+                          const KeyFrame* old_kf);
 	void FundmantalMatrixRANSAC(const std::vector<cv::Point2f> &matched_2d_cur_norm,
                                 const std::vector<cv::Point2f> &matched_2d_old_norm,
                                 vector<uchar> &status);
+	bool EpipolarPrefilter(const std::vector<cv::Point2f> &matched_2d_cur_norm,
+	                       const std::vector<cv::Point2f> &matched_2d_old_norm);
 	void PnPRANSAC(const vector<cv::Point2f> &matched_2d_old_norm,
 	               const std::vector<cv::Point3f> &matched_3d,
 	               std::vector<uchar> &status,
@@ -105,11 +152,24 @@ public:
 	vector<cv::KeyPoint> window_keypoints;
 	vector<BRIEF::bitset> brief_descriptors;
 	vector<BRIEF::bitset> window_brief_descriptors;
+	vector<PackedBRIEF> packed_brief_descriptors;
+	vector<PackedBRIEF> packed_window_brief_descriptors;
+	vector<vector<int> > keypoint_grid;     // keypoint indices per MATCH_GRID_SIZE cell, row major
+	int grid_cols, grid_rows;
 	bool has_fast_point;
 	int sequence;
 
+	// bounded-memory keyframe store, owned by PoseGraph (see PoseGraph::pinKeyFrame)
+	bool features_spilled;                  // keypoints and descriptors only live in the spill file
+	long spill_offset;                      // offset of the features in the spill file, -1 if never spilled
+	int spill_num;                          // number of keypoints in the spill file
+	const char *map_features;               // features in the mapped pose graph map instead of the spill file, or NULL
+	bool evictable;                         // listed in PoseGraph::resident_list
+	list<KeyFrame*>::iterator resident_it;
+
 	bool has_loop;
 	int loop_index;
 	Eigen::Matrix<double, 8, 1 > loop_info;
+	LoopVerifyTime verify_time;
 };
 
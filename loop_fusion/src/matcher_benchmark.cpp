@@ -0,0 +1,214 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+// BRIEF matching cost of the loop closure, on a synthetic keyframe pair.
+// usage: loop_fusion_matcher_benchmark [num_keypoints] [num_runs]
+//   per pair:      HammingDis on PackedBRIEF vs the dynamic_bitset XOR/count
+//   per candidate: KeyFrame::searchByBRIEFDes (brute force and predicted area) vs a
+//                  brute force search over dynamic_bitset descriptors, i.e. the matching
+//                  work findConnection does for each loop candidate
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <random>
+#include <vector>
+#include <eigen3/Eigen/Dense>
+#include "camodocal/camera_models/PinholeCamera.h"
+#include "keyframe.h"
+#include "parameters.h"
+#include "utility/tic_toc.h"
+
+// globals normally set up by pose_graph_node
+camodocal::CameraPtr m_camera;
+Eigen::Vector3d tic;
+Eigen::Matrix3d qic;
+ros::Publisher pub_match_img;
+int VISUALIZATION_SHIFT_X;
+int VISUALIZATION_SHIFT_Y;
+std::string BRIEF_PATTERN_FILE;
+std::string POSE_GRAPH_SAVE_PATH;
+int ROW = 480;
+int COL = 752;
+std::string VINS_RESULT_PATH;
+int DEBUG_IMAGE = 0;
+
+#define BENCH_MATCH_RATIO 0.6       // fraction of window points that revisit an old keypoint
+#define BENCH_BIT_NOISE 0.08        // fraction of flipped descriptor bits of a revisited point
+
+static std::mt19937 rng(42);
+
+static BRIEF::bitset randomDescriptor()
+{
+    BRIEF::bitset des(64 * BRIEF_WORDS);
+    std::uniform_int_distribution<int> bit(0, 1);
+    for (size_t j = 0; j < des.size(); j++)
+        if (bit(rng))
+            des.set(j);
+    return des;
+}
+
+static BRIEF::bitset perturbDescriptor(const BRIEF::bitset &des)
+{
+    BRIEF::bitset out = des;
+    std::uniform_real_distribution<double> u(0.0, 1.0);
+    for (size_t j = 0; j < out.size(); j++)
+        if (u(rng) < BENCH_BIT_NOISE)
+            out.flip(j);
+    return out;
+}
+
+// the matcher before descriptor packing: brute force with the bitset XOR/count
+static int bitsetSearch(KeyFrame *kf, const vector<BRIEF::bitset> &window_des, const vector<BRIEF::bitset> &old_des)
+{
+    int matched = 0;
+    for (size_t i = 0; i < window_des.size(); i++)
+    {
+        int bestDist = 256;
+        int secondDist = 256;
+        int bestIndex = -1;
+        for (size_t k = 0; k < old_des.size(); k++)
+        {
+            int dis = kf->HammingDis(window_des[i], old_des[k]);
+            if (dis < bestDist)
+            {
+                secondDist = bestDist;
+                bestDist = dis;
+                bestIndex = k;
+            }
+            else if (dis < secondDist)
+                secondDist = dis;
+        }
+        if (bestIndex != -1 && bestDist < 80 && (secondDist == 256 || bestDist < MATCH_RATIO * secondDist))
+            matched++;
+    }
+    return matched;
+}
+
+int main(int argc, char **argv)
+{
+    int num = argc > 1 ? atoi(argv[1]) : 500;
+    int runs = argc > 2 ? atoi(argv[2]) : 20;
+    num = max(num, 1);
+    runs = max(runs, 1);
+
+    tic.setZero();
+    qic.setIdentity();
+    m_camera = camodocal::CameraPtr(new camodocal::PinholeCamera("benchmark", COL, ROW, 0, 0, 0, 0,
+                                                                 460.0, 460.0, COL / 2.0, ROW / 2.0));
+
+    // old keyframe: FAST keypoints with descriptors, at the identity pose
+    std::uniform_real_distribution<double> u_col(0.0, COL - 1), u_row(0.0, ROW - 1), u_depth(2.0, 10.0);
+    std::uniform_real_distribution<double> u_unit(0.0, 1.0);
+    vector<cv::KeyPoint> keypoints(num), keypoints_norm(num);
+    vector<BRIEF::bitset> old_des(num);
+    vector<cv::Point3f> old_points(num);
+    for (int i = 0; i < num; i++)
+    {
+        float x = u_col(rng), y = u_row(rng);
+        Eigen::Vector3d P;
+        m_camera->liftProjective(Eigen::Vector2d(x, y), P);
+        double depth = u_depth(rng);
+        keypoints[i].pt = cv::Point2f(x, y);
+        keypoints_norm[i].pt = cv::Point2f(P.x() / P.z(), P.y() / P.z());
+        old_des[i] = randomDescriptor();
+        old_points[i] = cv::Point3f(P.x() / P.z() * depth, P.y() / P.z() * depth, depth);
+    }
+
+    Eigen::Vector3d T = Eigen::Vector3d::Zero();
+    Eigen::Matrix3d R = Eigen::Matrix3d::Identity();
+    cv::Mat image;
+    Eigen::Matrix<double, 8, 1> loop_info = Eigen::Matrix<double, 8, 1>::Zero();
+    KeyFrame old_kf(0, 0, T, R, T, R, image, -1, loop_info, keypoints, keypoints_norm, old_des);
+    old_kf.origin_vio_T = T;
+    old_kf.origin_vio_R = R;
+
+    // current keyframe: window points, part of them revisiting old keypoints with noisy descriptors
+    vector<cv::KeyPoint> no_keypoints;
+    vector<BRIEF::bitset> no_des;
+    KeyFrame cur_kf(1, 1, T, R, T, R, image, -1, loop_info, no_keypoints, no_keypoints, no_des);
+    vector<BRIEF::bitset> window_des(num);
+    cur_kf.point_3d.resize(num);
+    for (int i = 0; i < num; i++)
+    {
+        if (u_unit(rng) < BENCH_MATCH_RATIO)
+        {
+            window_des[i] = perturbDescriptor(old_des[i]);
+            cur_kf.point_3d[i] = old_points[i];
+        }
+        else
+        {
+            window_des[i] = randomDescriptor();
+            double depth = u_depth(rng);
+            cur_kf.point_3d[i] = cv::Point3f((u_col(rng) / COL - 0.5) * depth, (u_row(rng) / ROW - 0.5) * depth, depth);
+        }
+    }
+    packBRIEF(window_des, cur_kf.packed_window_brief_descriptors);
+
+    printf("%d old keypoints, %d window points, best of %d runs\n", num, num, runs);
+
+    // per pair
+    vector<PackedBRIEF> packed_old;
+    packBRIEF(old_des, packed_old);
+    double t_bitset = 1e12, t_packed = 1e12;
+    long checksum = 0;
+    for (int r = 0; r < runs; r++)
+    {
+        TicToc t;
+        for (int i = 0; i < num; i++)
+            for (int k = 0; k < num; k++)
+                checksum += cur_kf.HammingDis(window_des[i], old_des[k]);
+        t_bitset = min(t_bitset, t.toc());
+
+        t.tic();
+        for (int i = 0; i < num; i++)
+            for (int k = 0; k < num; k++)
+                checksum -= KeyFrame::HammingDis(cur_kf.packed_window_brief_descriptors[i], packed_old[k]);
+        t_packed = min(t_packed, t.toc());
+    }
+    double pairs = (double)num * num;
+    printf("HammingDis per pair: bitset %.2f ns, packed %.2f ns, speedup %.1fx%s\n",
+           t_bitset / pairs * 1e6, t_packed / pairs * 1e6, t_bitset / t_packed,
+           checksum == 0 ? "" : " (distance mismatch!)");
+
+    // per candidate
+    double t_bitset_search = 1e12, t_brute = 1e12, t_predicted = 1e12;
+    int matched_bitset = 0, matched_brute = 0, matched_predicted = 0;
+    for (int r = 0; r < runs; r++)
+    {
+        TicToc t;
+        matched_bitset = bitsetSearch(&cur_kf, window_des, old_des);
+        t_bitset_search = min(t_bitset_search, t.toc());
+
+        // keyframes of different sequences have no pose prior, every window point scans all old keypoints
+        vector<cv::Point2f> matched_2d_old, matched_2d_old_norm;
+        vector<uchar> status;
+        old_kf.sequence = 0;
+        cur_kf.sequence = 1;
+        t.tic();
+        cur_kf.searchByBRIEFDes(matched_2d_old, matched_2d_old_norm, status, &old_kf);
+        t_brute = min(t_brute, t.toc());
+        matched_brute = count(status.begin(), status.end(), 1);
+
+        matched_2d_old.clear();
+        matched_2d_old_norm.clear();
+        status.clear();
+        old_kf.sequence = 1;
+        t.tic();
+        cur_kf.searchByBRIEFDes(matched_2d_old, matched_2d_old_norm, status, &old_kf);
+        t_predicted = min(t_predicted, t.toc());
+        matched_predicted = count(status.begin(), status.end(), 1);
+    }
+    printf("searchByBRIEFDes per candidate: bitset brute force %.3f ms (%d matches), "
+           "packed brute force %.3f ms (%d matches), packed predicted area %.3f ms (%d matches)\n",
+           t_bitset_search, matched_bitset, t_brute, matched_brute, t_predicted, matched_predicted);
+    printf("speedup per candidate: %.1fx brute force, %.1fx predicted area\n",
+           t_bitset_search / t_brute, t_bitset_search / t_predicted);
+    return 0;
+}
@@ -10,6 +10,10 @@
  *******************************************************/
 
 #include "pose_graph.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 PoseGraph::PoseGraph()
 {
@@ -17,6 +21,8 @@ PoseGraph::PoseGraph()
     posegraph_visualization->setScale(0.1);
     posegraph_visualization->setLineWidth(0.01);
     earliest_loop_index = -1;
+    last_loop_index = -1;
+    culled_cnt = 0;
     t_drift = Eigen::Vector3d(0, 0, 0);
     yaw_drift = 0;
     r_drift = Eigen::Matrix3d::Identity();
@@ -27,11 +33,39 @@ PoseGraph::PoseGraph()
     sequence_loop.push_back(0);
     base_sequence = 1;
     use_imu = 0;
+    loop_pending_cnt = 0;
+    thread_stop = false;
+    resident_memory = 0;
+    memory_budget = 0;
+    spill_file = NULL;
+    map_data = NULL;
+    map_size = 0;
+    result_file_size = 0;
+    drawn_sequence = 0;
+    t_extraction = std::thread(&PoseGraph::extractionThread, this);
+    t_loop_detection = std::thread(&PoseGraph::detectionThread, this);
+    t_loop_verification = std::thread(&PoseGraph::verificationThread, this);
 }
 
 PoseGraph::~PoseGraph()
 {
-    t_optimization.detach();
+    // the workers use this object and the keyframes in their queues until they return
+    thread_stop = true;
+    if (t_optimization.joinable())
+        t_optimization.join();
+    t_extraction.join();
+    t_loop_detection.join();
+    t_loop_verification.join();
+    // no thread can page keyframes in or out any more
+    m_spill.lock();
+    if (spill_file != NULL)
+    {
+        fclose(spill_file);
+        spill_file = NULL;
+    }
+    m_spill.unlock();
+    if (map_data != NULL)
+        munmap(map_data, map_size);
 }
 
 void PoseGraph::registerPub(ros::NodeHandle &n)
@@ -59,6 +93,13 @@ void PoseGraph::setIMUFlag(bool _use_imu)
 
 }
 
+void PoseGraph::setMemoryBudget(int budget_mb)
+{
+    memory_budget = budget_mb > 0 ? (size_t)budget_mb << 20 : 0;
+    if (memory_budget > 0)
+        printf("keyframe memory budget %d MB, cold keyframes spill to %skeyframe_spill.bin\n", budget_mb, POSE_GRAPH_SAVE_PATH.c_str());
+}
+
 void PoseGraph::loadVocabulary(std::string voc_path)
 {
     voc = new BriefVocabulary(voc_path);
@@ -70,6 +111,7 @@ void PoseGraph::addKeyFrame(KeyFrame* cur_kf, bool flag_detect_loop)
     //shift to base frame
     Vector3d vio_P_cur;
     Matrix3d vio_R_cur;
+	m_keyframelist.lock();
     if (sequence_cnt != cur_kf->sequence)
     {
         sequence_cnt++;
@@ -88,77 +130,6 @@ void PoseGraph::addKeyFrame(KeyFrame* cur_kf, bool flag_detect_loop)
     cur_kf->updateVioPose(vio_P_cur, vio_R_cur);
     cur_kf->index = global_index;
     global_index++;
-	int loop_index = -1;
-    if (flag_detect_loop)
-    {
-        TicToc tmp_t;
-        loop_index = detectLoop(cur_kf, cur_kf->index);
-    }
-    else
-    {
-        addKeyFrameIntoVoc(cur_kf);
-    }
-	if (loop_index != -1)
-	{
-        //printf(" %d detect loop with %d \n", cur_kf->index, loop_index);
-        KeyFrame* old_kf = getKeyFrame(loop_index);
-
-        if (cur_kf->findConnection(old_kf))
-        {
-            if (earliest_loop_index > loop_index || earliest_loop_index == -1)
-                earliest_loop_index = loop_index;
-
-            Vector3d w_P_old, w_P_cur, vio_P_cur;
-            Matrix3d w_R_old, w_R_cur, vio_R_cur;
-            old_kf->getVioPose(w_P_old, w_R_old);
-            cur_kf->getVioPose(vio_P_cur, vio_R_cur);
-
-            Vector3d relative_t;
-            Quaterniond relative_q;
-            relative_t = cur_kf->getLoopRelativeT();
-            relative_q = (cur_kf->getLoopRelativeQ()).toRotationMatrix();
-            w_P_cur = w_R_old * relative_t + w_P_old;
-            w_R_cur = w_R_old * relative_q;
-            double shift_yaw;
-            Matrix3d shift_r;
-            Vector3d shift_t; 
-            if(use_imu)
-            {
-                shift_yaw = Utility::R2ypr(w_R_cur).x() - Utility::R2ypr(vio_R_cur).x();
-                shift_r = Utility::ypr2R(Vector3d(shift_yaw, 0, 0));
-            }
-            else
-                shift_r = w_R_cur * vio_R_cur.transpose();
-            shift_t = w_P_cur - w_R_cur * vio_R_cur.transpose() * vio_P_cur; 
-            // shift vio pose of whole sequence to the world frame
-            if (old_kf->sequence != cur_kf->sequence && sequence_loop[cur_kf->sequence] == 0)
-            {  
-                w_r_vio = shift_r;
-                w_t_vio = shift_t;
-                vio_P_cur = w_r_vio * vio_P_cur + w_t_vio;
-                vio_R_cur = w_r_vio *  vio_R_cur;
-                cur_kf->updateVioPose(vio_P_cur, vio_R_cur);
-                list<KeyFrame*>::iterator it = keyframelist.begin();
-                for (; it != keyframelist.end(); it++)   
-                {
-                    if((*it)->sequence == cur_kf->sequence)
-                    {
-                        Vector3d vio_P_cur;
-                        Matrix3d vio_R_cur;
-                        (*it)->getVioPose(vio_P_cur, vio_R_cur);
-                        vio_P_cur = w_r_vio * vio_P_cur + w_t_vio;
-                        vio_R_cur = w_r_vio *  vio_R_cur;
-                        (*it)->updateVioPose(vio_P_cur, vio_R_cur);
-                    }
-                }
-                sequence_loop[cur_kf->sequence] = 1;
-            }
-            m_optimize_buf.lock();
-            optimize_buf.push(cur_kf->index);
-            m_optimize_buf.unlock();
-        }
-	}
-	m_keyframelist.lock();
     Vector3d P;
     Matrix3d R;
     cur_kf->getVioPose(P, R);
@@ -182,23 +153,13 @@ void PoseGraph::addKeyFrame(KeyFrame* cur_kf, bool flag_detect_loop)
     if (SAVE_LOOP_PATH)
     {
         ofstream loop_path_file(VINS_RESULT_PATH, ios::app);
-        loop_path_file.setf(ios::fixed, ios::floatfield);
-        loop_path_file.precision(0);
-        loop_path_file << cur_kf->time_stamp * 1e9 << ",";
-        loop_path_file.precision(5);
-        loop_path_file  << P.x() << ","
-              << P.y() << ","
-              << P.z() << ","
-              << Q.w() << ","
-              << Q.x() << ","
-              << Q.y() << ","
-              << Q.z() << ","
-              << endl;
+        saveResultRecord(loop_path_file, cur_kf);
         loop_path_file.close();
     }
     //draw local connection
     if (SHOW_S_EDGE)
     {
+        edge_markers.push_back(make_pair(cur_kf->index, posegraph_visualization->markerNum()));
         list<KeyFrame*>::reverse_iterator rit = keyframelist.rbegin();
         for (int i = 0; i < 4; i++)
         {
@@ -214,30 +175,326 @@ void PoseGraph::addKeyFrame(KeyFrame* cur_kf, bool flag_detect_loop)
             rit++;
         }
     }
-    if (SHOW_L_EDGE)
+    //posegraph_visualization->add_pose(P + Vector3d(VISUALIZATION_SHIFT_X, VISUALIZATION_SHIFT_Y, 0), Q);
+
+	keyframelist.push_back(cur_kf);
+	keyframe_map[cur_kf->index] = cur_kf;
+    publish();
+	m_keyframelist.unlock();
+
+    // feature extraction, loop detection and verification run on the loop closure threads,
+    // a verified loop edge is added to the graph whenever it arrives
+    loop_pending_cnt++;
+    m_extract_buf.lock();
+    extract_buf.push(make_pair(cur_kf, flag_detect_loop));
+    m_extract_buf.unlock();
+}
+
+void PoseGraph::extractionThread()
+{
+    while(!thread_stop)
+    {
+        KeyFrame* cur_kf = NULL;
+        bool flag_detect_loop = false;
+        m_extract_buf.lock();
+        if (!extract_buf.empty())
+        {
+            cur_kf = extract_buf.front().first;
+            flag_detect_loop = extract_buf.front().second;
+            extract_buf.pop();
+        }
+        m_extract_buf.unlock();
+        if (cur_kf != NULL)
+        {
+            cur_kf->extractFeatures();
+            m_detect_buf.lock();
+            detect_buf.push(make_pair(cur_kf, flag_detect_loop));
+            m_detect_buf.unlock();
+            continue;
+        }
+        std::chrono::milliseconds dura(5);
+        std::this_thread::sleep_for(dura);
+    }
+}
+
+void PoseGraph::detectionThread()
+{
+    while(!thread_stop)
     {
-        if (cur_kf->has_loop)
+        KeyFrame* cur_kf = NULL;
+        bool flag_detect_loop = false;
+        m_detect_buf.lock();
+        if (!detect_buf.empty())
+        {
+            cur_kf = detect_buf.front().first;
+            flag_detect_loop = detect_buf.front().second;
+            detect_buf.pop();
+        }
+        m_detect_buf.unlock();
+        if (cur_kf != NULL)
         {
-            //printf("has loop \n");
-            KeyFrame* connected_KF = getKeyFrame(cur_kf->loop_index);
-            Vector3d connected_P,P0;
-            Matrix3d connected_R,R0;
-            connected_KF->getPose(connected_P, connected_R);
-            //cur_kf->getVioPose(P0, R0);
-            cur_kf->getPose(P0, R0);
-            if(cur_kf->sequence > 0)
+            int loop_index = -1;
+            bool redundant = false;
+            if (flag_detect_loop)
+                loop_index = detectLoop(cur_kf, cur_kf->index, &redundant);
+            else
+                addKeyFrameIntoVoc(cur_kf);
+            if (redundant)
             {
-                //printf("add loop into visual \n");
-                posegraph_visualization->add_loopedge(P0, connected_P + Vector3d(VISUALIZATION_SHIFT_X, VISUALIZATION_SHIFT_Y, 0));
+                cullKeyFrame(cur_kf);
+                loop_pending_cnt--;
             }
-            
+            else if (loop_index != -1)
+            {
+                m_verify_buf.lock();
+                verify_buf.push(make_pair(cur_kf, loop_index));
+                m_verify_buf.unlock();
+            }
+            else
+            {
+                cur_kf->releaseWindowFeatures();
+                unpinKeyFrame(cur_kf);
+                loop_pending_cnt--;
+            }
+            continue;
         }
+        std::chrono::milliseconds dura(5);
+        std::this_thread::sleep_for(dura);
     }
-    //posegraph_visualization->add_pose(P + Vector3d(VISUALIZATION_SHIFT_X, VISUALIZATION_SHIFT_Y, 0), Q);
+}
 
-	keyframelist.push_back(cur_kf);
+void PoseGraph::verificationThread()
+{
+    while(!thread_stop)
+    {
+        KeyFrame* cur_kf = NULL;
+        int loop_index = -1;
+        m_verify_buf.lock();
+        if (!verify_buf.empty())
+        {
+            cur_kf = verify_buf.front().first;
+            loop_index = verify_buf.front().second;
+            verify_buf.pop();
+        }
+        m_verify_buf.unlock();
+        if (cur_kf != NULL)
+        {
+            //printf(" %d detect loop with %d \n", cur_kf->index, loop_index);
+            m_keyframelist.lock();
+            KeyFrame* old_kf = getKeyFrame(loop_index);
+            m_keyframelist.unlock();
+            Eigen::Matrix<double, 8, 1 > loop_info;
+            if (pinKeyFrame(old_kf) && cur_kf->findConnection(old_kf, loop_info))
+            {
+                printf("loop verify %d-%d: match %f prefilter %f ransac %f refine %f ms\n", cur_kf->index, old_kf->index,
+                       cur_kf->verify_time.match, cur_kf->verify_time.prefilter, cur_kf->verify_time.ransac, cur_kf->verify_time.refine);
+                addLoopEdge(cur_kf, old_kf, loop_info);
+            }
+            unpinKeyFrame(old_kf);
+            cur_kf->releaseWindowFeatures();
+            unpinKeyFrame(cur_kf);
+            loop_pending_cnt--;
+            continue;
+        }
+        std::chrono::milliseconds dura(5);
+        std::this_thread::sleep_for(dura);
+    }
+}
+
+void PoseGraph::addLoopEdge(KeyFrame* cur_kf, KeyFrame* old_kf, const Eigen::Matrix<double, 8, 1 > &loop_info)
+{
+    m_keyframelist.lock();
+    // cur_kf is already read by the optimization and updatePath
+    cur_kf->has_loop = true;
+    cur_kf->loop_index = old_kf->index;
+    cur_kf->loop_info = loop_info;
+    Vector3d w_P_old, w_P_cur, vio_P_cur;
+    Matrix3d w_R_old, w_R_cur, vio_R_cur;
+    old_kf->getVioPose(w_P_old, w_R_old);
+    cur_kf->getVioPose(vio_P_cur, vio_R_cur);
+
+    Vector3d relative_t;
+    Quaterniond relative_q;
+    relative_t = cur_kf->getLoopRelativeT();
+    relative_q = (cur_kf->getLoopRelativeQ()).toRotationMatrix();
+    w_P_cur = w_R_old * relative_t + w_P_old;
+    w_R_cur = w_R_old * relative_q;
+    double shift_yaw;
+    Matrix3d shift_r;
+    Vector3d shift_t; 
+    if(use_imu)
+    {
+        shift_yaw = Utility::R2ypr(w_R_cur).x() - Utility::R2ypr(vio_R_cur).x();
+        shift_r = Utility::ypr2R(Vector3d(shift_yaw, 0, 0));
+    }
+    else
+        shift_r = w_R_cur * vio_R_cur.transpose();
+    shift_t = w_P_cur - w_R_cur * vio_R_cur.transpose() * vio_P_cur; 
+    // shift vio pose of whole sequence to the world frame,
+    // cur_kf is already in keyframelist so the loop below shifts it as well
+    if (old_kf->sequence != cur_kf->sequence && sequence_loop[cur_kf->sequence] == 0)
+    {  
+        // the sequence may have ended while the loop was verified, keep the frame of the live one
+        if (cur_kf->sequence == sequence_cnt)
+        {
+            w_r_vio = shift_r;
+            w_t_vio = shift_t;
+        }
+        list<KeyFrame*>::iterator it = keyframelist.begin();
+        for (; it != keyframelist.end(); it++)   
+        {
+            if((*it)->sequence == cur_kf->sequence)
+            {
+                Vector3d vio_P_cur;
+                Matrix3d vio_R_cur;
+                (*it)->getVioPose(vio_P_cur, vio_R_cur);
+                vio_P_cur = shift_r * vio_P_cur + shift_t;
+                vio_R_cur = shift_r *  vio_R_cur;
+                (*it)->updateVioPose(vio_P_cur, vio_R_cur);
+            }
+        }
+        sequence_loop[cur_kf->sequence] = 1;
+    }
+
+    //draw loop edge, through redrawEdges so the markers stay in keyframe order
+    redrawEdges(cur_kf->index);
+    last_loop_index = cur_kf->index;
     publish();
-	m_keyframelist.unlock();
+    m_keyframelist.unlock();
+
+    m_optimize_buf.lock();
+    if (earliest_loop_index > old_kf->index || earliest_loop_index == -1)
+        earliest_loop_index = old_kf->index;
+    optimize_buf.push(cur_kf->index);
+    m_optimize_buf.unlock();
+}
+
+void PoseGraph::waitLoopClosure()
+{
+    while (loop_pending_cnt > 0)
+    {
+        std::chrono::milliseconds dura(5);
+        std::this_thread::sleep_for(dura);
+    }
+}
+
+// take a keyframe out of the eviction list while its features are matched, paging them in if spilled
+bool PoseGraph::pinKeyFrame(KeyFrame* keyframe)
+{
+    m_spill.lock();
+    if (keyframe->evictable)
+    {
+        resident_list.erase(keyframe->resident_it);
+        resident_memory -= keyframe->featureMemory();
+        keyframe->evictable = false;
+    }
+    bool resident = true;
+    if (keyframe->features_spilled)
+    {
+        vector<PoseGraphMapKeyPoint> map_keypoints;
+        vector<PackedBRIEF> descriptors;
+        resident = readSpilledFeatures(keyframe, map_keypoints, descriptors);
+        if (resident)
+        {
+            keyframe->keypoints.resize(map_keypoints.size());
+            keyframe->keypoints_norm.resize(map_keypoints.size());
+            for (int i = 0; i < (int)map_keypoints.size(); i++)
+            {
+                keyframe->keypoints[i].pt = cv::Point2f(map_keypoints[i].x, map_keypoints[i].y);
+                keyframe->keypoints_norm[i].pt = cv::Point2f(map_keypoints[i].x_norm, map_keypoints[i].y_norm);
+            }
+            keyframe->packed_brief_descriptors.swap(descriptors);
+            keyframe->buildKeypointGrid();
+            keyframe->features_spilled = false;
+        }
+    }
+    m_spill.unlock();
+    return resident;
+}
+
+// make a keyframe evictable again and spill least recently used keyframes while over the memory budget
+void PoseGraph::unpinKeyFrame(KeyFrame* keyframe)
+{
+    m_spill.lock();
+    if (!keyframe->evictable && !keyframe->features_spilled)
+    {
+        keyframe->resident_it = resident_list.insert(resident_list.end(), keyframe);
+        keyframe->evictable = true;
+        resident_memory += keyframe->featureMemory();
+    }
+    while (memory_budget > 0 && resident_memory > memory_budget && !resident_list.empty())
+    {
+        KeyFrame* kf = resident_list.front();
+        // features never change, a keyframe paged in before is already on disk
+        if (kf->spill_offset < 0 && kf->map_features == NULL && !spillKeyFrame(kf))
+        {
+            printf("keyframe spill failed, keep all keyframes in memory \n");
+            memory_budget = 0;
+            break;
+        }
+        resident_list.pop_front();
+        resident_memory -= kf->featureMemory();
+        kf->releaseFeatures();
+        kf->evictable = false;
+        kf->features_spilled = true;
+    }
+    m_spill.unlock();
+}
+
+bool PoseGraph::spillKeyFrame(KeyFrame* keyframe)
+{
+    if (spill_file == NULL)
+    {
+        string file_path = POSE_GRAPH_SAVE_PATH + "keyframe_spill.bin";
+        spill_file = fopen(file_path.c_str(), "wb+");
+        if (spill_file == NULL)
+        {
+            printf("keyframe spill error: cannot open %s \n", file_path.c_str());
+            return false;
+        }
+    }
+    int num = keyframe->keypoints.size();
+    vector<PoseGraphMapKeyPoint> map_keypoints(num);
+    for (int i = 0; i < num; i++)
+    {
+        map_keypoints[i].x = keyframe->keypoints[i].pt.x;
+        map_keypoints[i].y = keyframe->keypoints[i].pt.y;
+        map_keypoints[i].x_norm = keyframe->keypoints_norm[i].pt.x;
+        map_keypoints[i].y_norm = keyframe->keypoints_norm[i].pt.y;
+    }
+    fseek(spill_file, 0, SEEK_END);
+    long offset = ftell(spill_file);
+    if (fwrite(map_keypoints.data(), sizeof(PoseGraphMapKeyPoint), num, spill_file) != (size_t)num ||
+        fwrite(keyframe->packed_brief_descriptors.data(), sizeof(PackedBRIEF), num, spill_file) != (size_t)num)
+    {
+        printf("keyframe spill error: cannot write keyframe %d \n", keyframe->index);
+        return false;
+    }
+    keyframe->spill_offset = offset;
+    keyframe->spill_num = num;
+    return true;
+}
+
+// caller holds m_spill
+bool PoseGraph::readSpilledFeatures(const KeyFrame* keyframe, vector<PoseGraphMapKeyPoint> &map_keypoints, vector<PackedBRIEF> &descriptors)
+{
+    size_t num = keyframe->spill_num;
+    map_keypoints.resize(num);
+    descriptors.resize(num);
+    if (keyframe->map_features != NULL)
+    {
+        memcpy(map_keypoints.data(), keyframe->map_features, num * sizeof(PoseGraphMapKeyPoint));
+        memcpy(descriptors.data(), keyframe->map_features + num * sizeof(PoseGraphMapKeyPoint), num * sizeof(PackedBRIEF));
+        return true;
+    }
+    if (fseek(spill_file, keyframe->spill_offset, SEEK_SET) != 0 ||
+        fread(map_keypoints.data(), sizeof(PoseGraphMapKeyPoint), num, spill_file) != num ||
+        fread(descriptors.data(), sizeof(PackedBRIEF), num, spill_file) != num)
+    {
+        printf("keyframe spill error: cannot read keyframe %d \n", keyframe->index);
+        return false;
+    }
+    return true;
 }
 
 
@@ -256,8 +513,12 @@ void PoseGraph::loadKeyFrame(KeyFrame* cur_kf, bool flag_detect_loop)
     {
         printf(" %d detect loop with %d \n", cur_kf->index, loop_index);
         KeyFrame* old_kf = getKeyFrame(loop_index);
-        if (cur_kf->findConnection(old_kf))
+        Eigen::Matrix<double, 8, 1 > loop_info;
+        if (cur_kf->findConnection(old_kf, loop_info))
         {
+            cur_kf->has_loop = true;
+            cur_kf->loop_index = old_kf->index;
+            cur_kf->loop_info = loop_info;
             if (earliest_loop_index > loop_index || earliest_loop_index == -1)
                 earliest_loop_index = loop_index;
             m_optimize_buf.lock();
@@ -286,6 +547,7 @@ void PoseGraph::loadKeyFrame(KeyFrame* cur_kf, bool flag_detect_loop)
     //draw local connection
     if (SHOW_S_EDGE)
     {
+        edge_markers.push_back(make_pair(cur_kf->index, posegraph_visualization->markerNum()));
         list<KeyFrame*>::reverse_iterator rit = keyframelist.rbegin();
         for (int i = 0; i < 1; i++)
         {
@@ -313,26 +575,23 @@ void PoseGraph::loadKeyFrame(KeyFrame* cur_kf, bool flag_detect_loop)
     */
 
     keyframelist.push_back(cur_kf);
+    keyframe_map[cur_kf->index] = cur_kf;
     //publish();
     m_keyframelist.unlock();
+    unpinKeyFrame(cur_kf);
 }
 
 KeyFrame* PoseGraph::getKeyFrame(int index)
 {
 //    unique_lock<mutex> lock(m_keyframelist);
-    list<KeyFrame*>::iterator it = keyframelist.begin();
-    for (; it != keyframelist.end(); it++)   
-    {
-        if((*it)->index == index)
-            break;
-    }
-    if (it != keyframelist.end())
-        return *it;
+    map<int, KeyFrame*>::iterator it = keyframe_map.find(index);
+    if (it != keyframe_map.end())
+        return it->second;
     else
         return NULL;
 }
 
-int PoseGraph::detectLoop(KeyFrame* keyframe, int frame_index)
+int PoseGraph::detectLoop(KeyFrame* keyframe, int frame_index, bool* redundant)
 {
     // put image into image_pool; for visualization
     cv::Mat compressed_image;
@@ -346,13 +605,23 @@ int PoseGraph::detectLoop(KeyFrame* keyframe, int frame_index)
     TicToc tmp_t;
     //first query; then add this frame into database!
     QueryResults ret;
+    // transform once from the packed descriptors, shared by query and add
+    BowVector bow;
+    db.getVocabulary()->transform(keyframe->packed_brief_descriptors, bow);
     TicToc t_query;
-    db.query(keyframe->brief_descriptors, ret, 4, frame_index - 50);
+    db.query(bow, ret, 4, frame_index - 50);
     //printf("query time: %f", t_query.toc());
     //cout << "Searching for Image " << frame_index << ". " << ret << endl;
 
     TicToc t_add;
-    db.add(keyframe->brief_descriptors);
+    if (redundant != NULL && isRedundant(keyframe, ret))
+    {
+        // the culled keyframe keeps an empty entry, so entry ids still follow keyframe indices
+        db.add(BowVector());
+        *redundant = true;
+        return -1;
+    }
+    db.add(bow);
     //printf("add feature time: %f", t_add.toc());
     // ret[0] is the nearest neighbour's score. threshold change with neighour score
     bool find_loop = false;
@@ -416,6 +685,80 @@ int PoseGraph::detectLoop(KeyFrame* keyframe, int frame_index)
 
 }
 
+// a new keyframe is redundant if the area is already mapped: a close and similar older keyframe
+// exists and a loop was verified recently, so drift is already anchored here
+bool PoseGraph::isRedundant(KeyFrame* keyframe, const QueryResults &ret)
+{
+    if (culled_cnt >= CULL_MAX_GAP)
+    {
+        culled_cnt = 0;
+        return false;
+    }
+    bool redundant = false;
+    m_keyframelist.lock();
+    if (last_loop_index >= 0 && keyframe->index - last_loop_index <= CULL_LOOP_WINDOW)
+    {
+        Vector3d P;
+        Matrix3d R;
+        keyframe->getPose(P, R);
+        double yaw = Utility::R2ypr(R).x();
+        // poses are only comparable within a sequence or between sequences aligned to the world frame
+        bool cur_aligned = keyframe->sequence == 0 || sequence_loop[keyframe->sequence];
+        for (unsigned int i = 0; i < ret.size() && ret[i].Score >= CULL_MIN_SCORE && !redundant; i++)
+        {
+            KeyFrame* old_kf = getKeyFrame(ret[i].Id);
+            if (old_kf == NULL)
+                continue;
+            bool old_aligned = old_kf->sequence == 0 || sequence_loop[old_kf->sequence];
+            if (old_kf->sequence != keyframe->sequence && !(cur_aligned && old_aligned))
+                continue;
+            Vector3d old_P;
+            Matrix3d old_R;
+            old_kf->getPose(old_P, old_R);
+            double yaw_diff = fabs(NormalizeAngle(yaw - Utility::R2ypr(old_R).x()));
+            redundant = (P - old_P).norm() < CULL_DISTANCE && yaw_diff < CULL_YAW;
+        }
+    }
+    m_keyframelist.unlock();
+    culled_cnt = redundant ? culled_cnt + 1 : 0;
+    return redundant;
+}
+
+// Drop a redundant keyframe on arrival, nothing absorbs its observations: the older keyframe it matched
+// already covers the place in the database, and its keypoints are in another image, so adding them there
+// would break the PnP of later loops against it. The odometry edge between its neighbours spans it in the
+// next optimization; it is built from their VIO poses, so it equals the two edges through the dropped one.
+// Keyframes are detected in order and loops only target keyframes verified before, so no loop edge or
+// optimization window refers to it yet.
+void PoseGraph::cullKeyFrame(KeyFrame* keyframe)
+{
+    m_keyframelist.lock();
+    // path poses of a sequence follow its keyframes in order
+    int newer_cnt = 0;
+    list<KeyFrame*>::iterator it = keyframelist.end();
+    while (it != keyframelist.begin())
+    {
+        --it;
+        if (*it == keyframe)
+        {
+            nav_msgs::Path &seq_path = keyframe->sequence == 0 ? base_path : path[keyframe->sequence];
+            seq_path.poses.erase(seq_path.poses.end() - 1 - newer_cnt);
+            keyframelist.erase(it);
+            keyframe_map.erase(keyframe->index);
+            break;
+        }
+        if ((*it)->sequence == keyframe->sequence)
+            newer_cnt++;
+    }
+    // drop its row of the result file and its edges, the newer keyframes are written and drawn again
+    rewriteResultPath(keyframe->index);
+    redrawEdges(keyframe->index);
+    m_keyframelist.unlock();
+    if (DEBUG_IMAGE)
+        image_pool.erase(keyframe->index);
+    delete keyframe;
+}
+
 void PoseGraph::addKeyFrameIntoVoc(KeyFrame* keyframe)
 {
     // put image into image_pool; for visualization
@@ -428,20 +771,28 @@ void PoseGraph::addKeyFrameIntoVoc(KeyFrame* keyframe)
         image_pool[keyframe->index] = compressed_image;
     }
 
-    db.add(keyframe->brief_descriptors);
+    // culled keyframes leave gaps in the indices of a saved map
+    while ((int)db.size() < keyframe->index)
+        db.add(BowVector());
+    if (keyframe->index >= (int)db.size())
+    {
+        BowVector bow;
+        db.getVocabulary()->transform(keyframe->packed_brief_descriptors, bow);
+        db.add(bow);
+    }
 }
 
 void PoseGraph::optimize4DoF()
 {
-    while(true)
+    while(!thread_stop)
     {
         int cur_index = -1;
-        int first_looped_index = -1;
+        vector<int> loop_cur_indices;
         m_optimize_buf.lock();
         while(!optimize_buf.empty())
         {
             cur_index = optimize_buf.front();
-            first_looped_index = earliest_loop_index;
+            loop_cur_indices.push_back(cur_index);
             optimize_buf.pop();
         }
         m_optimize_buf.unlock();
@@ -451,14 +802,69 @@ void PoseGraph::optimize4DoF()
             TicToc tmp_t;
             m_keyframelist.lock();
             KeyFrame* cur_kf = getKeyFrame(cur_index);
+            if (cur_kf == NULL)
+            {
+                m_keyframelist.unlock();
+                continue;
+            }
 
-            int max_length = cur_index + 1;
+            // only the subgraph spanned by the new loops is re-optimized, keyframes before it keep their poses;
+            // loop fields are only set by addLoopEdge under m_keyframelist, after the sequence shift
+            int window_start = cur_index;
+            for (int k = 0; k < (int)loop_cur_indices.size(); k++)
+            {
+                KeyFrame* loop_kf = getKeyFrame(loop_cur_indices[k]);
+                if (loop_kf != NULL && loop_kf->has_loop)
+                    window_start = min(window_start, loop_kf->loop_index);
+            }
+            window_start = max(window_start, cur_index - OPT_WINDOW_SIZE);
+
+            vector<KeyFrame*> opt_kfs;
+            list<KeyFrame*>::reverse_iterator rit;
+            for (rit = keyframelist.rbegin(); rit != keyframelist.rend(); rit++)
+            {
+                if ((*rit)->index > cur_index)
+                    continue;
+                if ((*rit)->index < window_start)
+                    break;
+                opt_kfs.push_back(*rit);
+            }
+            reverse(opt_kfs.begin(), opt_kfs.end());
+            int window_size = opt_kfs.size();
+            for (int i = 0; i < window_size; i++)
+                opt_kfs[i]->local_index = i;
+            // loop targets older than the window enter the problem as fixed poses
+            for (int i = 0; i < window_size; i++)
+            {
+                if (!opt_kfs[i]->has_loop || opt_kfs[i]->loop_index >= opt_kfs[0]->index)
+                    continue;
+                KeyFrame* connected_kf = getKeyFrame(opt_kfs[i]->loop_index);
+                if (connected_kf == NULL)
+                    continue;
+                int l = connected_kf->local_index;
+                if (l < 0 || l >= (int)opt_kfs.size() || opt_kfs[l] != connected_kf)
+                {
+                    connected_kf->local_index = opt_kfs.size();
+                    opt_kfs.push_back(connected_kf);
+                }
+            }
+            int max_length = opt_kfs.size();
 
             // w^t_i   w^q_i
-            double t_array[max_length][3];
-            Quaterniond q_array[max_length];
-            double euler_array[max_length][3];
-            double sequence_array[max_length];
+            vector<array<double, 3> > t_array(max_length);
+            vector<Quaterniond, Eigen::aligned_allocator<Quaterniond> > q_array(max_length);
+            vector<array<double, 3> > euler_array(max_length);
+            vector<Vector3d, Eigen::aligned_allocator<Vector3d> > vio_t_array(max_length);
+            vector<Matrix3d, Eigen::aligned_allocator<Matrix3d> > vio_r_array(max_length);
+
+            // the window is initialized with the drift of its first keyframe, which is held fixed
+            Vector3d start_t, start_vio_t;
+            Matrix3d start_r, start_vio_r;
+            opt_kfs[0]->getPose(start_t, start_r);
+            opt_kfs[0]->getVioPose(start_vio_t, start_vio_r);
+            double start_yaw_drift = Utility::R2ypr(start_r).x() - Utility::R2ypr(start_vio_r).x();
+            Matrix3d start_r_drift = Utility::ypr2R(Vector3d(start_yaw_drift, 0, 0));
+            Vector3d start_t_drift = start_t - start_r_drift * start_vio_t;
 
             ceres::Problem problem;
             ceres::Solver::Options options;
@@ -473,80 +879,76 @@ void PoseGraph::optimize4DoF()
             ceres::LocalParameterization* angle_local_parameterization =
                 AngleLocalParameterization::Create();
 
-            list<KeyFrame*>::iterator it;
-
-            int i = 0;
-            for (it = keyframelist.begin(); it != keyframelist.end(); it++)
+            for (int i = 0; i < max_length; i++)
             {
-                if ((*it)->index < first_looped_index)
-                    continue;
-                (*it)->local_index = i;
-                Quaterniond tmp_q;
+                KeyFrame* kf = opt_kfs[i];
+                bool fixed = (i == 0 || i >= window_size || kf->sequence == 0);
                 Matrix3d tmp_r;
                 Vector3d tmp_t;
-                (*it)->getVioPose(tmp_t, tmp_r);
-                tmp_q = tmp_r;
+                kf->getVioPose(vio_t_array[i], vio_r_array[i]);
+                if (fixed)
+                    kf->getPose(tmp_t, tmp_r);
+                else
+                {
+                    tmp_t = start_r_drift * vio_t_array[i] + start_t_drift;
+                    tmp_r = start_r_drift * vio_r_array[i];
+                }
                 t_array[i][0] = tmp_t(0);
                 t_array[i][1] = tmp_t(1);
                 t_array[i][2] = tmp_t(2);
-                q_array[i] = tmp_q;
+                q_array[i] = tmp_r;
 
-                Vector3d euler_angle = Utility::R2ypr(tmp_q.toRotationMatrix());
+                Vector3d euler_angle = Utility::R2ypr(tmp_r);
                 euler_array[i][0] = euler_angle.x();
                 euler_array[i][1] = euler_angle.y();
                 euler_array[i][2] = euler_angle.z();
 
-                sequence_array[i] = (*it)->sequence;
-
-                problem.AddParameterBlock(euler_array[i], 1, angle_local_parameterization);
-                problem.AddParameterBlock(t_array[i], 3);
-
-                if ((*it)->index == first_looped_index || (*it)->sequence == 0)
+                problem.AddParameterBlock(euler_array[i].data(), 1, angle_local_parameterization);
+                problem.AddParameterBlock(t_array[i].data(), 3);
+                if (fixed)
                 {   
-                    problem.SetParameterBlockConstant(euler_array[i]);
-                    problem.SetParameterBlockConstant(t_array[i]);
+                    problem.SetParameterBlockConstant(euler_array[i].data());
+                    problem.SetParameterBlockConstant(t_array[i].data());
                 }
+            }
 
-                //add edge
+            for (int i = 0; i < window_size; i++)
+            {
+                //add edge, relative motion is taken from the vio poses
                 for (int j = 1; j < 5; j++)
                 {
-                  if (i - j >= 0 && sequence_array[i] == sequence_array[i-j])
+                  if (i - j >= 0 && opt_kfs[i]->sequence == opt_kfs[i-j]->sequence)
                   {
-                    Vector3d euler_conncected = Utility::R2ypr(q_array[i-j].toRotationMatrix());
-                    Vector3d relative_t(t_array[i][0] - t_array[i-j][0], t_array[i][1] - t_array[i-j][1], t_array[i][2] - t_array[i-j][2]);
-                    relative_t = q_array[i-j].inverse() * relative_t;
-                    double relative_yaw = euler_array[i][0] - euler_array[i-j][0];
+                    Vector3d euler_conncected = Utility::R2ypr(vio_r_array[i-j]);
+                    Vector3d relative_t = vio_r_array[i-j].transpose() * (vio_t_array[i] - vio_t_array[i-j]);
+                    double relative_yaw = Utility::R2ypr(vio_r_array[i]).x() - euler_conncected.x();
                     ceres::CostFunction* cost_function = FourDOFError::Create( relative_t.x(), relative_t.y(), relative_t.z(),
                                                    relative_yaw, euler_conncected.y(), euler_conncected.z());
-                    problem.AddResidualBlock(cost_function, NULL, euler_array[i-j], 
-                                            t_array[i-j], 
-                                            euler_array[i], 
-                                            t_array[i]);
+                    problem.AddResidualBlock(cost_function, NULL, euler_array[i-j].data(), 
+                                            t_array[i-j].data(), 
+                                            euler_array[i].data(), 
+                                            t_array[i].data());
                   }
                 }
 
                 //add loop edge
                 
-                if((*it)->has_loop)
+                KeyFrame* connected_kf = opt_kfs[i]->has_loop ? getKeyFrame(opt_kfs[i]->loop_index) : NULL;
+                if(connected_kf != NULL)
                 {
-                    assert((*it)->loop_index >= first_looped_index);
-                    int connected_index = getKeyFrame((*it)->loop_index)->local_index;
+                    int connected_index = connected_kf->local_index;
                     Vector3d euler_conncected = Utility::R2ypr(q_array[connected_index].toRotationMatrix());
                     Vector3d relative_t;
-                    relative_t = (*it)->getLoopRelativeT();
-                    double relative_yaw = (*it)->getLoopRelativeYaw();
+                    relative_t = opt_kfs[i]->getLoopRelativeT();
+                    double relative_yaw = opt_kfs[i]->getLoopRelativeYaw();
                     ceres::CostFunction* cost_function = FourDOFWeightError::Create( relative_t.x(), relative_t.y(), relative_t.z(),
                                                                                relative_yaw, euler_conncected.y(), euler_conncected.z());
-                    problem.AddResidualBlock(cost_function, loss_function, euler_array[connected_index], 
-                                                                  t_array[connected_index], 
-                                                                  euler_array[i], 
-                                                                  t_array[i]);
+                    problem.AddResidualBlock(cost_function, loss_function, euler_array[connected_index].data(), 
+                                                                  t_array[connected_index].data(), 
+                                                                  euler_array[i].data(), 
+                                                                  t_array[i].data());
                     
                 }
-                
-                if ((*it)->index == cur_index)
-                    break;
-                i++;
             }
             m_keyframelist.unlock();
 
@@ -554,27 +956,16 @@ void PoseGraph::optimize4DoF()
             //std::cout << summary.BriefReport() << "\n";
             
             //printf("pose optimization time: %f \n", tmp_t.toc());
-            /*
-            for (int j = 0 ; j < i; j++)
-            {
-                printf("optimize i: %d p: %f, %f, %f\n", j, t_array[j][0], t_array[j][1], t_array[j][2] );
-            }
-            */
             m_keyframelist.lock();
-            i = 0;
-            for (it = keyframelist.begin(); it != keyframelist.end(); it++)
+            for (int i = 1; i < window_size; i++)
             {
-                if ((*it)->index < first_looped_index)
+                if (opt_kfs[i]->sequence == 0)
                     continue;
                 Quaterniond tmp_q;
                 tmp_q = Utility::ypr2R(Vector3d(euler_array[i][0], euler_array[i][1], euler_array[i][2]));
                 Vector3d tmp_t = Vector3d(t_array[i][0], t_array[i][1], t_array[i][2]);
                 Matrix3d tmp_r = tmp_q.toRotationMatrix();
-                (*it)-> updatePose(tmp_t, tmp_r);
-
-                if ((*it)->index == cur_index)
-                    break;
-                i++;
+                opt_kfs[i]-> updatePose(tmp_t, tmp_r);
             }
 
             Vector3d cur_t, vio_t;
@@ -590,18 +981,17 @@ void PoseGraph::optimize4DoF()
             //cout << "r_drift " << Utility::R2ypr(r_drift).transpose() << endl;
             //cout << "yaw drift " << yaw_drift << endl;
 
-            it++;
-            for (; it != keyframelist.end(); it++)
+            for (rit = keyframelist.rbegin(); rit != keyframelist.rend() && (*rit)->index > cur_index; rit++)
             {
                 Vector3d P;
                 Matrix3d R;
-                (*it)->getVioPose(P, R);
+                (*rit)->getVioPose(P, R);
                 P = r_drift * P + t_drift;
                 R = r_drift * R;
-                (*it)->updatePose(P, R);
+                (*rit)->updatePose(P, R);
             }
             m_keyframelist.unlock();
-            updatePath();
+            updatePath(window_start);
         }
 
         std::chrono::milliseconds dura(2000);
@@ -613,7 +1003,7 @@ void PoseGraph::optimize4DoF()
 
 void PoseGraph::optimize6DoF()
 {
-    while(true)
+    while(!thread_stop)
     {
         int cur_index = -1;
         int first_looped_index = -1;
@@ -631,13 +1021,18 @@ void PoseGraph::optimize6DoF()
             TicToc tmp_t;
             m_keyframelist.lock();
             KeyFrame* cur_kf = getKeyFrame(cur_index);
+            if (cur_kf == NULL)
+            {
+                m_keyframelist.unlock();
+                continue;
+            }
 
             int max_length = cur_index + 1;
 
             // w^t_i   w^q_i
-            double t_array[max_length][3];
-            double q_array[max_length][4];
-            double sequence_array[max_length];
+            vector<array<double, 3> > t_array(max_length);
+            vector<array<double, 4> > q_array(max_length);
+            vector<double> sequence_array(max_length);
 
             ceres::Problem problem;
             ceres::Solver::Options options;
@@ -674,13 +1069,13 @@ void PoseGraph::optimize6DoF()
 
                 sequence_array[i] = (*it)->sequence;
 
-                problem.AddParameterBlock(q_array[i], 4, local_parameterization);
-                problem.AddParameterBlock(t_array[i], 3);
+                problem.AddParameterBlock(q_array[i].data(), 4, local_parameterization);
+                problem.AddParameterBlock(t_array[i].data(), 3);
 
                 if ((*it)->index == first_looped_index || (*it)->sequence == 0)
                 {   
-                    problem.SetParameterBlockConstant(q_array[i]);
-                    problem.SetParameterBlockConstant(t_array[i]);
+                    problem.SetParameterBlockConstant(q_array[i].data());
+                    problem.SetParameterBlockConstant(t_array[i].data());
                 }
 
                 //add edge
@@ -696,16 +1091,17 @@ void PoseGraph::optimize6DoF()
                         ceres::CostFunction* vo_function = RelativeRTError::Create(relative_t.x(), relative_t.y(), relative_t.z(),
                                                                                 relative_q.w(), relative_q.x(), relative_q.y(), relative_q.z(),
                                                                                 0.1, 0.01);
-                        problem.AddResidualBlock(vo_function, NULL, q_array[i-j], t_array[i-j], q_array[i], t_array[i]);
+                        problem.AddResidualBlock(vo_function, NULL, q_array[i-j].data(), t_array[i-j].data(), q_array[i].data(), t_array[i].data());
                     }
                 }
 
                 //add loop edge
                 
-                if((*it)->has_loop)
+                KeyFrame* connected_kf = (*it)->has_loop ? getKeyFrame((*it)->loop_index) : NULL;
+                if(connected_kf != NULL)
                 {
                     assert((*it)->loop_index >= first_looped_index);
-                    int connected_index = getKeyFrame((*it)->loop_index)->local_index;
+                    int connected_index = connected_kf->local_index;
                     Vector3d relative_t;
                     relative_t = (*it)->getLoopRelativeT();
                     Quaterniond relative_q;
@@ -713,7 +1109,7 @@ void PoseGraph::optimize6DoF()
                     ceres::CostFunction* loop_function = RelativeRTError::Create(relative_t.x(), relative_t.y(), relative_t.z(),
                                                                                 relative_q.w(), relative_q.x(), relative_q.y(), relative_q.z(),
                                                                                 0.1, 0.01);
-                    problem.AddResidualBlock(loop_function, loss_function, q_array[connected_index], t_array[connected_index], q_array[i], t_array[i]);                    
+                    problem.AddResidualBlock(loop_function, loss_function, q_array[connected_index].data(), t_array[connected_index].data(), q_array[i].data(), t_array[i].data());                    
                 }
                 
                 if ((*it)->index == cur_index)
@@ -770,7 +1166,7 @@ void PoseGraph::optimize6DoF()
                 (*it)->updatePose(P, R);
             }
             m_keyframelist.unlock();
-            updatePath();
+            updatePath(first_looped_index);
         }
 
         std::chrono::milliseconds dura(2000);
@@ -779,35 +1175,25 @@ void PoseGraph::optimize6DoF()
     return;
 }
 
-void PoseGraph::updatePath()
+void PoseGraph::updatePath(int start_index)
 {
     m_keyframelist.lock();
-    list<KeyFrame*>::iterator it;
+    // each path holds the poses of its sequence in keyframe order, so only the tail
+    // from start_index on is rewritten in place
+    vector<int> path_pos(sequence_cnt + 1);
+    path_pos[0] = base_path.poses.size();
     for (int i = 1; i <= sequence_cnt; i++)
-    {
-        path[i].poses.clear();
-    }
-    base_path.poses.clear();
-    posegraph_visualization->reset();
-
-    if (SAVE_LOOP_PATH)
-    {
-        ofstream loop_path_file_tmp(VINS_RESULT_PATH, ios::out);
-        loop_path_file_tmp.close();
-    }
-
-    for (it = keyframelist.begin(); it != keyframelist.end(); it++)
+        path_pos[i] = path[i].poses.size();
+    list<KeyFrame*>::reverse_iterator rit;
+    for (rit = keyframelist.rbegin(); rit != keyframelist.rend() && (*rit)->index >= start_index; rit++)
     {
         Vector3d P;
         Matrix3d R;
-        (*it)->getPose(P, R);
+        (*rit)->getPose(P, R);
         Quaterniond Q;
         Q = R;
-//        printf("path p: %f, %f, %f\n",  P.x(),  P.z(),  P.y() );
-
-        geometry_msgs::PoseStamped pose_stamped;
-        pose_stamped.header.stamp = ros::Time((*it)->time_stamp);
-        pose_stamped.header.frame_id = "world";
+        nav_msgs::Path &seq_path = (*rit)->sequence == 0 ? base_path : path[(*rit)->sequence];
+        geometry_msgs::PoseStamped &pose_stamped = seq_path.poses[--path_pos[(*rit)->sequence]];
         pose_stamped.pose.position.x = P.x() + VISUALIZATION_SHIFT_X;
         pose_stamped.pose.position.y = P.y() + VISUALIZATION_SHIFT_Y;
         pose_stamped.pose.position.z = P.z();
@@ -815,61 +1201,103 @@ void PoseGraph::updatePath()
         pose_stamped.pose.orientation.y = Q.y();
         pose_stamped.pose.orientation.z = Q.z();
         pose_stamped.pose.orientation.w = Q.w();
-        if((*it)->sequence == 0)
-        {
-            base_path.poses.push_back(pose_stamped);
-            base_path.header = pose_stamped.header;
-        }
-        else
+    }
+    rewriteResultPath(start_index);
+    redrawEdges(start_index);
+    publish();
+    m_keyframelist.unlock();
+}
+
+// first keyframe with an index from start_index on, caller holds m_keyframelist
+list<KeyFrame*>::iterator PoseGraph::keyFrameTail(int start_index)
+{
+    list<KeyFrame*>::reverse_iterator rit = keyframelist.rbegin();
+    while (rit != keyframelist.rend() && (*rit)->index >= start_index)
+        rit++;
+    return rit.base();
+}
+
+// records are in keyframe order: truncate at the first one from start_index on and append from there,
+// loaded keyframes are not in the file yet and need a full rewrite; caller holds m_keyframelist
+void PoseGraph::rewriteResultPath(int start_index)
+{
+    if (!SAVE_LOOP_PATH || keyframelist.empty())
+        return;
+    list<KeyFrame*>::iterator it;
+    ofstream loop_path_file;
+    if (result_records.empty() || result_records.front().first > keyframelist.front()->index)
+    {
+        loop_path_file.open(VINS_RESULT_PATH, ios::out);
+        result_records.clear();
+        result_file_size = 0;
+        it = keyframelist.begin();
+    }
+    else
+    {
+        vector<pair<int, long> >::iterator rec_it = lower_bound(result_records.begin(), result_records.end(),
+                                                                make_pair(start_index, 0L));
+        if (rec_it != result_records.end())
         {
-            path[(*it)->sequence].poses.push_back(pose_stamped);
-            path[(*it)->sequence].header = pose_stamped.header;
+            result_file_size = rec_it->second;
+            result_records.erase(rec_it, result_records.end());
+            if (truncate(VINS_RESULT_PATH.c_str(), result_file_size) != 0)
+                printf("cannot truncate %s\n", VINS_RESULT_PATH.c_str());
         }
+        loop_path_file.open(VINS_RESULT_PATH, ios::app);
+        it = keyFrameTail(start_index);
+    }
+    for (; it != keyframelist.end(); it++)
+        saveResultRecord(loop_path_file, *it);
+    loop_path_file.close();
+}
 
-        if (SAVE_LOOP_PATH)
+// edge markers are in keyframe order as well, drop the ones from start_index on and redraw them;
+// loop edges are only drawn for the current sequence, a new sequence redraws everything;
+// caller holds m_keyframelist
+void PoseGraph::redrawEdges(int start_index)
+{
+    list<KeyFrame*>::iterator it;
+    if (drawn_sequence != sequence_cnt)
+    {
+        posegraph_visualization->reset();
+        edge_markers.clear();
+        drawn_sequence = sequence_cnt;
+        it = keyframelist.begin();
+    }
+    else
+    {
+        vector<pair<int, int> >::iterator marker_it = lower_bound(edge_markers.begin(), edge_markers.end(),
+                                                                  make_pair(start_index, 0));
+        if (marker_it != edge_markers.end())
         {
-            ofstream loop_path_file(VINS_RESULT_PATH, ios::app);
-            loop_path_file.setf(ios::fixed, ios::floatfield);
-            loop_path_file.precision(0);
-            loop_path_file << (*it)->time_stamp * 1e9 << ",";
-            loop_path_file.precision(5);
-            loop_path_file  << P.x() << ","
-                  << P.y() << ","
-                  << P.z() << ","
-                  << Q.w() << ","
-                  << Q.x() << ","
-                  << Q.y() << ","
-                  << Q.z() << ","
-                  << endl;
-            loop_path_file.close();
+            posegraph_visualization->truncate(marker_it->second);
+            edge_markers.erase(marker_it, edge_markers.end());
         }
+        it = keyFrameTail(start_index);
+    }
+    for (; it != keyframelist.end(); it++)
+    {
+        Vector3d P;
+        Matrix3d R;
+        (*it)->getPose(P, R);
+        int marker_num = posegraph_visualization->markerNum();
         //draw local connection
         if (SHOW_S_EDGE)
         {
-            list<KeyFrame*>::reverse_iterator rit = keyframelist.rbegin();
-            list<KeyFrame*>::reverse_iterator lrit;
-            for (; rit != keyframelist.rend(); rit++)  
-            {  
-                if ((*rit)->index == (*it)->index)
-                {
-                    lrit = rit;
-                    lrit++;
-                    for (int i = 0; i < 4; i++)
-                    {
-                        if (lrit == keyframelist.rend())
-                            break;
-                        if((*lrit)->sequence == (*it)->sequence)
-                        {
-                            Vector3d conncected_P;
-                            Matrix3d connected_R;
-                            (*lrit)->getPose(conncected_P, connected_R);
-                            posegraph_visualization->add_edge(P, conncected_P);
-                        }
-                        lrit++;
-                    }
+            list<KeyFrame*>::reverse_iterator lrit(it);
+            for (int i = 0; i < 4; i++)
+            {
+                if (lrit == keyframelist.rend())
                     break;
+                if((*lrit)->sequence == (*it)->sequence)
+                {
+                    Vector3d conncected_P;
+                    Matrix3d connected_R;
+                    (*lrit)->getPose(conncected_P, connected_R);
+                    posegraph_visualization->add_edge(P, conncected_P);
                 }
-            } 
+                lrit++;
+            }
         }
         if (SHOW_L_EDGE)
         {
@@ -879,39 +1307,88 @@ void PoseGraph::updatePath()
                 KeyFrame* connected_KF = getKeyFrame((*it)->loop_index);
                 Vector3d connected_P;
                 Matrix3d connected_R;
-                connected_KF->getPose(connected_P, connected_R);
-                //(*it)->getVioPose(P, R);
-                (*it)->getPose(P, R);
-                if((*it)->sequence > 0)
+                if (connected_KF != NULL && (*it)->sequence > 0)
                 {
+                    connected_KF->getPose(connected_P, connected_R);
                     posegraph_visualization->add_loopedge(P, connected_P + Vector3d(VISUALIZATION_SHIFT_X, VISUALIZATION_SHIFT_Y, 0));
                 }
             }
         }
+        if (posegraph_visualization->markerNum() != marker_num)
+            edge_markers.push_back(make_pair((*it)->index, marker_num));
+    }
+}
 
+void PoseGraph::saveResultRecord(ofstream &loop_path_file, KeyFrame* keyframe)
+{
+    Vector3d P;
+    Matrix3d R;
+    keyframe->getPose(P, R);
+    Quaterniond Q;
+    Q = R;
+    ostringstream record;
+    record.setf(ios::fixed, ios::floatfield);
+    record.precision(0);
+    record << keyframe->time_stamp * 1e9 << ",";
+    record.precision(5);
+    record  << P.x() << ","
+            << P.y() << ","
+            << P.z() << ","
+            << Q.w() << ","
+            << Q.x() << ","
+            << Q.y() << ","
+            << Q.z() << ","
+            << endl;
+    // the file may not start empty, find its end before the first record
+    if (result_records.empty() && result_file_size == 0)
+    {
+        loop_path_file.seekp(0, ios::end);
+        result_file_size = max((long)loop_path_file.tellp(), 0L);
     }
-    publish();
-    m_keyframelist.unlock();
+    result_records.push_back(make_pair(keyframe->index, result_file_size));
+    result_file_size += record.str().size();
+    loop_path_file << record.str();
 }
 
 
 void PoseGraph::savePoseGraph()
 {
+    waitLoopClosure();
     m_keyframelist.lock();
     TicToc tmp_t;
     FILE *pFile;
     printf("pose graph path: %s\n",POSE_GRAPH_SAVE_PATH.c_str());
     printf("pose graph saving... \n");
-    string file_path = POSE_GRAPH_SAVE_PATH + "pose_graph.txt";
-    pFile = fopen (file_path.c_str(),"w");
-    //fprintf(pFile, "index time_stamp Tx Ty Tz Qw Qx Qy Qz loop_index loop_info\n");
+    string file_path = POSE_GRAPH_SAVE_PATH + "pose_graph.bin";
+    // the old map is only replaced once the new one is completely on disk
+    string tmp_path = file_path + ".tmp";
+    pFile = fopen (tmp_path.c_str(),"wb");
+    if (pFile == NULL)
+    {
+        printf("save pose graph error: cannot open %s \n", tmp_path.c_str());
+        m_keyframelist.unlock();
+        return;
+    }
+
+    PoseGraphMapHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, POSE_GRAPH_MAP_MAGIC, sizeof(POSE_GRAPH_MAP_MAGIC));
+    header.version = POSE_GRAPH_MAP_VERSION;
+    header.num_keyframes = keyframelist.size();
+    header.brief_words = BRIEF_WORDS;
+    header.records_offset = sizeof(PoseGraphMapHeader);
+    header.features_offset = header.records_offset + header.num_keyframes * sizeof(PoseGraphMapRecord);
+    bool ok = fwrite(&header, sizeof(header), 1, pFile) == 1;
+
+    // spilled keyframes are copied from the spill file, keep the store still while writing
+    m_spill.lock();
     list<KeyFrame*>::iterator it;
-    for (it = keyframelist.begin(); it != keyframelist.end(); it++)
+    uint64_t feature_offset = 0;
+    for (it = keyframelist.begin(); it != keyframelist.end() && ok; it++)
     {
-        std::string image_path, descriptor_path, brief_path, keypoints_path;
         if (DEBUG_IMAGE)
         {
-            image_path = POSE_GRAPH_SAVE_PATH + to_string((*it)->index) + "_image.png";
+            std::string image_path = POSE_GRAPH_SAVE_PATH + to_string((*it)->index) + "_image.png";
             imwrite(image_path.c_str(), (*it)->image);
         }
         Quaterniond VIO_tmp_Q{(*it)->vio_R_w_i};
@@ -919,38 +1396,207 @@ void PoseGraph::savePoseGraph()
         Vector3d VIO_tmp_T = (*it)->vio_T_w_i;
         Vector3d PG_tmp_T = (*it)->T_w_i;
 
-        fprintf (pFile, " %d %f %f %f %f %f %f %f %f %f %f %f %f %f %f %f %d %f %f %f %f %f %f %f %f %d\n",(*it)->index, (*it)->time_stamp, 
-                                    VIO_tmp_T.x(), VIO_tmp_T.y(), VIO_tmp_T.z(), 
-                                    PG_tmp_T.x(), PG_tmp_T.y(), PG_tmp_T.z(), 
-                                    VIO_tmp_Q.w(), VIO_tmp_Q.x(), VIO_tmp_Q.y(), VIO_tmp_Q.z(), 
-                                    PG_tmp_Q.w(), PG_tmp_Q.x(), PG_tmp_Q.y(), PG_tmp_Q.z(), 
-                                    (*it)->loop_index, 
-                                    (*it)->loop_info(0), (*it)->loop_info(1), (*it)->loop_info(2), (*it)->loop_info(3),
-                                    (*it)->loop_info(4), (*it)->loop_info(5), (*it)->loop_info(6), (*it)->loop_info(7),
-                                    (int)(*it)->keypoints.size());
-
-        // write keypoints, brief_descriptors   vector<cv::KeyPoint> keypoints vector<BRIEF::bitset> brief_descriptors;
-        assert((*it)->keypoints.size() == (*it)->brief_descriptors.size());
-        brief_path = POSE_GRAPH_SAVE_PATH + to_string((*it)->index) + "_briefdes.dat";
-        std::ofstream brief_file(brief_path, std::ios::binary);
-        keypoints_path = POSE_GRAPH_SAVE_PATH + to_string((*it)->index) + "_keypoints.txt";
-        FILE *keypoints_file;
-        keypoints_file = fopen(keypoints_path.c_str(), "w");
+        PoseGraphMapRecord record;
+        memset(&record, 0, sizeof(record));
+        record.time_stamp = (*it)->time_stamp;
+        for (int k = 0; k < 3; k++)
+        {
+            record.vio_t[k] = VIO_tmp_T(k);
+            record.pg_t[k] = PG_tmp_T(k);
+        }
+        record.vio_q[0] = VIO_tmp_Q.w();
+        record.vio_q[1] = VIO_tmp_Q.x();
+        record.vio_q[2] = VIO_tmp_Q.y();
+        record.vio_q[3] = VIO_tmp_Q.z();
+        record.pg_q[0] = PG_tmp_Q.w();
+        record.pg_q[1] = PG_tmp_Q.x();
+        record.pg_q[2] = PG_tmp_Q.y();
+        record.pg_q[3] = PG_tmp_Q.z();
+        for (int k = 0; k < 8; k++)
+            record.loop_info[k] = (*it)->loop_info(k);
+        record.index = (*it)->index;
+        record.loop_index = (*it)->loop_index;
+        record.keypoints_num = (*it)->features_spilled ? (*it)->spill_num : (*it)->keypoints.size();
+        record.feature_offset = feature_offset;
+        feature_offset += record.keypoints_num * (sizeof(PoseGraphMapKeyPoint) + sizeof(PackedBRIEF));
+        ok = fwrite(&record, sizeof(record), 1, pFile) == 1;
+    }
+
+    // write keypoints, brief_descriptors   vector<cv::KeyPoint> keypoints vector<PackedBRIEF> packed_brief_descriptors;
+    vector<PoseGraphMapKeyPoint> map_keypoints;
+    vector<PackedBRIEF> spilled_descriptors;
+    for (it = keyframelist.begin(); it != keyframelist.end() && ok; it++)
+    {
+        if ((*it)->features_spilled)
+        {
+            // sizes must match the record even if the spill file cannot be read
+            if (!readSpilledFeatures(*it, map_keypoints, spilled_descriptors))
+            {
+                memset(map_keypoints.data(), 0, map_keypoints.size() * sizeof(PoseGraphMapKeyPoint));
+                memset(spilled_descriptors.data(), 0, spilled_descriptors.size() * sizeof(PackedBRIEF));
+            }
+            ok = fwrite(map_keypoints.data(), sizeof(PoseGraphMapKeyPoint), map_keypoints.size(), pFile) == map_keypoints.size() &&
+                 fwrite(spilled_descriptors.data(), sizeof(PackedBRIEF), spilled_descriptors.size(), pFile) == spilled_descriptors.size();
+            continue;
+        }
+        assert((*it)->keypoints.size() == (*it)->packed_brief_descriptors.size());
+        map_keypoints.resize((*it)->keypoints.size());
         for (int i = 0; i < (int)(*it)->keypoints.size(); i++)
         {
-            brief_file << (*it)->brief_descriptors[i] << endl;
-            fprintf(keypoints_file, "%f %f %f %f\n", (*it)->keypoints[i].pt.x, (*it)->keypoints[i].pt.y, 
-                                                     (*it)->keypoints_norm[i].pt.x, (*it)->keypoints_norm[i].pt.y);
+            map_keypoints[i].x = (*it)->keypoints[i].pt.x;
+            map_keypoints[i].y = (*it)->keypoints[i].pt.y;
+            map_keypoints[i].x_norm = (*it)->keypoints_norm[i].pt.x;
+            map_keypoints[i].y_norm = (*it)->keypoints_norm[i].pt.y;
         }
-        brief_file.close();
-        fclose(keypoints_file);
+        ok = fwrite(map_keypoints.data(), sizeof(PoseGraphMapKeyPoint), map_keypoints.size(), pFile) == map_keypoints.size() &&
+             fwrite((*it)->packed_brief_descriptors.data(), sizeof(PackedBRIEF), (*it)->packed_brief_descriptors.size(), pFile) ==
+             (*it)->packed_brief_descriptors.size();
     }
-    fclose(pFile);
+    m_spill.unlock();
 
-    printf("save pose graph time: %f s\n", tmp_t.toc() / 1000);
+    // DBoW indices, so loading does not transform every descriptor again
+    long db_begin = ok ? ftell(pFile) : -1;
+    ok = db_begin >= 0 && db.saveBinary(pFile);
+    long db_end = ok ? ftell(pFile) : -1;
+    if (ok && db_end >= 0)
+    {
+        header.db_offset = db_begin;
+        header.db_size = db_end - db_begin;
+        ok = fseek(pFile, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, pFile) == 1 &&
+             fflush(pFile) == 0 && fsync(fileno(pFile)) == 0;
+    }
+    else
+        ok = false;
+    if (fclose(pFile) != 0)
+        ok = false;
+    if (ok && rename(tmp_path.c_str(), file_path.c_str()) != 0)
+        ok = false;
+    if (ok)
+        printf("save pose graph time: %f s\n", tmp_t.toc() / 1000);
+    else
+    {
+        printf("save pose graph error: cannot write %s, the previous map is kept \n", tmp_path.c_str());
+        remove(tmp_path.c_str());
+    }
     m_keyframelist.unlock();
 }
+
 void PoseGraph::loadPoseGraph()
+{
+    TicToc tmp_t;
+    string file_path = POSE_GRAPH_SAVE_PATH + "pose_graph.bin";
+    printf("lode pose graph from: %s \n", file_path.c_str());
+    int fd = open(file_path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        // maps saved before the binary format
+        loadPoseGraphText();
+        return;
+    }
+    printf("pose graph loading...\n");
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0 || file_stat.st_size < POSE_GRAPH_MAP_HEADER_V1_SIZE)
+    {
+        printf("lode previous pose graph error: broken pose graph file \n the system will start with new pose graph \n");
+        close(fd);
+        return;
+    }
+    size_t file_size = file_stat.st_size;
+    void *file_data = mmap(NULL, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (file_data == MAP_FAILED)
+    {
+        printf("lode previous pose graph error: fail to map %s \n", file_path.c_str());
+        return;
+    }
+    // records are read once, features are only faulted in when a keyframe is paged in as a loop candidate
+    madvise(file_data, file_size, MADV_RANDOM);
+    const char *map_base = (const char *)file_data;
+
+    const PoseGraphMapHeader *header = (const PoseGraphMapHeader *)map_base;
+    if (memcmp(header->magic, POSE_GRAPH_MAP_MAGIC, sizeof(POSE_GRAPH_MAP_MAGIC)) != 0 ||
+        header->version < 1 || header->version > POSE_GRAPH_MAP_VERSION || header->brief_words != BRIEF_WORDS ||
+        (header->version >= 2 && file_size < sizeof(PoseGraphMapHeader)) ||
+        header->features_offset > file_size ||
+        header->records_offset + (uint64_t)header->num_keyframes * sizeof(PoseGraphMapRecord) > header->features_offset)
+    {
+        printf("lode previous pose graph error: unsupported pose graph file \n the system will start with new pose graph \n");
+        munmap(file_data, file_size);
+        return;
+    }
+
+    // restore the DBoW database, entry ids follow keyframe indices so restored keyframes are not added again
+    bool db_restored = false;
+    if (header->version >= 2 && header->db_offset + header->db_size <= file_size)
+    {
+        const PoseGraphMapRecord *last_record = (const PoseGraphMapRecord *)(map_base + header->records_offset) + header->num_keyframes - 1;
+        unsigned int num_entries = header->num_keyframes > 0 ? last_record->index + 1 : 0;
+        db_restored = db.loadBinary(map_base + header->db_offset, header->db_size) && db.size() == num_entries;
+        if (db_restored)
+            printf("restore loop detection database, %d entries \n", (int)db.size());
+        else
+            db.clear();
+    }
+
+    const PoseGraphMapRecord *records = (const PoseGraphMapRecord *)(map_base + header->records_offset);
+    for (int cnt = 0; cnt < (int)header->num_keyframes; cnt++)
+    {
+        const PoseGraphMapRecord &record = records[cnt];
+        uint64_t feature_begin = header->features_offset + record.feature_offset;
+        uint64_t feature_size = (uint64_t)record.keypoints_num * (sizeof(PoseGraphMapKeyPoint) + sizeof(PackedBRIEF));
+        if (feature_begin + feature_size > file_size)
+        {
+            printf(" fail to load pose graph \n");
+            break;
+        }
+        cv::Mat image;
+        if (DEBUG_IMAGE)
+        {
+            std::string image_path = POSE_GRAPH_SAVE_PATH + to_string(record.index) + "_image.png";
+            image = cv::imread(image_path.c_str(), 0);
+        }
+
+        Vector3d VIO_T(record.vio_t[0], record.vio_t[1], record.vio_t[2]);
+        Vector3d PG_T(record.pg_t[0], record.pg_t[1], record.pg_t[2]);
+        Matrix3d VIO_R, PG_R;
+        VIO_R = Quaterniond(record.vio_q[0], record.vio_q[1], record.vio_q[2], record.vio_q[3]).toRotationMatrix();
+        PG_R = Quaterniond(record.pg_q[0], record.pg_q[1], record.pg_q[2], record.pg_q[3]).toRotationMatrix();
+        Eigen::Matrix<double, 8, 1 > loop_info(record.loop_info);
+        int loop_index = record.loop_index;
+
+        if (loop_index != -1)
+            if (earliest_loop_index > loop_index || earliest_loop_index == -1)
+            {
+                earliest_loop_index = loop_index;
+            }
+
+        // features stay in the map until the keyframe is pinned
+        vector<cv::KeyPoint> keypoints, keypoints_norm;
+        vector<PackedBRIEF> packed_brief_descriptors;
+        KeyFrame* keyframe = new KeyFrame(record.time_stamp, record.index, VIO_T, VIO_R, PG_T, PG_R, image, loop_index, loop_info, keypoints, keypoints_norm, packed_brief_descriptors);
+        keyframe->features_spilled = true;
+        keyframe->spill_num = record.keypoints_num;
+        keyframe->map_features = map_base + feature_begin;
+        // without the restored database the descriptors go through the vocabulary once, loadKeyFrame unpins
+        if (!db_restored)
+            pinKeyFrame(keyframe);
+        // keep the saved indices, culled keyframes leave gaps that loop indices refer across
+        if (record.index > global_index)
+            global_index = record.index;
+        loadKeyFrame(keyframe, 0);
+        if (cnt % 20 == 0)
+        {
+            publish();
+        }
+    }
+    // keyframes page their features in from the mapping, a later save renames a new file over it
+    map_data = file_data;
+    map_size = file_size;
+    printf("load pose graph time: %f s\n", tmp_t.toc()/1000);
+    base_sequence = 0;
+}
+
+void PoseGraph::loadPoseGraphText()
 {
     TicToc tmp_t;
     FILE * pFile;
@@ -13,12 +13,15 @@
 
 #include <thread>
 #include <mutex>
+#include <atomic>
 #include <opencv2/opencv.hpp>
 #include <eigen3/Eigen/Dense>
 #include <string>
+#include <fstream>
 #include <ceres/ceres.h>
 #include <ceres/rotation.h>
 #include <queue>
+#include <array>
 #include <assert.h>
 #include <nav_msgs/Path.h>
 #include <geometry_msgs/PointStamped.h>
@@ -39,10 +42,60 @@
 #define SHOW_S_EDGE false
 #define SHOW_L_EDGE true
 #define SAVE_LOOP_PATH true
+#define OPT_WINDOW_SIZE 2000    // max keyframes re-optimized by one 4 DoF loop correction
+#define CULL_MIN_SCORE 0.08     // DBoW score to an older keyframe for a new one to be redundant
+#define CULL_DISTANCE 0.5       // max distance (m) to that older keyframe
+#define CULL_YAW 20.0           // max yaw difference (degree) to that older keyframe
+#define CULL_LOOP_WINDOW 20     // a loop must have been verified within this many keyframes
+#define CULL_MAX_GAP 3          // max consecutive culled keyframes, bounds the span of collapsed odometry edges
+#define POSE_GRAPH_MAP_MAGIC "VINSPGM"
+#define POSE_GRAPH_MAP_VERSION 2
 
 using namespace DVision;
 using namespace DBoW2;
 
+/*
+**  Binary pose graph map (pose_graph.bin), native endianness, all chunks 8-byte aligned:
+**    PoseGraphMapHeader
+**    keyframe chunk: num_keyframes x PoseGraphMapRecord
+**    feature chunk:  per keyframe, keypoints_num x PoseGraphMapKeyPoint then keypoints_num x PackedBRIEF
+**    database chunk: DBoW indices, see TemplatedDatabase::saveBinary (since version 2)
+ */
+struct PoseGraphMapHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t num_keyframes;
+	uint32_t brief_words;
+	uint32_t reserved;
+	uint64_t records_offset;
+	uint64_t features_offset;
+	uint64_t db_offset;
+	uint64_t db_size;
+};
+#define POSE_GRAPH_MAP_HEADER_V1_SIZE 40
+
+struct PoseGraphMapRecord
+{
+	double time_stamp;
+	double vio_t[3];
+	double vio_q[4];        // w x y z
+	double pg_t[3];
+	double pg_q[4];         // w x y z
+	double loop_info[8];
+	int32_t index;
+	int32_t loop_index;
+	uint32_t keypoints_num;
+	uint32_t reserved;
+	uint64_t feature_offset;    // relative to features_offset
+};
+
+struct PoseGraphMapKeyPoint
+{
+	float x, y;
+	float x_norm, y_norm;
+};
+
 class PoseGraph
 {
 public:
@@ -53,6 +106,7 @@ public:
 	void loadKeyFrame(KeyFrame* cur_kf, bool flag_detect_loop);
 	void loadVocabulary(std::string voc_path);
 	void setIMUFlag(bool _use_imu);
+	void setMemoryBudget(int budget_mb);
 	KeyFrame* getKeyFrame(int index);
 	nav_msgs::Path path[10];
 	nav_msgs::Path base_path;
@@ -69,24 +123,70 @@ public:
 
 
 private:
-	int detectLoop(KeyFrame* keyframe, int frame_index);
+	int detectLoop(KeyFrame* keyframe, int frame_index, bool* redundant = NULL);
+	bool isRedundant(KeyFrame* keyframe, const QueryResults &ret);
+	void cullKeyFrame(KeyFrame* keyframe);
 	void addKeyFrameIntoVoc(KeyFrame* keyframe);
+	void extractionThread();
+	void detectionThread();
+	void verificationThread();
+	void addLoopEdge(KeyFrame* cur_kf, KeyFrame* old_kf, const Eigen::Matrix<double, 8, 1 > &loop_info);
+	void waitLoopClosure();
+	bool pinKeyFrame(KeyFrame* keyframe);
+	void unpinKeyFrame(KeyFrame* keyframe);
+	bool spillKeyFrame(KeyFrame* keyframe);
+	bool readSpilledFeatures(const KeyFrame* keyframe, vector<PoseGraphMapKeyPoint> &map_keypoints, vector<PackedBRIEF> &descriptors);
 	void optimize4DoF();
 	void optimize6DoF();
-	void updatePath();
+	void updatePath(int start_index);
+	void saveResultRecord(ofstream &loop_path_file, KeyFrame* keyframe);
+	list<KeyFrame*>::iterator keyFrameTail(int start_index);
+	void rewriteResultPath(int start_index);
+	void redrawEdges(int start_index);
+	void loadPoseGraphText();
 	list<KeyFrame*> keyframelist;
+	map<int, KeyFrame*> keyframe_map;           // index -> keyframe of keyframelist
+	// updatePath only redraws and rewrites from the first changed keyframe on
+	vector<pair<int, int> > edge_markers;       // (keyframe index, its first edge marker), in keyframe order
+	vector<pair<int, long> > result_records;    // (keyframe index, its record offset in VINS_RESULT_PATH), in keyframe order
+	long result_file_size;
+	int drawn_sequence;                         // sequence whose loop edges are drawn
 	std::mutex m_keyframelist;
 	std::mutex m_optimize_buf;
 	std::mutex m_path;
 	std::mutex m_drift;
 	std::thread t_optimization;
 	std::queue<int> optimize_buf;
+	// loop closure pipeline: feature extraction -> DBoW query -> geometric verification
+	std::mutex m_extract_buf;
+	std::mutex m_detect_buf;
+	std::mutex m_verify_buf;
+	std::thread t_extraction;
+	std::thread t_loop_detection;
+	std::thread t_loop_verification;
+	std::queue<pair<KeyFrame*, bool> > extract_buf;
+	std::queue<pair<KeyFrame*, bool> > detect_buf;
+	std::queue<pair<KeyFrame*, int> > verify_buf;
+	std::atomic<int> loop_pending_cnt;      // keyframes still in the loop closure pipeline
+	std::atomic<bool> thread_stop;          // set by the destructor, ends the worker loops
+	// bounded-memory keyframe store: features of cold keyframes are spilled to keyframe_spill.bin
+	// (same layout as the map feature chunk) and paged back in when they become loop candidates;
+	// keyframes of a loaded map start out spilled, their features are paged in from the mapped map
+	std::mutex m_spill;
+	list<KeyFrame*> resident_list;          // evictable keyframes with features in memory, least recently used first
+	size_t resident_memory;
+	size_t memory_budget;                   // bytes, 0 for unlimited
+	FILE* spill_file;
+	void* map_data;                         // mapping of the loaded pose_graph.bin, kept while its keyframes live
+	size_t map_size;
 
 	int global_index;
 	int sequence_cnt;
 	vector<bool> sequence_loop;
 	map<int, cv::Mat> image_pool;
 	int earliest_loop_index;
+	int last_loop_index;                    // newest keyframe with a verified loop
+	int culled_cnt;                         // consecutive culled keyframes
 	int base_sequence;
 	bool use_imu;
 
@@ -464,6 +464,8 @@ int main(int argc, char **argv)
 
     int USE_IMU = fsSettings["imu"];
     posegraph.setIMUFlag(USE_IMU);
+    int MEMORY_BUDGET = fsSettings["keyframe_memory_budget"];
+    posegraph.setMemoryBudget(MEMORY_BUDGET);
     fsSettings.release();
 
     if (LOAD_PREVIOUS_POSE_GRAPH)
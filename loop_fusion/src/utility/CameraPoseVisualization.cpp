@@ -204,6 +204,16 @@ void CameraPoseVisualization::reset() {
     //image.colors.clear();
 }
 
+int CameraPoseVisualization::markerNum() const {
+	return (int)m_markers.size();
+}
+
+// drop the markers added after the first num ones, re-added markers reuse their ids
+void CameraPoseVisualization::truncate(int num) {
+	if (num < (int)m_markers.size())
+		m_markers.resize(num);
+}
+
 void CameraPoseVisualization::publish_by( ros::Publisher &pub, const std_msgs::Header &header ) {
 	visualization_msgs::MarkerArray markerArray_msg;
 	//int k = (int)m_markers.size();
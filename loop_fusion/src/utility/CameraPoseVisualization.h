@@ -31,6 +31,8 @@ public:
 
 	void add_pose(const Eigen::Vector3d& p, const Eigen::Quaterniond& q);
 	void reset();
+	int markerNum() const;
+	void truncate(int num);
 
 	void publish_by(ros::Publisher& pub, const std_msgs::Header& header);
 	void add_edge(const Eigen::Vector3d& p0, const Eigen::Vector3d& p1);
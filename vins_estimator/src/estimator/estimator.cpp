@@ -14,10 +14,12 @@ Estimator::Estimator()
 {
     ROS_INFO("init begins");
     initThreadFlag = false;
+    gnss_align_running = false;
 }
 
 Estimator::~Estimator()
 {
+    stopGNSSVIAlign();
     if (MULTIPLE_THREAD)
     {
         processThread.join();
@@ -80,13 +82,21 @@ void Estimator::clearState()
     initial_timestamp = 0;
     all_image_frame.clear();
 
+    stopGNSSVIAlign();
     gnss_ready = false;
     anc_ecef.setZero();
     R_ecef_enu.setIdentity();
     para_yaw_enu_local[0] = 0;
     yaw_enu_local = 0;
+    mEphem.lock();
     sat2ephem.clear();
-    sat2time_index.clear();
+    mEphem.unlock();
+    for (int i = 0; i < WINDOW_SIZE + 1; i++)
+    {
+        gnss_meas_buf[i].clear();
+        gnss_ephem_buf[i].clear();
+        gnss_sat_state_buf[i].clear();
+    }
     sat_track_status.clear();
     latest_gnss_iono_params.clear();
     std::copy(GNSS_IONO_DEFAULT_PARAMS.begin(), GNSS_IONO_DEFAULT_PARAMS.end(), 
@@ -298,12 +308,49 @@ void Estimator::getGNSSInterval(double t0, double t1, vector<pair<double, shared
 
 void Estimator::inputEphem(EphemBasePtr ephem_ptr)
 {
+    std::lock_guard<std::mutex> lg(mEphem);
     double toe = time2sec(ephem_ptr->toe);
     // if a new ephemeris comes
-    if (sat2time_index.count(ephem_ptr->sat) == 0 || sat2time_index.at(ephem_ptr->sat).count(toe) == 0)
+    sat2ephem[ephem_ptr->sat].emplace(toe, ephem_ptr);
+}
+
+// pick the ephemeris whose toe is closest to obs_time, caller holds mEphem
+EphemBasePtr Estimator::selectEphem(const uint32_t sat, const double obs_time) const
+{
+    auto sat_it = sat2ephem.find(sat);
+    if (sat_it == sat2ephem.end())
+        return nullptr;
+
+    const std::map<double, EphemBasePtr> &toe2ephem = sat_it->second;
+    EphemBasePtr best_ephem = nullptr;
+    double ephem_time = EPH_VALID_SECONDS;
+    auto next_it = toe2ephem.lower_bound(obs_time);
+    if (next_it != toe2ephem.begin())
+    {
+        auto prev_it = std::prev(next_it);
+        if (obs_time - prev_it->first < ephem_time)
+        {
+            ephem_time = obs_time - prev_it->first;
+            best_ephem = prev_it->second;
+        }
+    }
+    if (next_it != toe2ephem.end() && next_it->first - obs_time < ephem_time)
+        best_ephem = next_it->second;
+    return best_ephem;
+}
+
+// drop ephemerides that can no longer be selected by any later observation, caller holds mEphem
+void Estimator::pruneEphem(const double obs_time)
+{
+    const double stale_toe = obs_time - EPH_VALID_SECONDS;
+    for (auto sat_it = sat2ephem.begin(); sat_it != sat2ephem.end(); )
     {
-        sat2ephem[ephem_ptr->sat].emplace_back(ephem_ptr);
-        sat2time_index[ephem_ptr->sat].emplace(toe, sat2ephem.at(ephem_ptr->sat).size()-1);
+        std::map<double, EphemBasePtr> &toe2ephem = sat_it->second;
+        toe2ephem.erase(toe2ephem.begin(), toe2ephem.lower_bound(stale_toe));
+        if (toe2ephem.empty())
+            sat_it = sat2ephem.erase(sat_it);
+        else
+            ++sat_it;
     }
 }
 
@@ -332,6 +379,7 @@ void Estimator::processGNSS(const shared_ptr<vector<ObsPtr>> &gnss_meas)
 {
     std::vector<ObsPtr> valid_meas;
     std::vector<EphemBasePtr> valid_ephems;
+    std::unique_lock<std::mutex> ephem_lock(mEphem);
     for (auto obs : *gnss_meas)
     {
         // filter according to system
@@ -349,23 +397,12 @@ void Estimator::processGNSS(const shared_ptr<vector<ObsPtr>> &gnss_meas)
         if (freq_idx < 0)   continue;              // no L1 observation
         
         double obs_time = time2sec(obs->time);
-        std::map<double, size_t> time2index = sat2time_index.at(obs->sat);
-        double ephem_time = EPH_VALID_SECONDS;
-        size_t ephem_index = -1;
-        for (auto ti : time2index)
-        {
-            if (std::abs(ti.first - obs_time) < ephem_time)
-            {
-                ephem_time = std::abs(ti.first - obs_time);
-                ephem_index = ti.second;
-            }
-        }
-        if (ephem_time >= EPH_VALID_SECONDS)
+        EphemBasePtr best_ephem = selectEphem(obs->sat, obs_time);
+        if (!best_ephem)
         {
             cerr << "ephemeris not valid anymore\n";
             continue;
         }
-        const EphemBasePtr &best_ephem = sat2ephem.at(obs->sat).at(ephem_index);
 
         // filter by tracking status
         LOG_IF(FATAL, freq_idx < 0) << "No L1 observation found.\n";
@@ -384,25 +421,40 @@ void Estimator::processGNSS(const shared_ptr<vector<ObsPtr>> &gnss_meas)
         if (sat_track_status[obs->sat] < GNSS_TRACK_NUM_THRES)
             continue;           // not being tracked for enough epochs
 
-        // filter by elevation angle
-        if (gnss_ready)
+        valid_meas.push_back(obs);
+        valid_ephems.push_back(best_ephem);
+    }
+    if (!gnss_meas->empty())
+        pruneEphem(time2sec(gnss_meas->front()->time));
+    ephem_lock.unlock();
+
+    // satellite states are evaluated once per epoch and shared by the
+    // elevation filter, the psr/dopp factors and the GNSS-VI initializer
+    std::vector<SatStatePtr> valid_sat_states = sat_states(valid_meas, valid_ephems);
+
+    // filter by elevation angle
+    if (gnss_ready)
+    {
+        uint32_t num_kept = 0;
+        for (uint32_t i = 0; i < valid_meas.size(); ++i)
         {
-            Vector3d sat_ecef;
-            if (sys == SYS_GLO)
-                sat_ecef = geph2pos(obs->time, std::dynamic_pointer_cast<GloEphem>(best_ephem), NULL);
-            else
-                sat_ecef = eph2pos(obs->time, std::dynamic_pointer_cast<Ephem>(best_ephem), NULL);
             double azel[2] = {0, M_PI/2.0};
-            sat_azel(ecef_pos, sat_ecef, azel);
+            sat_azel(ecef_pos, valid_sat_states[i]->pos, azel);
             if (azel[1] < GNSS_ELEVATION_THRES*M_PI/180.0)
                 continue;
+            valid_meas[num_kept] = valid_meas[i];
+            valid_ephems[num_kept] = valid_ephems[i];
+            valid_sat_states[num_kept] = valid_sat_states[i];
+            ++ num_kept;
         }
-        valid_meas.push_back(obs);
-        valid_ephems.push_back(best_ephem);
+        valid_meas.resize(num_kept);
+        valid_ephems.resize(num_kept);
+        valid_sat_states.resize(num_kept);
     }
     
     gnss_meas_buf[frame_count] = valid_meas;
     gnss_ephem_buf[frame_count] = valid_ephems;
+    gnss_sat_state_buf[frame_count] = valid_sat_states;
 }
 
 void Estimator::processMeasurements()
@@ -696,10 +748,8 @@ void Estimator::processImage(const map<int, map<int, vector<pair<int, Matrix<dou
         if(STEREO && USE_IMU)
         {
             for (auto f_manager : f_managers)
-            {
                 f_manager->initFramePoseByPnP(frame_count, Ps, Rs, tic, ric);
-                f_manager->triangulate(frame_count, Ps, Rs, tic, ric);
-            }
+            triangulateUnits();
             if (frame_count == WINDOW_SIZE)
             {
                 map<double, ImageFrame>::iterator frame_it;
@@ -727,10 +777,8 @@ void Estimator::processImage(const map<int, map<int, vector<pair<int, Matrix<dou
         if(STEREO && !USE_IMU)
         {
             for (auto f_manager : f_managers)
-            {
                 f_manager->initFramePoseByPnP(frame_count, Ps, Rs, tic, ric);
-                f_manager->triangulate(frame_count, Ps, Rs, tic, ric);
-            }
+            triangulateUnits();
             optimization();
 
             if(frame_count == WINDOW_SIZE)
@@ -758,12 +806,12 @@ void Estimator::processImage(const map<int, map<int, vector<pair<int, Matrix<dou
     else
     {
         TicToc t_solve;
-        for (auto f_manager : f_managers)
+        if(!USE_IMU)
         {
-            if(!USE_IMU)
+            for (auto f_manager : f_managers)
                 f_manager->initFramePoseByPnP(frame_count, Ps, Rs, tic, ric);
-            f_manager->triangulate(frame_count, Ps, Rs, tic, ric);
         }
+        triangulateUnits();
         optimization();
         if (GNSS_ENABLE)
         {
@@ -772,17 +820,19 @@ void Estimator::processImage(const map<int, map<int, vector<pair<int, Matrix<dou
             if (gnss_ready)
                 updateGNSSStatistics();
         }
-        for (int cam = 0; cam < NUM_OF_CAM_UNIT; ++cam)
+        cv::parallel_for_(cv::Range(0, NUM_OF_CAM_UNIT), [&](const cv::Range &range)
         {
-            set<int> removeIndex;
-            outliersRejection(cam, removeIndex);
-            f_managers[cam]->removeOutlier(removeIndex);
-            if (! MULTIPLE_THREAD)
+            for (int cam = range.start; cam < range.end; ++cam)
             {
-                featureTrackers[cam]->removeOutliers(removeIndex);
-                predictPtsInNextFrame();
+                set<int> removeIndex;
+                outliersRejection(cam, removeIndex);
+                f_managers[cam]->removeOutlier(removeIndex);
+                if (! MULTIPLE_THREAD)
+                    featureTrackers[cam]->removeOutliers(removeIndex);
             }
-        }
+        });
+        if (! MULTIPLE_THREAD)
+            predictPtsInNextFrame();
             
         ROS_DEBUG("solver costs: %fms", t_solve.toc());
 
@@ -812,6 +862,16 @@ void Estimator::processImage(const map<int, map<int, vector<pair<int, Matrix<dou
     }  
 }
 
+void Estimator::triangulateUnits()
+{
+    // each unit only reads the window poses and writes its own feature depths
+    cv::parallel_for_(cv::Range(0, NUM_OF_CAM_UNIT), [&](const cv::Range &range)
+    {
+        for (int cam = range.start; cam < range.end; ++cam)
+            f_managers[cam]->triangulate(frame_count, Ps, Rs, tic, ric);
+    });
+}
+
 void Estimator::processIMUEncoder(double dt, const Vector3d &linear_acceleration, const Vector3d &angular_velocity, const Matrix<double, 6, 1> &encoder_velocity)
 {
     if (!first_imu)
@@ -1053,10 +1113,8 @@ bool Estimator::visualInitialAlign()
     ROS_DEBUG_STREAM("my R0  " << Utility::R2ypr(Rs[0]).transpose()); 
 
     for (auto f_manager : f_managers)
-    {
         f_manager->clearDepth();
-        f_manager->triangulate(frame_count, Ps, Rs, tic, ric);
-    }
+    triangulateUnits();
 
     return true;
 }
@@ -1068,6 +1126,18 @@ bool Estimator::GNSSVIAlign()
     
     if (gnss_ready)                 // GNSS-VI already initialized
         return true;
+
+    // the alignment runs off the estimator thread, collect its result once finished
+    if (gnssAlignThread.joinable())
+    {
+        if (gnss_align_running)
+            return false;
+        gnssAlignThread.join();
+        shared_ptr<GNSSVIAlignJob> finished_job = gnss_align_job;
+        gnss_align_job.reset();
+        if (finished_job->success && applyGNSSVIAlign(*finished_job))
+            return true;
+    }
     
     for (uint32_t i = 0; i < (WINDOW_SIZE+1); ++i)
     {
@@ -1086,55 +1156,89 @@ bool Estimator::GNSSVIAlign()
         return false;
     }
 
-    std::vector<std::vector<ObsPtr>> curr_gnss_meas_buf;
-    std::vector<std::vector<EphemBasePtr>> curr_gnss_ephem_buf;
+    // snapshot the window, only shared pointers to the measurements are copied
+    gnss_align_job = make_shared<GNSSVIAlignJob>();
     for (uint32_t i = 0; i < (WINDOW_SIZE+1); ++i)
     {
-        curr_gnss_meas_buf.push_back(gnss_meas_buf[i]);
-        curr_gnss_ephem_buf.push_back(gnss_ephem_buf[i]);
+        gnss_align_job->meas_buf.push_back(gnss_meas_buf[i]);
+        gnss_align_job->ephem_buf.push_back(gnss_ephem_buf[i]);
+        gnss_align_job->sat_state_buf.push_back(gnss_sat_state_buf[i]);
+        gnss_align_job->local_ps.push_back(Ps[i]);
+        gnss_align_job->local_vs.push_back(Vs[i]);
+        gnss_align_job->headers[i] = Headers[i];
     }
+    gnss_align_job->iono_params = latest_gnss_iono_params;
+    gnss_align_job->success = false;
+
+    gnss_align_running = true;
+    gnssAlignThread = std::thread(&Estimator::runGNSSVIAlign, this, gnss_align_job);
+    return false;
+}
 
-    GNSSVIInitializer gnss_vi_initializer(curr_gnss_meas_buf, curr_gnss_ephem_buf, latest_gnss_iono_params);
+void Estimator::runGNSSVIAlign(shared_ptr<GNSSVIAlignJob> job)
+{
+    TicToc t_align;
+    GNSSVIInitializer gnss_vi_initializer(job->meas_buf, job->ephem_buf, 
+        job->sat_state_buf, job->iono_params);
 
     // 1. get a rough global location
-    Matrix<double, 7, 1> rough_xyzt;
-    rough_xyzt.setZero();
-    if (!gnss_vi_initializer.coarse_localization(rough_xyzt))
+    job->rough_xyzt.setZero();
+    if (!gnss_vi_initializer.coarse_localization(job->rough_xyzt))
     {
         std::cerr << "Fail to obtain a coarse location.\n";
-        return false;
+        gnss_align_running = false;
+        return;
     }
 
     // 2. perform yaw alignment
-    std::vector<Vector3d> local_vs;
-    for (uint32_t i = 0; i < (WINDOW_SIZE+1); ++i)
-        local_vs.push_back(Vs[i]);
-    Vector3d rough_anchor_ecef = rough_xyzt.head<3>();
-    double aligned_yaw = 0;
-    double aligned_rcv_ddt = 0;
-    if (!gnss_vi_initializer.yaw_alignment(local_vs, rough_anchor_ecef, aligned_yaw, aligned_rcv_ddt))
+    Vector3d rough_anchor_ecef = job->rough_xyzt.head<3>();
+    job->aligned_yaw = 0;
+    job->aligned_rcv_ddt = 0;
+    if (!gnss_vi_initializer.yaw_alignment(job->local_vs, rough_anchor_ecef, 
+        job->aligned_yaw, job->aligned_rcv_ddt))
     {
         std::cerr << "Fail to align ENU and local frames.\n";
-        return false;
+        gnss_align_running = false;
+        return;
     }
-    // std::cout << "aligned_yaw is " << aligned_yaw*180.0/M_PI << '\n';
+    // std::cout << "aligned_yaw is " << job->aligned_yaw*180.0/M_PI << '\n';
 
     // 3. perform anchor refinement
-    std::vector<Vector3d> local_ps;
-    for (uint32_t i = 0; i < (WINDOW_SIZE+1); ++i)
-        local_ps.push_back(Ps[i]);
-    Matrix<double, 7, 1> refined_xyzt;
-    refined_xyzt.setZero();
-    if (!gnss_vi_initializer.anchor_refinement(local_ps, aligned_yaw, 
-        aligned_rcv_ddt, rough_xyzt, refined_xyzt))
+    job->refined_xyzt.setZero();
+    if (!gnss_vi_initializer.anchor_refinement(job->local_ps, job->aligned_yaw, 
+        job->aligned_rcv_ddt, job->rough_xyzt, job->refined_xyzt))
     {
         std::cerr << "Fail to refine anchor point.\n";
-        return false;
+        gnss_align_running = false;
+        return;
     }
     // std::cout << "refined anchor point is " << std::setprecision(20) 
-    //           << refined_xyzt.head<3>().transpose() << '\n';
+    //           << job->refined_xyzt.head<3>().transpose() << '\n';
+
+    ROS_DEBUG("GNSS-VI alignment costs: %fms", t_align.toc());
+    job->success = true;
+    gnss_align_running = false;
+}
+
+bool Estimator::applyGNSSVIAlign(const GNSSVIAlignJob &job)
+{
+    // the window may have slid while the alignment was running
+    int shift = -1;
+    for (int i = 0; i <= WINDOW_SIZE; ++i)
+    {
+        if (job.headers[i] == Headers[0])
+        {
+            shift = i;
+            break;
+        }
+    }
+    if (shift < 0)
+        return false;
 
     // restore GNSS states
+    const Matrix<double, 7, 1> &rough_xyzt = job.rough_xyzt;
+    const Matrix<double, 7, 1> &refined_xyzt = job.refined_xyzt;
+    const double aligned_rcv_ddt = job.aligned_rcv_ddt;
     uint32_t one_observed_sys = static_cast<uint32_t>(-1);
     for (uint32_t k = 0; k < 4; ++k)
     {
@@ -1150,19 +1254,27 @@ bool Estimator::GNSSVIAlign()
         for (uint32_t k = 0; k < 4; ++k)
         {
             if (rough_xyzt(k+3) == 0)
-                para_rcv_dt[i*4+k] = refined_xyzt(3+one_observed_sys) + aligned_rcv_ddt * i;
+                para_rcv_dt[i*4+k] = refined_xyzt(3+one_observed_sys) + aligned_rcv_ddt * (i+shift);
             else
-                para_rcv_dt[i*4+k] = refined_xyzt(3+k) + aligned_rcv_ddt * i;
+                para_rcv_dt[i*4+k] = refined_xyzt(3+k) + aligned_rcv_ddt * (i+shift);
         }
     }
     anc_ecef = refined_xyzt.head<3>();
     R_ecef_enu = ecef2rotation(anc_ecef);
 
-    yaw_enu_local = aligned_yaw;
+    yaw_enu_local = job.aligned_yaw;
 
     return true;
 }
 
+void Estimator::stopGNSSVIAlign()
+{
+    if (gnssAlignThread.joinable())
+        gnssAlignThread.join();
+    gnss_align_job.reset();
+    gnss_align_running = false;
+}
+
 void Estimator::updateGNSSStatistics()
 {
     R_enu_local = AngleAxisd(yaw_enu_local, Vector3d::UnitZ());
@@ -1406,6 +1518,66 @@ bool Estimator::failureDetection()
     return false;
 }
 
+// Build the visual residuals of camera unit cam. With marginalize only the features
+// observed in the oldest frame are kept, and drop_set holds the blocks to marginalize.
+// Returns the number of observations used.
+int Estimator::collectVisualResiduals(int cam, bool marginalize, vector<VisualResidual> &residuals)
+{
+    int obs_cnt = 0;
+    int feature_index = -1;
+    for (auto &it_per_id : f_managers[cam]->feature)
+    {
+        it_per_id.used_num = it_per_id.feature_per_frame.size();
+        if (it_per_id.used_num < 4)
+            continue;
+
+        ++feature_index;
+
+        int imu_i = it_per_id.start_frame, imu_j = imu_i - 1;
+        if (marginalize && imu_i != 0)
+            continue;
+
+        Vector3d pts_i = it_per_id.feature_per_frame[0].point;
+
+        for (auto &it_per_frame : it_per_id.feature_per_frame)
+        {
+            imu_j++;
+            if (imu_i != imu_j)
+            {
+                Vector3d pts_j = it_per_frame.point;
+                ProjectionTwoFrameOneCamFactor *f_td = new ProjectionTwoFrameOneCamFactor(pts_i, pts_j, it_per_id.feature_per_frame[0].velocity, it_per_frame.velocity,
+                                                                it_per_id.feature_per_frame[0].cur_td, it_per_frame.cur_td);
+                residuals.push_back(VisualResidual{f_td,
+                                                   vector<double *>{para_Pose[imu_i], para_Pose[imu_j], para_Ex_Pose[cam * 2], para_Feature[cam][feature_index], para_Td[0]},
+                                                   vector<int>{0, 3}});
+            }
+
+            if(STEREO && it_per_frame.is_stereo)
+            {
+                Vector3d pts_j_right = it_per_frame.pointRight;
+                if(imu_i != imu_j)
+                {
+                    ProjectionTwoFrameTwoCamFactor *f = new ProjectionTwoFrameTwoCamFactor(pts_i, pts_j_right, it_per_id.feature_per_frame[0].velocity, it_per_frame.velocityRight,
+                                                                it_per_id.feature_per_frame[0].cur_td, it_per_frame.cur_td);
+                    residuals.push_back(VisualResidual{f,
+                                                       vector<double *>{para_Pose[imu_i], para_Pose[imu_j], para_Ex_Pose[cam * 2], para_Ex_Pose[cam * 2 + 1], para_Feature[cam][feature_index], para_Td[0]},
+                                                       vector<int>{0, 4}});
+                }
+                else
+                {
+                    ProjectionOneFrameTwoCamFactor *f = new ProjectionOneFrameTwoCamFactor(pts_i, pts_j_right, it_per_id.feature_per_frame[0].velocity, it_per_frame.velocityRight,
+                                                                it_per_id.feature_per_frame[0].cur_td, it_per_frame.cur_td);
+                    residuals.push_back(VisualResidual{f,
+                                                       vector<double *>{para_Ex_Pose[cam * 2], para_Ex_Pose[cam * 2 + 1], para_Feature[cam][feature_index], para_Td[0]},
+                                                       vector<int>{2}});
+                }
+            }
+            obs_cnt++;
+        }
+    }
+    return obs_cnt;
+}
+
 void Estimator::optimization()
 {
     TicToc t_whole, t_prepare;
@@ -1512,28 +1684,32 @@ void Estimator::optimization()
             // cerr << "size of gnss_meas_buf[" << i << "] is " << gnss_meas_buf[i].size() << endl;
             const std::vector<ObsPtr> &curr_obs = gnss_meas_buf[i];
             const std::vector<EphemBasePtr> &curr_ephem = gnss_ephem_buf[i];
+            const std::vector<SatStatePtr> &curr_sat_state = gnss_sat_state_buf[i];
+            if (curr_obs.empty())
+                continue;
 
-            for (uint32_t j = 0; j < curr_obs.size(); ++j)
-            {
-                const uint32_t sys = satsys(curr_obs[j]->sat, NULL);
-                const uint32_t sys_idx = gnss_comm::sys2idx.at(sys);
-
-                int lower_idx = -1;
-                const double obs_local_ts = time2sec(curr_obs[j]->time) - diff_t_gnss_local;
-                if (Headers[i] > obs_local_ts)
-                    lower_idx = (i==0? 0 : i-1);
-                else
-                    lower_idx = (i==WINDOW_SIZE? WINDOW_SIZE-1 : i);
-                const double lower_ts = Headers[lower_idx];
-                const double upper_ts = Headers[lower_idx+1];
-
-                const double ts_ratio = (upper_ts-obs_local_ts) / (upper_ts-lower_ts);
-                GnssPsrDoppFactor *gnss_factor = new GnssPsrDoppFactor(curr_obs[j], 
-                    curr_ephem[j], latest_gnss_iono_params, ts_ratio);
-                problem.AddResidualBlock(gnss_factor, NULL, para_Pose[lower_idx], 
-                    para_SpeedBias[lower_idx], para_Pose[lower_idx+1], para_SpeedBias[lower_idx+1],
-                    para_rcv_dt+i*4+sys_idx, para_rcv_ddt+i, para_yaw_enu_local, para_anc_ecef);
-            }
+            // all satellites of one epoch share the same timestamp
+            int lower_idx = -1;
+            const double obs_local_ts = time2sec(curr_obs[0]->time) - diff_t_gnss_local;
+            if (Headers[i] > obs_local_ts)
+                lower_idx = (i==0? 0 : i-1);
+            else
+                lower_idx = (i==WINDOW_SIZE? WINDOW_SIZE-1 : i);
+            const double lower_ts = Headers[lower_idx];
+            const double upper_ts = Headers[lower_idx+1];
+
+            const double ts_ratio = (upper_ts-obs_local_ts) / (upper_ts-lower_ts);
+            GnssPsrDoppEpochFactor *gnss_factor = new GnssPsrDoppEpochFactor(curr_obs, 
+                curr_ephem, curr_sat_state, latest_gnss_iono_params, ts_ratio);
+            vector<double *> gnss_parameter_blocks{para_Pose[lower_idx], para_SpeedBias[lower_idx], 
+                para_Pose[lower_idx+1], para_SpeedBias[lower_idx+1]};
+            for (uint32_t sys_idx : gnss_factor->observed_sys())
+                gnss_parameter_blocks.push_back(para_rcv_dt+i*4+sys_idx);
+            gnss_parameter_blocks.push_back(para_rcv_ddt+i);
+            gnss_parameter_blocks.push_back(para_yaw_enu_local);
+            gnss_parameter_blocks.push_back(para_anc_ecef);
+            gnss_factor->update_atmos_delay(gnss_parameter_blocks.data());
+            problem.AddResidualBlock(gnss_factor, NULL, gnss_parameter_blocks);
         }
 
         // build relationship between rcv_dt and rcv_ddt
@@ -1556,53 +1732,22 @@ void Estimator::optimization()
         }
     }
 
+    // the residuals of each camera unit only touch its own features, so they are built in
+    // parallel and only the assembly into the problem is serialized
+    vector<vector<VisualResidual>> unit_residuals(NUM_OF_CAM_UNIT);
+    vector<int> unit_obs_cnt(NUM_OF_CAM_UNIT, 0);
+    cv::parallel_for_(cv::Range(0, NUM_OF_CAM_UNIT), [&](const cv::Range &range)
+    {
+        for (int cam = range.start; cam < range.end; ++cam)
+            unit_obs_cnt[cam] = collectVisualResiduals(cam, false, unit_residuals[cam]);
+    });
+
     int f_m_cnt = 0;
     for (int cam = 0; cam < NUM_OF_CAM_UNIT; ++cam)
     {
-        int feature_index = -1;
-        for (auto &it_per_id : f_managers[cam]->feature)
-        {
-            it_per_id.used_num = it_per_id.feature_per_frame.size();
-            if (it_per_id.used_num < 4)
-                continue;
-    
-            ++feature_index;
-
-            int imu_i = it_per_id.start_frame, imu_j = imu_i - 1;
-            
-            Vector3d pts_i = it_per_id.feature_per_frame[0].point;
-
-            for (auto &it_per_frame : it_per_id.feature_per_frame)
-            {
-                imu_j++;
-                if (imu_i != imu_j)
-                {
-                    Vector3d pts_j = it_per_frame.point;
-                    ProjectionTwoFrameOneCamFactor *f_td = new ProjectionTwoFrameOneCamFactor(pts_i, pts_j, it_per_id.feature_per_frame[0].velocity, it_per_frame.velocity,
-                                                                    it_per_id.feature_per_frame[0].cur_td, it_per_frame.cur_td);
-                    problem.AddResidualBlock(f_td, loss_function, para_Pose[imu_i], para_Pose[imu_j], para_Ex_Pose[cam * 2], para_Feature[cam][feature_index], para_Td[0]);
-                }
-
-                if(STEREO && it_per_frame.is_stereo)
-                {                
-                    Vector3d pts_j_right = it_per_frame.pointRight;
-                    if(imu_i != imu_j)
-                    {
-                        ProjectionTwoFrameTwoCamFactor *f = new ProjectionTwoFrameTwoCamFactor(pts_i, pts_j_right, it_per_id.feature_per_frame[0].velocity, it_per_frame.velocityRight,
-                                                                    it_per_id.feature_per_frame[0].cur_td, it_per_frame.cur_td);
-                        problem.AddResidualBlock(f, loss_function, para_Pose[imu_i], para_Pose[imu_j], para_Ex_Pose[cam * 2], para_Ex_Pose[cam * 2 + 1], para_Feature[cam][feature_index], para_Td[0]);
-                    }
-                    else
-                    {
-                        ProjectionOneFrameTwoCamFactor *f = new ProjectionOneFrameTwoCamFactor(pts_i, pts_j_right, it_per_id.feature_per_frame[0].velocity, it_per_frame.velocityRight,
-                                                                    it_per_id.feature_per_frame[0].cur_td, it_per_frame.cur_td);
-                        problem.AddResidualBlock(f, loss_function, para_Ex_Pose[cam * 2], para_Ex_Pose[cam * 2 + 1], para_Feature[cam][feature_index], para_Td[0]);
-                    }
-                
-                }
-                f_m_cnt++;
-            }
-        }
+        for (auto &residual : unit_residuals[cam])
+            problem.AddResidualBlock(residual.cost_function, loss_function, residual.parameter_blocks);
+        f_m_cnt += unit_obs_cnt[cam];
     }
     
     ROS_DEBUG("visual measurement count: %d", f_m_cnt);
@@ -1685,23 +1830,29 @@ void Estimator::optimization()
 
         if (gnss_ready)
         {
-            for (uint32_t j = 0; j < gnss_meas_buf[0].size(); ++j)
+            if (!gnss_meas_buf[0].empty())
             {
-                const uint32_t sys = satsys(gnss_meas_buf[0][j]->sat, NULL);
-                const uint32_t sys_idx = gnss_comm::sys2idx.at(sys);
-
-                const double obs_local_ts = time2sec(gnss_meas_buf[0][j]->time) - diff_t_gnss_local;
+                const double obs_local_ts = time2sec(gnss_meas_buf[0][0]->time) - diff_t_gnss_local;
                 const double lower_ts = Headers[0];
                 const double upper_ts = Headers[1];
                 const double ts_ratio = (upper_ts-obs_local_ts) / (upper_ts-lower_ts);
 
-                GnssPsrDoppFactor *gnss_factor = new GnssPsrDoppFactor(gnss_meas_buf[0][j], 
-                    gnss_ephem_buf[0][j], latest_gnss_iono_params, ts_ratio);
+                GnssPsrDoppEpochFactor *gnss_factor = new GnssPsrDoppEpochFactor(gnss_meas_buf[0], 
+                    gnss_ephem_buf[0], gnss_sat_state_buf[0], latest_gnss_iono_params, ts_ratio);
+                vector<double *> gnss_parameter_blocks{para_Pose[0], para_SpeedBias[0], para_Pose[1], para_SpeedBias[1]};
+                vector<int> gnss_drop_set{0, 1};
+                for (uint32_t sys_idx : gnss_factor->observed_sys())
+                {
+                    gnss_drop_set.push_back(gnss_parameter_blocks.size());
+                    gnss_parameter_blocks.push_back(para_rcv_dt+sys_idx);
+                }
+                gnss_drop_set.push_back(gnss_parameter_blocks.size());
+                gnss_parameter_blocks.push_back(para_rcv_ddt);
+                gnss_parameter_blocks.push_back(para_yaw_enu_local);
+                gnss_parameter_blocks.push_back(para_anc_ecef);
+                gnss_factor->update_atmos_delay(gnss_parameter_blocks.data());
                 ResidualBlockInfo *psr_dopp_residual_block_info = new ResidualBlockInfo(gnss_factor, NULL,
-                    vector<double *>{para_Pose[0], para_SpeedBias[0], para_Pose[1], 
-                        para_SpeedBias[1],para_rcv_dt+sys_idx, para_rcv_ddt, 
-                        para_yaw_enu_local, para_anc_ecef},
-                    vector<int>{0, 1, 4, 5});
+                    gnss_parameter_blocks, gnss_drop_set);
                 marginalization_info->addResidualBlockInfo(psr_dopp_residual_block_info);
             }
 
@@ -1722,59 +1873,19 @@ void Estimator::optimization()
             marginalization_info->addResidualBlockInfo(ddt_smooth_residual_block_info);
         }
 
+        vector<vector<VisualResidual>> unit_residuals(NUM_OF_CAM_UNIT);
+        cv::parallel_for_(cv::Range(0, NUM_OF_CAM_UNIT), [&](const cv::Range &range)
+        {
+            for (int cam = range.start; cam < range.end; ++cam)
+                collectVisualResiduals(cam, true, unit_residuals[cam]);
+        });
         for (int cam = 0; cam < NUM_OF_CAM_UNIT; ++cam)
         {
-            int feature_index = -1;
-            for (auto &it_per_id : f_managers[cam]->feature)
+            for (auto &residual : unit_residuals[cam])
             {
-                it_per_id.used_num = it_per_id.feature_per_frame.size();
-                if (it_per_id.used_num < 4)
-                    continue;
-
-                ++feature_index;
-
-                int imu_i = it_per_id.start_frame, imu_j = imu_i - 1;
-                if (imu_i != 0)
-                    continue;
-
-                Vector3d pts_i = it_per_id.feature_per_frame[0].point;
-
-                for (auto &it_per_frame : it_per_id.feature_per_frame)
-                {
-                    imu_j++;
-                    if(imu_i != imu_j)
-                    {
-                        Vector3d pts_j = it_per_frame.point;
-                        ProjectionTwoFrameOneCamFactor *f_td = new ProjectionTwoFrameOneCamFactor(pts_i, pts_j, it_per_id.feature_per_frame[0].velocity, it_per_frame.velocity,
-                                                                          it_per_id.feature_per_frame[0].cur_td, it_per_frame.cur_td);
-                        ResidualBlockInfo *residual_block_info = new ResidualBlockInfo(f_td, loss_function,
-                                                                                        vector<double *>{para_Pose[imu_i], para_Pose[imu_j], para_Ex_Pose[cam * 2], para_Feature[cam][feature_index], para_Td[0]},
-                                                                                        vector<int>{0, 3});
-                        marginalization_info->addResidualBlockInfo(residual_block_info);
-                    }
-                    if(STEREO && it_per_frame.is_stereo)
-                    {
-                        Vector3d pts_j_right = it_per_frame.pointRight;
-                        if(imu_i != imu_j)
-                        {
-                            ProjectionTwoFrameTwoCamFactor *f = new ProjectionTwoFrameTwoCamFactor(pts_i, pts_j_right, it_per_id.feature_per_frame[0].velocity, it_per_frame.velocityRight,
-                                                                          it_per_id.feature_per_frame[0].cur_td, it_per_frame.cur_td);
-                            ResidualBlockInfo *residual_block_info = new ResidualBlockInfo(f, loss_function,
-                                                                                           vector<double *>{para_Pose[imu_i], para_Pose[imu_j], para_Ex_Pose[cam * 2], para_Ex_Pose[cam * 2 + 1], para_Feature[cam][feature_index], para_Td[0]},
-                                                                                           vector<int>{0, 4});
-                            marginalization_info->addResidualBlockInfo(residual_block_info);
-                        }
-                        else
-                        {
-                            ProjectionOneFrameTwoCamFactor *f = new ProjectionOneFrameTwoCamFactor(pts_i, pts_j_right, it_per_id.feature_per_frame[0].velocity, it_per_frame.velocityRight,
-                                                                          it_per_id.feature_per_frame[0].cur_td, it_per_frame.cur_td);
-                            ResidualBlockInfo *residual_block_info = new ResidualBlockInfo(f, loss_function,
-                                                                                           vector<double *>{para_Ex_Pose[cam * 2], para_Ex_Pose[cam * 2 + 1], para_Feature[cam][feature_index], para_Td[0]},
-                                                                                           vector<int>{2});
-                            marginalization_info->addResidualBlockInfo(residual_block_info);
-                        }
-                    }
-                }
+                ResidualBlockInfo *residual_block_info = new ResidualBlockInfo(residual.cost_function, loss_function,
+                                                                               residual.parameter_blocks, residual.drop_set);
+                marginalization_info->addResidualBlockInfo(residual_block_info);
             }
         }
 
@@ -1922,6 +2033,7 @@ void Estimator::slideWindow()
                 // GNSS related
                 gnss_meas_buf[i].swap(gnss_meas_buf[i+1]);
                 gnss_ephem_buf[i].swap(gnss_ephem_buf[i+1]);
+                gnss_sat_state_buf[i].swap(gnss_sat_state_buf[i+1]);
                 for (uint32_t k = 0; k < 4; ++k)
                     para_rcv_dt[i*4+k] = para_rcv_dt[(i+1)*4+k];
                 para_rcv_ddt[i] = para_rcv_ddt[i+1];
@@ -1933,6 +2045,7 @@ void Estimator::slideWindow()
             // GNSS related
             gnss_meas_buf[WINDOW_SIZE].clear();
             gnss_ephem_buf[WINDOW_SIZE].clear();
+            gnss_sat_state_buf[WINDOW_SIZE].clear();
 
             if(USE_IMU)
             {
@@ -1998,11 +2111,13 @@ void Estimator::slideWindow()
                 // GNSS related
                 gnss_meas_buf[frame_count-1] = gnss_meas_buf[frame_count];
                 gnss_ephem_buf[frame_count-1] = gnss_ephem_buf[frame_count];
+                gnss_sat_state_buf[frame_count-1] = gnss_sat_state_buf[frame_count];
                 for (uint32_t k = 0; k < 4; ++k)
                     para_rcv_dt[(frame_count-1)*4+k] = para_rcv_dt[frame_count*4+k];
                 para_rcv_ddt[frame_count-1] = para_rcv_ddt[frame_count];
                 gnss_meas_buf[frame_count].clear();
                 gnss_ephem_buf[frame_count].clear();
+                gnss_sat_state_buf[frame_count].clear();
 
                 delete pre_integrations[WINDOW_SIZE];
                 if (ENCODER_ENABLE)
@@ -2115,60 +2230,75 @@ double Estimator::reprojectionError(Matrix3d &Ri, Vector3d &Pi, Matrix3d &rici,
 void Estimator::outliersRejection(int cam, set<int> &removeIndex)
 {
     //return;
-    int feature_index = -1;
+    vector<FeaturePerId *> candidates;
     for (auto &it_per_id : f_managers[cam]->feature)
     {
-        double err = 0;
-        int errCnt = 0;
         it_per_id.used_num = it_per_id.feature_per_frame.size();
-        if (it_per_id.used_num < 4)
-            continue;
-        feature_index ++;
-        int imu_i = it_per_id.start_frame, imu_j = imu_i - 1;
-        Vector3d pts_i = it_per_id.feature_per_frame[0].point;
-        double depth = it_per_id.estimated_depth;
-        for (auto &it_per_frame : it_per_id.feature_per_frame)
+        if (it_per_id.used_num >= 4)
+            candidates.push_back(&it_per_id);
+    }
+
+    // the reprojection errors of each feature are independent, check them in chunks
+    vector<char> is_outlier(candidates.size(), 0);
+    cv::parallel_for_(cv::Range(0, candidates.size()), [&](const cv::Range &range)
+    {
+        for (int k = range.start; k < range.end; ++k)
         {
-            imu_j++;
-            if (imu_i != imu_j)
-            {
-                Vector3d pts_j = it_per_frame.point;             
-                double tmp_error = reprojectionError(Rs[imu_i], Ps[imu_i], ric[cam * 2], tic[cam * 2], 
-                                                    Rs[imu_j], Ps[imu_j], ric[cam * 2], tic[cam * 2],
-                                                    depth, pts_i, pts_j);
-                err += tmp_error;
-                errCnt++;
-                //printf("tmp_error %f\n", FOCAL_LENGTH / 1.5 * tmp_error);
-            }
-            // need to rewrite projecton factor.........
-            if(STEREO && it_per_frame.is_stereo)
+            FeaturePerId &it_per_id = *candidates[k];
+            double err = 0;
+            int errCnt = 0;
+            int imu_i = it_per_id.start_frame, imu_j = imu_i - 1;
+            Vector3d pts_i = it_per_id.feature_per_frame[0].point;
+            double depth = it_per_id.estimated_depth;
+            for (auto &it_per_frame : it_per_id.feature_per_frame)
             {
-                
-                Vector3d pts_j_right = it_per_frame.pointRight;
-                if(imu_i != imu_j)
-                {            
+                imu_j++;
+                if (imu_i != imu_j)
+                {
+                    Vector3d pts_j = it_per_frame.point;             
                     double tmp_error = reprojectionError(Rs[imu_i], Ps[imu_i], ric[cam * 2], tic[cam * 2], 
-                                                        Rs[imu_j], Ps[imu_j], ric[cam * 2 + 1], tic[cam * 2 + 1],
-                                                        depth, pts_i, pts_j_right);
+                                                        Rs[imu_j], Ps[imu_j], ric[cam * 2], tic[cam * 2],
+                                                        depth, pts_i, pts_j);
                     err += tmp_error;
                     errCnt++;
                     //printf("tmp_error %f\n", FOCAL_LENGTH / 1.5 * tmp_error);
                 }
-                else
+                // need to rewrite projecton factor.........
+                if(STEREO && it_per_frame.is_stereo)
                 {
-                    double tmp_error = reprojectionError(Rs[imu_i], Ps[imu_i], ric[cam * 2], tic[cam * 2], 
-                                                        Rs[imu_j], Ps[imu_j], ric[cam * 2 + 1], tic[cam * 2 + 1],
-                                                        depth, pts_i, pts_j_right);
-                    err += tmp_error;
-                    errCnt++;
-                    //printf("tmp_error %f\n", FOCAL_LENGTH / 1.5 * tmp_error);
-                }       
+                
+                    Vector3d pts_j_right = it_per_frame.pointRight;
+                    if(imu_i != imu_j)
+                    {            
+                        double tmp_error = reprojectionError(Rs[imu_i], Ps[imu_i], ric[cam * 2], tic[cam * 2], 
+                                                            Rs[imu_j], Ps[imu_j], ric[cam * 2 + 1], tic[cam * 2 + 1],
+                                                            depth, pts_i, pts_j_right);
+                        err += tmp_error;
+                        errCnt++;
+                        //printf("tmp_error %f\n", FOCAL_LENGTH / 1.5 * tmp_error);
+                    }
+                    else
+                    {
+                        double tmp_error = reprojectionError(Rs[imu_i], Ps[imu_i], ric[cam * 2], tic[cam * 2], 
+                                                            Rs[imu_j], Ps[imu_j], ric[cam * 2 + 1], tic[cam * 2 + 1],
+                                                            depth, pts_i, pts_j_right);
+                        err += tmp_error;
+                        errCnt++;
+                        //printf("tmp_error %f\n", FOCAL_LENGTH / 1.5 * tmp_error);
+                    }       
+                }
             }
+            double ave_err = err / errCnt;
+            if(ave_err * FOCAL_LENGTH > 3)
+                is_outlier[k] = 1;
+
         }
-        double ave_err = err / errCnt;
-        if(ave_err * FOCAL_LENGTH > 3)
-            removeIndex.insert(it_per_id.feature_id);
+    }, std::max(1.0, candidates.size() / (double)FEATURE_CHUNK_SIZE));
 
+    for (size_t k = 0; k < candidates.size(); ++k)
+    {
+        if (is_outlier[k])
+            removeIndex.insert(candidates[k]->feature_id);
     }
 }
 
@@ -38,6 +38,7 @@
 #include "../factor/projectionTwoFrameTwoCamFactor.h"
 #include "../factor/projectionOneFrameTwoCamFactor.h"
 #include "../factor/gnss_psr_dopp_factor.hpp"
+#include "../factor/gnss_psr_dopp_epoch_factor.hpp"
 #include "../factor/gnss_dt_ddt_factor.hpp"
 #include "../factor/gnss_dt_anchor_factor.hpp"
 #include "../factor/gnss_ddt_smooth_factor.hpp"
@@ -83,6 +84,14 @@ class Estimator
     void slideWindow();
     void slideWindowNew();
     void slideWindowOld();
+    // visual residual of one feature observation, built per camera unit and added to the problem serially
+    struct VisualResidual
+    {
+        ceres::CostFunction *cost_function;
+        vector<double *> parameter_blocks;
+        vector<int> drop_set;
+    };
+    int collectVisualResiduals(int cam, bool marginalize, vector<VisualResidual> &residuals);
     void optimization();
     void vector2double();
     void double2vector();
@@ -92,6 +101,7 @@ class Estimator
     void getPoseInWorldFrame(Eigen::Matrix4d &T);
     void getPoseInWorldFrame(int index, Eigen::Matrix4d &T);
     void predictPtsInNextFrame();
+    void triangulateUnits();
     void outliersRejection(int cam, set<int> &removeIndex);
     double reprojectionError(Matrix3d &Ri, Vector3d &Pi, Matrix3d &rici, Vector3d &tici,
                                      Matrix3d &Rj, Vector3d &Pj, Matrix3d &ricj, Vector3d &ticj, 
@@ -101,9 +111,26 @@ class Estimator
     void initFirstIMUPose(vector<pair<double, shared_ptr<Vector3d>>> &accVector);
 
     // GNSS related
+    struct GNSSVIAlignJob
+    {
+        std::vector<std::vector<ObsPtr>> meas_buf;
+        std::vector<std::vector<EphemBasePtr>> ephem_buf;
+        std::vector<std::vector<SatStatePtr>> sat_state_buf;
+        std::vector<double> iono_params;
+        std::vector<Eigen::Vector3d> local_ps, local_vs;
+        double headers[(WINDOW_SIZE+1)];
+        bool success;
+        Eigen::Matrix<double, 7, 1> rough_xyzt, refined_xyzt;
+        double aligned_yaw, aligned_rcv_ddt;
+    };
     bool GNSSVIAlign();
+    void runGNSSVIAlign(shared_ptr<GNSSVIAlignJob> job);
+    bool applyGNSSVIAlign(const GNSSVIAlignJob &job);
+    void stopGNSSVIAlign();
     void updateGNSSStatistics();
     void inputEphem(EphemBasePtr ephem_ptr);
+    EphemBasePtr selectEphem(const uint32_t sat, const double obs_time) const;
+    void pruneEphem(const double obs_time);
     void inputIonoParams(double ts, const std::vector<double> &iono_params);
     void inputGNSSTimeDiff(const double t_diff);
 
@@ -148,6 +175,7 @@ class Estimator
 
     std::thread trackThread;
     std::thread processThread;
+    std::thread gnssAlignThread;
 
     vector<shared_ptr<FeatureTracker>> featureTrackers;
 
@@ -180,14 +208,17 @@ class Estimator
 
     // GNSS related
     bool gnss_ready;
+    atomic<bool> gnss_align_running;
+    shared_ptr<GNSSVIAlignJob> gnss_align_job;
     Eigen::Vector3d anc_ecef;
     Eigen::Matrix3d R_ecef_enu;
     double yaw_enu_local;
     std::vector<ObsPtr> gnss_meas_buf[(WINDOW_SIZE+1)];
     std::vector<EphemBasePtr> gnss_ephem_buf[(WINDOW_SIZE+1)];
+    std::vector<SatStatePtr> gnss_sat_state_buf[(WINDOW_SIZE+1)];     // satellite pos/vel/clock at transmission time
     std::vector<double> latest_gnss_iono_params;
-    std::map<uint32_t, std::vector<EphemBasePtr>> sat2ephem;
-    std::map<uint32_t, std::map<double, size_t>> sat2time_index;
+    std::map<uint32_t, std::map<double, EphemBasePtr>> sat2ephem;     // sat -> (toe -> ephemeris)
+    std::mutex mEphem;
     std::map<uint32_t, uint32_t> sat_track_status;
     double para_anc_ecef[3];
     double para_yaw_enu_local[1];
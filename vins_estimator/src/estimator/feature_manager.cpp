@@ -200,6 +200,25 @@ void FeatureManager::triangulatePoint(Eigen::Matrix<double, 3, 4> &Pose0, Eigen:
 }
 
 
+// Closed-form two-view triangulation, the midpoint of the closest points of both rays.
+// R, t are camera to world. Returns false when the rays are close to parallel.
+bool FeatureManager::triangulatePointMidpoint(const Matrix3d &R0, const Vector3d &t0, const Matrix3d &R1, const Vector3d &t1,
+                                              const Vector2d &point0, const Vector2d &point1, Vector3d &point_3d)
+{
+    Vector3d d0 = R0 * Vector3d(point0.x(), point0.y(), 1.0);
+    Vector3d d1 = R1 * Vector3d(point1.x(), point1.y(), 1.0);
+    Vector3d w = t0 - t1;
+    double a = d0.dot(d0), b = d0.dot(d1), c = d1.dot(d1);
+    double d = d0.dot(w), e = d1.dot(w);
+    double denom = a * c - b * b;
+    if (denom < 1e-10 * a * c)
+        return false;
+    double s0 = (b * e - c * d) / denom;
+    double s1 = (a * e - b * d) / denom;
+    point_3d = 0.5 * (t0 + s0 * d0 + t1 + s1 * d1);
+    return true;
+}
+
 bool FeatureManager::solvePoseByPnP(Eigen::Matrix3d &R, Eigen::Vector3d &P, 
                                       vector<cv::Point2f> &pts2D, vector<cv::Point3f> &pts3D)
 {
@@ -289,133 +308,147 @@ void FeatureManager::initFramePoseByPnP(int frameCnt, Vector3d Ps[], Matrix3d Rs
 
 void FeatureManager::triangulate(int frameCnt, Vector3d Ps[], Matrix3d Rs[], Vector3d tic[], Matrix3d ric[])
 {
+    // features are independent, they are triangulated in chunks on the opencv thread pool
+    vector<FeaturePerId *> pending;
+    pending.reserve(feature.size());
     for (auto &it_per_id : feature)
     {
-        if (it_per_id.estimated_depth > 0)
-            continue;
+        if (!(it_per_id.estimated_depth > 0))
+            pending.push_back(&it_per_id);
+    }
 
-        if(STEREO && it_per_id.feature_per_frame[0].is_stereo)
-        {
-            int imu_i = it_per_id.start_frame;
-            Eigen::Matrix<double, 3, 4> leftPose;
-            Eigen::Vector3d t0 = Ps[imu_i] + Rs[imu_i] * tic[cam_id * 2];
-            Eigen::Matrix3d R0 = Rs[imu_i] * ric[cam_id * 2];
-            leftPose.leftCols<3>() = R0.transpose();
-            leftPose.rightCols<1>() = -R0.transpose() * t0;
-            //cout << "left pose " << leftPose << endl;
-
-            Eigen::Matrix<double, 3, 4> rightPose;
-            Eigen::Vector3d t1 = Ps[imu_i] + Rs[imu_i] * tic[cam_id * 2 + 1];
-            Eigen::Matrix3d R1 = Rs[imu_i] * ric[cam_id * 2 + 1];
-            rightPose.leftCols<3>() = R1.transpose();
-            rightPose.rightCols<1>() = -R1.transpose() * t1;
-            //cout << "right pose " << rightPose << endl;
-
-            Eigen::Vector2d point0, point1;
-            Eigen::Vector3d point3d;
-            point0 = it_per_id.feature_per_frame[0].point.head(2);
-            point1 = it_per_id.feature_per_frame[0].pointRight.head(2);
-            //cout << "point0 " << point0.transpose() << endl;
-            //cout << "point1 " << point1.transpose() << endl;
+    cv::parallel_for_(cv::Range(0, pending.size()), [&](const cv::Range &range)
+    {
+        for (int i = range.start; i < range.end; ++i)
+            triangulateFeature(*pending[i], Ps, Rs, tic, ric);
+    }, std::max(1.0, pending.size() / (double)FEATURE_CHUNK_SIZE));
+}
 
+void FeatureManager::triangulateFeature(FeaturePerId &it_per_id, Vector3d Ps[], Matrix3d Rs[], Vector3d tic[], Matrix3d ric[])
+{
+    if(STEREO && it_per_id.feature_per_frame[0].is_stereo)
+    {
+        int imu_i = it_per_id.start_frame;
+        Eigen::Matrix<double, 3, 4> leftPose;
+        Eigen::Vector3d t0 = Ps[imu_i] + Rs[imu_i] * tic[cam_id * 2];
+        Eigen::Matrix3d R0 = Rs[imu_i] * ric[cam_id * 2];
+        leftPose.leftCols<3>() = R0.transpose();
+        leftPose.rightCols<1>() = -R0.transpose() * t0;
+        //cout << "left pose " << leftPose << endl;
+
+        Eigen::Matrix<double, 3, 4> rightPose;
+        Eigen::Vector3d t1 = Ps[imu_i] + Rs[imu_i] * tic[cam_id * 2 + 1];
+        Eigen::Matrix3d R1 = Rs[imu_i] * ric[cam_id * 2 + 1];
+        rightPose.leftCols<3>() = R1.transpose();
+        rightPose.rightCols<1>() = -R1.transpose() * t1;
+        //cout << "right pose " << rightPose << endl;
+
+        Eigen::Vector2d point0, point1;
+        Eigen::Vector3d point3d;
+        point0 = it_per_id.feature_per_frame[0].point.head(2);
+        point1 = it_per_id.feature_per_frame[0].pointRight.head(2);
+        //cout << "point0 " << point0.transpose() << endl;
+        //cout << "point1 " << point1.transpose() << endl;
+
+        if (!triangulatePointMidpoint(R0, t0, R1, t1, point0, point1, point3d))
             triangulatePoint(leftPose, rightPose, point0, point1, point3d);
-            Eigen::Vector3d localPoint;
-            localPoint = leftPose.leftCols<3>() * point3d + leftPose.rightCols<1>();
-            double depth = localPoint.z();
-            if (depth > 0)
-                it_per_id.estimated_depth = depth;
-            else
-                it_per_id.estimated_depth = INIT_DEPTH;
-            /*
-            Vector3d ptsGt = pts_gt[it_per_id.feature_id];
-            printf("stereo %d pts: %f %f %f gt: %f %f %f \n",it_per_id.feature_id, point3d.x(), point3d.y(), point3d.z(),
-                                                            ptsGt.x(), ptsGt.y(), ptsGt.z());
-            */
-            continue;
-        }
-        else if(it_per_id.feature_per_frame.size() > 1)
-        {
-            int imu_i = it_per_id.start_frame;
-            Eigen::Matrix<double, 3, 4> leftPose;
-            Eigen::Vector3d t0 = Ps[imu_i] + Rs[imu_i] * tic[cam_id * 2];
-            Eigen::Matrix3d R0 = Rs[imu_i] * ric[cam_id * 2];
-            leftPose.leftCols<3>() = R0.transpose();
-            leftPose.rightCols<1>() = -R0.transpose() * t0;
-
-            imu_i++;
-            Eigen::Matrix<double, 3, 4> rightPose;
-            Eigen::Vector3d t1 = Ps[imu_i] + Rs[imu_i] * tic[cam_id * 2];
-            Eigen::Matrix3d R1 = Rs[imu_i] * ric[cam_id * 2];
-            rightPose.leftCols<3>() = R1.transpose();
-            rightPose.rightCols<1>() = -R1.transpose() * t1;
-
-            Eigen::Vector2d point0, point1;
-            Eigen::Vector3d point3d;
-            point0 = it_per_id.feature_per_frame[0].point.head(2);
-            point1 = it_per_id.feature_per_frame[1].point.head(2);
+        Eigen::Vector3d localPoint;
+        localPoint = leftPose.leftCols<3>() * point3d + leftPose.rightCols<1>();
+        double depth = localPoint.z();
+        if (depth > 0)
+            it_per_id.estimated_depth = depth;
+        else
+            it_per_id.estimated_depth = INIT_DEPTH;
+        /*
+        Vector3d ptsGt = pts_gt[it_per_id.feature_id];
+        printf("stereo %d pts: %f %f %f gt: %f %f %f \n",it_per_id.feature_id, point3d.x(), point3d.y(), point3d.z(),
+                                                        ptsGt.x(), ptsGt.y(), ptsGt.z());
+        */
+        return;
+    }
+    else if(it_per_id.feature_per_frame.size() > 1)
+    {
+        int imu_i = it_per_id.start_frame;
+        Eigen::Matrix<double, 3, 4> leftPose;
+        Eigen::Vector3d t0 = Ps[imu_i] + Rs[imu_i] * tic[cam_id * 2];
+        Eigen::Matrix3d R0 = Rs[imu_i] * ric[cam_id * 2];
+        leftPose.leftCols<3>() = R0.transpose();
+        leftPose.rightCols<1>() = -R0.transpose() * t0;
+
+        imu_i++;
+        Eigen::Matrix<double, 3, 4> rightPose;
+        Eigen::Vector3d t1 = Ps[imu_i] + Rs[imu_i] * tic[cam_id * 2];
+        Eigen::Matrix3d R1 = Rs[imu_i] * ric[cam_id * 2];
+        rightPose.leftCols<3>() = R1.transpose();
+        rightPose.rightCols<1>() = -R1.transpose() * t1;
+
+        Eigen::Vector2d point0, point1;
+        Eigen::Vector3d point3d;
+        point0 = it_per_id.feature_per_frame[0].point.head(2);
+        point1 = it_per_id.feature_per_frame[1].point.head(2);
+        if (!triangulatePointMidpoint(R0, t0, R1, t1, point0, point1, point3d))
             triangulatePoint(leftPose, rightPose, point0, point1, point3d);
-            Eigen::Vector3d localPoint;
-            localPoint = leftPose.leftCols<3>() * point3d + leftPose.rightCols<1>();
-            double depth = localPoint.z();
-            if (depth > 0)
-                it_per_id.estimated_depth = depth;
-            else
-                it_per_id.estimated_depth = INIT_DEPTH;
-            /*
-            Vector3d ptsGt = pts_gt[it_per_id.feature_id];
-            printf("motion  %d pts: %f %f %f gt: %f %f %f \n",it_per_id.feature_id, point3d.x(), point3d.y(), point3d.z(),
-                                                            ptsGt.x(), ptsGt.y(), ptsGt.z());
-            */
-            continue;
-        }
-        it_per_id.used_num = it_per_id.feature_per_frame.size();
-        if (it_per_id.used_num < 4)
-            continue;
+        Eigen::Vector3d localPoint;
+        localPoint = leftPose.leftCols<3>() * point3d + leftPose.rightCols<1>();
+        double depth = localPoint.z();
+        if (depth > 0)
+            it_per_id.estimated_depth = depth;
+        else
+            it_per_id.estimated_depth = INIT_DEPTH;
+        /*
+        Vector3d ptsGt = pts_gt[it_per_id.feature_id];
+        printf("motion  %d pts: %f %f %f gt: %f %f %f \n",it_per_id.feature_id, point3d.x(), point3d.y(), point3d.z(),
+                                                        ptsGt.x(), ptsGt.y(), ptsGt.z());
+        */
+        return;
+    }
+    it_per_id.used_num = it_per_id.feature_per_frame.size();
+    if (it_per_id.used_num < 4)
+        return;
 
-        int imu_i = it_per_id.start_frame, imu_j = imu_i - 1;
+    int imu_i = it_per_id.start_frame, imu_j = imu_i - 1;
 
-        Eigen::MatrixXd svd_A(2 * it_per_id.feature_per_frame.size(), 4);
-        int svd_idx = 0;
+    Eigen::MatrixXd svd_A(2 * it_per_id.feature_per_frame.size(), 4);
+    int svd_idx = 0;
 
-        Eigen::Matrix<double, 3, 4> P0;
-        Eigen::Vector3d t0 = Ps[imu_i] + Rs[imu_i] * tic[cam_id * 2];
-        Eigen::Matrix3d R0 = Rs[imu_i] * ric[cam_id * 2];
-        P0.leftCols<3>() = Eigen::Matrix3d::Identity();
-        P0.rightCols<1>() = Eigen::Vector3d::Zero();
+    Eigen::Matrix<double, 3, 4> P0;
+    Eigen::Vector3d t0 = Ps[imu_i] + Rs[imu_i] * tic[cam_id * 2];
+    Eigen::Matrix3d R0 = Rs[imu_i] * ric[cam_id * 2];
+    P0.leftCols<3>() = Eigen::Matrix3d::Identity();
+    P0.rightCols<1>() = Eigen::Vector3d::Zero();
 
-        for (auto &it_per_frame : it_per_id.feature_per_frame)
-        {
-            imu_j++;
-
-            Eigen::Vector3d t1 = Ps[imu_j] + Rs[imu_j] * tic[cam_id * 2];
-            Eigen::Matrix3d R1 = Rs[imu_j] * ric[cam_id * 2];
-            Eigen::Vector3d t = R0.transpose() * (t1 - t0);
-            Eigen::Matrix3d R = R0.transpose() * R1;
-            Eigen::Matrix<double, 3, 4> P;
-            P.leftCols<3>() = R.transpose();
-            P.rightCols<1>() = -R.transpose() * t;
-            Eigen::Vector3d f = it_per_frame.point.normalized();
-            svd_A.row(svd_idx++) = f[0] * P.row(2) - f[2] * P.row(0);
-            svd_A.row(svd_idx++) = f[1] * P.row(2) - f[2] * P.row(1);
-
-            if (imu_i == imu_j)
-                continue;
-        }
-        ROS_ASSERT(svd_idx == svd_A.rows());
-        Eigen::Vector4d svd_V = Eigen::JacobiSVD<Eigen::MatrixXd>(svd_A, Eigen::ComputeThinV).matrixV().rightCols<1>();
-        double svd_method = svd_V[2] / svd_V[3];
-        //it_per_id->estimated_depth = -b / A;
-        //it_per_id->estimated_depth = svd_V[2] / svd_V[3];
-
-        it_per_id.estimated_depth = svd_method;
-        //it_per_id->estimated_depth = INIT_DEPTH;
+    for (auto &it_per_frame : it_per_id.feature_per_frame)
+    {
+        imu_j++;
+
+        Eigen::Vector3d t1 = Ps[imu_j] + Rs[imu_j] * tic[cam_id * 2];
+        Eigen::Matrix3d R1 = Rs[imu_j] * ric[cam_id * 2];
+        Eigen::Vector3d t = R0.transpose() * (t1 - t0);
+        Eigen::Matrix3d R = R0.transpose() * R1;
+        Eigen::Matrix<double, 3, 4> P;
+        P.leftCols<3>() = R.transpose();
+        P.rightCols<1>() = -R.transpose() * t;
+        Eigen::Vector3d f = it_per_frame.point.normalized();
+        svd_A.row(svd_idx++) = f[0] * P.row(2) - f[2] * P.row(0);
+        svd_A.row(svd_idx++) = f[1] * P.row(2) - f[2] * P.row(1);
+
+        if (imu_i == imu_j)
+            continue;
+    }
+    ROS_ASSERT(svd_idx == svd_A.rows());
+    Eigen::Vector4d svd_V = Eigen::JacobiSVD<Eigen::MatrixXd>(svd_A, Eigen::ComputeThinV).matrixV().rightCols<1>();
+    double svd_method = svd_V[2] / svd_V[3];
+    //it_per_id->estimated_depth = -b / A;
+    //it_per_id->estimated_depth = svd_V[2] / svd_V[3];
 
-        if (it_per_id.estimated_depth < 0.1)
-        {
-            it_per_id.estimated_depth = INIT_DEPTH;
-        }
+    it_per_id.estimated_depth = svd_method;
+    //it_per_id->estimated_depth = INIT_DEPTH;
 
+    if (it_per_id.estimated_depth < 0.1)
+    {
+        it_per_id.estimated_depth = INIT_DEPTH;
     }
+
 }
 
 void FeatureManager::removeOutlier(set<int> &outlierIndex)
@@ -25,6 +25,8 @@ using namespace Eigen;
 #include "parameters.h"
 #include "../utility/tic_toc.h"
 
+#define FEATURE_CHUNK_SIZE 64   // features per parallel_for_ stripe in triangulation and outlier rejection
+
 class FeaturePerFrame
 {
   public:
@@ -95,6 +97,8 @@ class FeatureManager
     void triangulate(int frameCnt, Vector3d Ps[], Matrix3d Rs[], Vector3d tic[], Matrix3d ric[]);
     void triangulatePoint(Eigen::Matrix<double, 3, 4> &Pose0, Eigen::Matrix<double, 3, 4> &Pose1,
                             Eigen::Vector2d &point0, Eigen::Vector2d &point1, Eigen::Vector3d &point_3d);
+    bool triangulatePointMidpoint(const Matrix3d &R0, const Vector3d &t0, const Matrix3d &R1, const Vector3d &t1,
+                                  const Vector2d &point0, const Vector2d &point1, Vector3d &point_3d);
     void initFramePoseByPnP(int frameCnt, Vector3d Ps[], Matrix3d Rs[], Vector3d tic[], Matrix3d ric[]);
     bool solvePoseByPnP(Eigen::Matrix3d &R_initial, Eigen::Vector3d &P_initial, 
                             vector<cv::Point2f> &pts2D, vector<cv::Point3f> &pts3D);
@@ -109,6 +113,7 @@ class FeatureManager
     int long_track_num;
 
   private:
+    void triangulateFeature(FeaturePerId &it_per_id, Vector3d Ps[], Matrix3d Rs[], Vector3d tic[], Matrix3d ric[]);
     double compensatedParallax2(const FeaturePerId &it_per_id, int frame_count);
     const Matrix3d *Rs;
     int cam_id;
@@ -0,0 +1,255 @@
+#include "gnss_psr_dopp_epoch_factor.hpp"
+
+GnssPsrDoppEpochFactor::GnssPsrDoppEpochFactor(const std::vector<ObsPtr> &_obs,
+    const std::vector<EphemBasePtr> &_ephems, const std::vector<SatStatePtr> &_sat_states,
+    std::vector<double> &_iono_paras, const double _ratio)
+        : obs(_obs), iono_paras(_iono_paras), ratio(_ratio)
+{
+    num_sv = obs.size();
+    sv_pos.resize(3, num_sv);
+    sv_vel.resize(3, num_sv);
+    sv_psr_bias.resize(num_sv);
+    sv_dopp_bias.resize(num_sv);
+    psr_meas.resize(num_sv);
+    dopp_meas.resize(num_sv);
+    pr_info.resize(num_sv);
+    dp_info.resize(num_sv);
+    sv_dt_block.resize(num_sv);
+    atmos_delay.setZero(num_sv);
+    sv_sin_el.setOnes(num_sv);
+
+    const double relative_sqrt_info = 10.0;
+    bool sys_observed[4] = {false, false, false, false};
+    std::vector<uint32_t> sv_sys_idx(num_sv);
+    for (uint32_t i = 0; i < num_sv; ++i)
+    {
+        int freq_idx = -1;
+        const double freq = L1_freq(obs[i], &freq_idx);
+        LOG_IF(FATAL, freq < 0) << "No L1 observation found.";
+
+        const uint32_t sys = satsys(obs[i]->sat, NULL);
+        sv_sys_idx[i] = sys2idx.at(sys);
+        sys_observed[sv_sys_idx[i]] = true;
+
+        sv_pos.col(i) = _sat_states[i]->pos;
+        sv_vel.col(i) = _sat_states[i]->vel;
+        sv_psr_bias(i) = (_sat_states[i]->tgd - _sat_states[i]->dt) * LIGHT_SPEED;
+        sv_dopp_bias(i) = -_sat_states[i]->ddt * LIGHT_SPEED;
+        psr_meas(i) = obs[i]->psr[freq_idx];
+        dopp_meas(i) = obs[i]->dopp[freq_idx] * LIGHT_SPEED / freq;
+
+        double pr_uura = 0, dp_uura = 0;
+        if (sys == SYS_GLO)
+        {
+            pr_uura = 2.0 * (obs[i]->psr_std[freq_idx]/0.16);
+            dp_uura = 2.0 * (obs[i]->dopp_std[freq_idx]/0.256);
+        }
+        else
+        {
+            EphemPtr eph = std::dynamic_pointer_cast<Ephem>(_ephems[i]);
+            const double ura_offset = (sys == SYS_GAL ? 2.0 : 1.0);
+            pr_uura = (eph->ura - ura_offset) * (obs[i]->psr_std[freq_idx]/0.16);
+            dp_uura = (eph->ura - ura_offset) * (obs[i]->dopp_std[freq_idx]/0.256);
+        }
+        LOG_IF(FATAL, pr_uura <= 0) << "pr_uura is " << pr_uura;
+        LOG_IF(FATAL, dp_uura <= 0) << "dp_uura is " << dp_uura;
+        pr_info(i) = relative_sqrt_info / pr_uura;
+        dp_info(i) = relative_sqrt_info * PSR_TO_DOPP_RATIO / dp_uura;
+    }
+
+    // one clock bias block per observed system
+    uint32_t sys_block[4];
+    for (uint32_t k = 0; k < 4; ++k)
+    {
+        if (!sys_observed[k])   continue;
+        sys_block[k] = sys_idx_list.size();
+        sys_idx_list.push_back(k);
+    }
+    for (uint32_t i = 0; i < num_sv; ++i)
+        sv_dt_block[i] = sys_block[sv_sys_idx[i]];
+
+    set_num_residuals(2 * num_sv);
+    std::vector<int> *block_sizes = mutable_parameter_block_sizes();
+    block_sizes->push_back(7);
+    block_sizes->push_back(9);
+    block_sizes->push_back(7);
+    block_sizes->push_back(9);
+    for (uint32_t k = 0; k < sys_idx_list.size(); ++k)
+        block_sizes->push_back(1);
+    block_sizes->push_back(1);
+    block_sizes->push_back(1);
+    block_sizes->push_back(3);
+}
+
+void GnssPsrDoppEpochFactor::update_atmos_delay(double const *const *parameters)
+{
+    const uint32_t num_sys = sys_idx_list.size();
+    const double *anc = parameters[6+num_sys];
+    const double yaw_diff = parameters[5+num_sys][0];
+    Eigen::Vector3d ref_ecef(anc[0], anc[1], anc[2]);
+    Eigen::Vector3d local_pos = ratio * Eigen::Map<const Eigen::Vector3d>(parameters[0]) +
+        (1.0-ratio) * Eigen::Map<const Eigen::Vector3d>(parameters[2]);
+    Eigen::Vector3d rcv_ecef = ecef2rotation(ref_ecef) *
+        Eigen::AngleAxisd(yaw_diff, Eigen::Vector3d::UnitZ()) * local_pos + ref_ecef;
+
+    atmos_delay.setZero();
+    sv_sin_el.setOnes();
+    if (rcv_ecef.norm() > 0)
+    {
+        Eigen::Vector3d rcv_lla = ecef2geo(rcv_ecef);
+        for (uint32_t i = 0; i < num_sv; ++i)
+        {
+            double azel[2] = {0, M_PI/2.0};
+            sat_azel(rcv_ecef, sv_pos.col(i), azel);
+            atmos_delay(i) = calculate_trop_delay(obs[i]->time, rcv_lla, azel) +
+                calculate_ion_delay(obs[i]->time, iono_paras, rcv_lla, azel);
+            sv_sin_el(i) = std::sin(azel[1]);
+        }
+    }
+}
+
+bool GnssPsrDoppEpochFactor::Evaluate(double const *const *parameters, double *residuals, double **jacobians) const
+{
+    const uint32_t num_sys = sys_idx_list.size();
+    const uint32_t ddt_block = 4 + num_sys;
+    const uint32_t yaw_block = 5 + num_sys;
+    const uint32_t anc_block = 6 + num_sys;
+
+    Eigen::Vector3d Pi(parameters[0][0], parameters[0][1], parameters[0][2]);
+    Eigen::Vector3d Vi(parameters[1][0], parameters[1][1], parameters[1][2]);
+    Eigen::Vector3d Pj(parameters[2][0], parameters[2][1], parameters[2][2]);
+    Eigen::Vector3d Vj(parameters[3][0], parameters[3][1], parameters[3][2]);
+    double rcv_ddt = parameters[ddt_block][0];
+    double yaw_diff = parameters[yaw_block][0];
+    Eigen::Vector3d ref_ecef(parameters[anc_block][0], parameters[anc_block][1], parameters[anc_block][2]);
+
+    const Eigen::Vector3d local_pos = ratio*Pi + (1.0-ratio)*Pj;
+    const Eigen::Vector3d local_vel = ratio*Vi + (1.0-ratio)*Vj;
+
+    // anchor and yaw transforms are shared by all satellites of the epoch
+    double sin_yaw_diff = std::sin(yaw_diff);
+    double cos_yaw_diff = std::cos(yaw_diff);
+    Eigen::Matrix3d R_enu_local;
+    R_enu_local << cos_yaw_diff, -sin_yaw_diff, 0,
+                   sin_yaw_diff,  cos_yaw_diff, 0,
+                   0           ,  0           , 1;
+    Eigen::Matrix3d R_ecef_enu = ecef2rotation(ref_ecef);
+    Eigen::Matrix3d R_ecef_local = R_ecef_enu * R_enu_local;
+
+    Eigen::Vector3d P_ecef = R_ecef_local * local_pos + ref_ecef;
+    Eigen::Vector3d V_ecef = R_ecef_local * local_vel;
+
+    const Eigen::ArrayXd sin_el_2 = sv_sin_el.square();
+    const Eigen::VectorXd pr_weight = (sin_el_2 * pr_info.array()).matrix();
+    const Eigen::VectorXd dp_weight = (sin_el_2 * dp_info.array()).matrix();
+
+    const Eigen::Matrix3Xd rcv2sat_ecef = sv_pos.colwise() - P_ecef;
+    const Eigen::RowVectorXd rcv2sat_norm = rcv2sat_ecef.colwise().norm();
+    const Eigen::Matrix3Xd rcv2sat_unit = rcv2sat_ecef.array().rowwise() / rcv2sat_norm.array();
+    const Eigen::Matrix3Xd rel_vel = sv_vel.colwise() - V_ecef;
+
+    Eigen::VectorXd rcv_dt(num_sv);
+    for (uint32_t i = 0; i < num_sv; ++i)
+        rcv_dt(i) = parameters[4+sv_dt_block[i]][0];
+
+    const Eigen::VectorXd psr_sagnac = EARTH_OMG_GPS / LIGHT_SPEED *
+        (sv_pos.row(0) * P_ecef(1) - sv_pos.row(1) * P_ecef(0)).transpose();
+    const Eigen::VectorXd psr_estimated = rcv2sat_norm.transpose() + psr_sagnac + rcv_dt +
+        sv_psr_bias + atmos_delay;
+
+    const Eigen::VectorXd dopp_sagnac = EARTH_OMG_GPS / LIGHT_SPEED *
+        (sv_vel.row(0) * P_ecef(1) + sv_pos.row(0) * V_ecef(1) -
+         sv_vel.row(1) * P_ecef(0) - sv_pos.row(1) * V_ecef(0)).transpose();
+    const Eigen::VectorXd dopp_estimated = rel_vel.cwiseProduct(rcv2sat_unit).colwise().sum().transpose() +
+        dopp_sagnac + Eigen::VectorXd::Constant(num_sv, rcv_ddt) + sv_dopp_bias;
+
+    Eigen::Map<Eigen::VectorXd, 0, Eigen::InnerStride<2>> psr_residuals(residuals, num_sv);
+    Eigen::Map<Eigen::VectorXd, 0, Eigen::InnerStride<2>> dopp_residuals(residuals+1, num_sv);
+    psr_residuals = (psr_estimated - psr_meas).cwiseProduct(pr_weight);
+    dopp_residuals = (dopp_estimated + dopp_meas).cwiseProduct(dp_weight);
+
+    if (jacobians)
+    {
+        typedef Eigen::Map<Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>,
+            0, Eigen::OuterStride<>> RowsMap;
+
+        // d(unit vector)/d(receiver position) applied to the relative velocity, one row per satellite
+        const Eigen::MatrixX3d psr_J_ecef = -(rcv2sat_unit.transpose() * R_ecef_local);
+        Eigen::MatrixX3d dopp_J_ecef;
+        if (jacobians[0] || jacobians[2])
+        {
+            const Eigen::RowVectorXd rel_vel_proj = rel_vel.cwiseProduct(rcv2sat_unit).colwise().sum();
+            const Eigen::Matrix3Xd rel_vel_perp = rel_vel - rcv2sat_unit * rel_vel_proj.asDiagonal();
+            dopp_J_ecef = -((rel_vel_perp.array().rowwise() / rcv2sat_norm.array()).matrix().transpose() *
+                R_ecef_local);
+        }
+
+        const double pose_ratio[2] = {ratio, 1.0-ratio};
+        for (uint32_t k = 0; k < 2; ++k)
+        {
+            // J_Pi, J_Pj
+            if (jacobians[2*k])
+            {
+                Eigen::Map<Eigen::Matrix<double, Eigen::Dynamic, 7, Eigen::RowMajor>> J_P(jacobians[2*k], 2*num_sv, 7);
+                J_P.setZero();
+                RowsMap J_psr(jacobians[2*k], num_sv, 3, Eigen::OuterStride<>(14));
+                RowsMap J_dopp(jacobians[2*k]+7, num_sv, 3, Eigen::OuterStride<>(14));
+                J_psr = pr_weight.asDiagonal() * psr_J_ecef * pose_ratio[k];
+                J_dopp = dp_weight.asDiagonal() * dopp_J_ecef * pose_ratio[k];
+            }
+
+            // J_Vi, J_Vj
+            if (jacobians[2*k+1])
+            {
+                Eigen::Map<Eigen::Matrix<double, Eigen::Dynamic, 9, Eigen::RowMajor>> J_V(jacobians[2*k+1], 2*num_sv, 9);
+                J_V.setZero();
+                RowsMap J_dopp(jacobians[2*k+1]+9, num_sv, 3, Eigen::OuterStride<>(18));
+                J_dopp = dp_weight.asDiagonal() * psr_J_ecef * pose_ratio[k];
+            }
+        }
+
+        // J_rcv_dt
+        for (uint32_t k = 0; k < num_sys; ++k)
+        {
+            if (!jacobians[4+k])    continue;
+            Eigen::Map<Eigen::VectorXd> J_dt(jacobians[4+k], 2*num_sv);
+            J_dt.setZero();
+            for (uint32_t i = 0; i < num_sv; ++i)
+            {
+                if (sv_dt_block[i] == k)
+                    J_dt(2*i) = pr_weight(i);
+            }
+        }
+
+        // J_rcv_ddt
+        if (jacobians[ddt_block])
+        {
+            Eigen::Map<Eigen::VectorXd, 0, Eigen::InnerStride<2>>(jacobians[ddt_block], num_sv).setZero();
+            Eigen::Map<Eigen::VectorXd, 0, Eigen::InnerStride<2>>(jacobians[ddt_block]+1, num_sv) = dp_weight;
+        }
+
+        // J_yaw_diff
+        if (jacobians[yaw_block])
+        {
+            Eigen::Matrix3d d_yaw;
+            d_yaw << -sin_yaw_diff, -cos_yaw_diff, 0,
+                      cos_yaw_diff, -sin_yaw_diff, 0,
+                      0           ,  0           , 0;
+            const Eigen::Matrix3d R_ecef_dyaw = R_ecef_enu * d_yaw;
+            Eigen::Map<Eigen::VectorXd, 0, Eigen::InnerStride<2>>(jacobians[yaw_block], num_sv) =
+                -(rcv2sat_unit.transpose() * (R_ecef_dyaw * local_pos)).cwiseProduct(pr_weight);
+            Eigen::Map<Eigen::VectorXd, 0, Eigen::InnerStride<2>>(jacobians[yaw_block]+1, num_sv) =
+                -(rcv2sat_unit.transpose() * (R_ecef_dyaw * local_vel)).cwiseProduct(dp_weight);
+        }
+
+        // J_ref_ecef, approximation for simplicity
+        if (jacobians[anc_block])
+        {
+            Eigen::Map<Eigen::Matrix<double, Eigen::Dynamic, 3, Eigen::RowMajor>> J_ref_ecef(jacobians[anc_block], 2*num_sv, 3);
+            J_ref_ecef.setZero();
+            RowsMap J_psr(jacobians[anc_block], num_sv, 3, Eigen::OuterStride<>(6));
+            J_psr = -(pr_weight.asDiagonal() * rcv2sat_unit.transpose());
+        }
+    }
+    return true;
+}
@@ -0,0 +1,70 @@
+#ifndef GNSS_PSR_DOPP_EPOCH_FACTOR_H_
+#define GNSS_PSR_DOPP_EPOCH_FACTOR_H_
+
+#include <vector>
+#include <Eigen/Dense>
+#include <ceres/ceres.h>
+
+#include <gnss_comm/gnss_constant.hpp>
+#include <gnss_comm/gnss_utility.hpp>
+#include <gnss_comm/gnss_spp.hpp>
+
+#include "gnss_psr_dopp_factor.hpp"
+
+using namespace gnss_comm;
+
+/*
+**  Pseudo-range and Doppler residuals of all satellites observed in one GNSS epoch,
+**  residuals are ordered as [psr_0, dopp_0, psr_1, dopp_1, ...].
+**
+**  parameters[0]: position and orientation at time k
+**  parameters[1]: velocity and acc/gyro bias at time k
+**  parameters[2]: position and orientation at time k+1
+**  parameters[3]: velocity and acc/gyro bias at time k+1
+**  parameters[4 ... 4+m-1]: receiver clock bias of each observed system, ordered as observed_sys()
+**  parameters[4+m]: receiver clock bias change rate in clock bias light travelling distance per second (m/s)
+**  parameters[5+m]: yaw difference between ENU and local coordinate (rad)
+**  parameters[6+m]: anchor point's ECEF coordinate
+**
+ */
+class GnssPsrDoppEpochFactor : public ceres::CostFunction
+{
+    public:
+        EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+        GnssPsrDoppEpochFactor() = delete;
+        GnssPsrDoppEpochFactor(const std::vector<ObsPtr> &_obs, const std::vector<EphemBasePtr> &_ephems,
+            const std::vector<SatStatePtr> &_sat_states, std::vector<double> &_iono_paras, const double _ratio);
+        virtual bool Evaluate(double const *const *parameters, double *residuals, double **jacobians) const;
+
+        // system indices (see gnss_comm::sys2idx) whose clock bias blocks follow the 4 pose/speed blocks
+        const std::vector<uint32_t> &observed_sys() const { return sys_idx_list; }
+        uint32_t num_sat() const { return num_sv; }
+
+        // recompute the atmospheric delays at the receiver position given by the current parameter
+        // values (same layout as Evaluate), called once before each solve
+        void update_atmos_delay(double const *const *parameters);
+
+    private:
+
+        const std::vector<ObsPtr> obs;
+        const std::vector<double> &iono_paras;
+        double ratio;
+        uint32_t num_sv;
+        std::vector<uint32_t> sys_idx_list;
+        std::vector<uint32_t> sv_dt_block;              // clock bias block (relative to 4) of each satellite
+        Eigen::Matrix3Xd sv_pos;
+        Eigen::Matrix3Xd sv_vel;
+        Eigen::VectorXd sv_psr_bias;                    // (tgd - svdt) * LIGHT_SPEED
+        Eigen::VectorXd sv_dopp_bias;                   // -svddt * LIGHT_SPEED
+        Eigen::VectorXd psr_meas;
+        Eigen::VectorXd dopp_meas;                      // Doppler in m/s
+        Eigen::VectorXd pr_info;                        // relative_sqrt_info / pr_uura
+        Eigen::VectorXd dp_info;                        // relative_sqrt_info * PSR_TO_DOPP_RATIO / dp_uura
+
+        // troposphere/ionosphere delays and elevations only depend on the receiver position, they are
+        // fixed during a solve so Evaluate stays read only and safe with multiple solver threads
+        Eigen::VectorXd atmos_delay;
+        Eigen::ArrayXd sv_sin_el;
+};
+
+#endif
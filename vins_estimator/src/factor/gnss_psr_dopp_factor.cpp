@@ -1,35 +1,28 @@
 #include "gnss_psr_dopp_factor.hpp"
 
 GnssPsrDoppFactor::GnssPsrDoppFactor(const ObsPtr &_obs, const EphemBasePtr &_ephem, 
-    std::vector<double> &_iono_paras, const double _ratio) 
+    const SatStatePtr &_sat_state, std::vector<double> &_iono_paras, const double _ratio) 
         : obs(_obs), ephem(_ephem), iono_paras(_iono_paras), ratio(_ratio)
 {
     freq = L1_freq(obs, &freq_idx);
     LOG_IF(FATAL, freq < 0) << "No L1 observation found.";
 
+    // satellite states are evaluated once per epoch in Estimator::processGNSS
     uint32_t sys = satsys(obs->sat, NULL);
-    double tof = obs->psr[freq_idx] / LIGHT_SPEED;
-    gtime_t sv_tx = time_add(obs->time, -tof);
+    sv_pos = _sat_state->pos;
+    sv_vel = _sat_state->vel;
+    svdt = _sat_state->dt;
+    svddt = _sat_state->ddt;
+    tgd = _sat_state->tgd;
 
     if (sys == SYS_GLO)
     {
-        GloEphemPtr glo_ephem = std::dynamic_pointer_cast<GloEphem>(ephem);
-        svdt = geph2svdt(sv_tx, glo_ephem);
-        sv_tx = time_add(sv_tx, -svdt);
-        sv_pos = geph2pos(sv_tx, glo_ephem, &svdt);
-        sv_vel = geph2vel(sv_tx, glo_ephem, &svddt);
-        tgd = 0.0;
         pr_uura = 2.0 * (obs->psr_std[freq_idx]/0.16);
         dp_uura = 2.0 * (obs->dopp_std[freq_idx]/0.256);
     }
     else
     {
         EphemPtr eph = std::dynamic_pointer_cast<Ephem>(ephem);
-        svdt = eph2svdt(sv_tx, eph);
-        sv_tx = time_add(sv_tx, -svdt);
-        sv_pos = eph2pos(sv_tx, eph, &svdt);
-        sv_vel = eph2vel(sv_tx, eph, &svddt);
-        tgd = eph->tgd[0];
         if (sys == SYS_GAL)
         {
             pr_uura = (eph->ura - 2.0) * (obs->psr_std[freq_idx]/0.16);
@@ -7,6 +7,7 @@
 
 #include <gnss_comm/gnss_constant.hpp>
 #include <gnss_comm/gnss_utility.hpp>
+#include <gnss_comm/gnss_spp.hpp>
 
 #define PSR_TO_DOPP_RATIO                   5
 
@@ -28,8 +29,8 @@ class GnssPsrDoppFactor : public ceres::SizedCostFunction<2, 7, 9, 7, 9, 1, 1, 1
     public: 
         EIGEN_MAKE_ALIGNED_OPERATOR_NEW
         GnssPsrDoppFactor() = delete;
-        GnssPsrDoppFactor(const ObsPtr &_obs, const EphemBasePtr &_ephem, std::vector<double> &_iono_paras, 
-            const double _ratio);
+        GnssPsrDoppFactor(const ObsPtr &_obs, const EphemBasePtr &_ephem, const SatStatePtr &_sat_state, 
+            std::vector<double> &_iono_paras, const double _ratio);
         virtual bool Evaluate(double const *const *parameters, double *residuals, double **jacobians) const;
         bool check_gradients(const std::vector<const double*> &parameters) const;
     private:
@@ -311,19 +311,15 @@ void FeatureTracker::rejectWithF()
     {
         ROS_DEBUG("FM ransac begins");
         TicToc t_f;
-        vector<cv::Point2f> un_cur_pts(cur_pts.size()), un_prev_pts(prev_pts.size());
+        vector<cv::Point2f> un_cur_pts, un_prev_pts;
+        m_camera[0]->liftProjectiveBatch(cur_pts, un_cur_pts);
+        m_camera[0]->liftProjectiveBatch(prev_pts, un_prev_pts);
         for (unsigned int i = 0; i < cur_pts.size(); i++)
         {
-            Eigen::Vector3d tmp_p;
-            m_camera[0]->liftProjective(Eigen::Vector2d(cur_pts[i].x, cur_pts[i].y), tmp_p);
-            tmp_p.x() = FOCAL_LENGTH * tmp_p.x() / tmp_p.z() + col / 2.0;
-            tmp_p.y() = FOCAL_LENGTH * tmp_p.y() / tmp_p.z() + row / 2.0;
-            un_cur_pts[i] = cv::Point2f(tmp_p.x(), tmp_p.y());
-
-            m_camera[0]->liftProjective(Eigen::Vector2d(prev_pts[i].x, prev_pts[i].y), tmp_p);
-            tmp_p.x() = FOCAL_LENGTH * tmp_p.x() / tmp_p.z() + col / 2.0;
-            tmp_p.y() = FOCAL_LENGTH * tmp_p.y() / tmp_p.z() + row / 2.0;
-            un_prev_pts[i] = cv::Point2f(tmp_p.x(), tmp_p.y());
+            un_cur_pts[i].x = FOCAL_LENGTH * un_cur_pts[i].x + col / 2.0;
+            un_cur_pts[i].y = FOCAL_LENGTH * un_cur_pts[i].y + row / 2.0;
+            un_prev_pts[i].x = FOCAL_LENGTH * un_prev_pts[i].x + col / 2.0;
+            un_prev_pts[i].y = FOCAL_LENGTH * un_prev_pts[i].y + row / 2.0;
         }
 
         vector<uchar> status;
@@ -354,29 +350,24 @@ void FeatureTracker::readIntrinsicParameter(const vector<string> &calib_file)
 void FeatureTracker::showUndistortion(const string &name)
 {
     cv::Mat undistortedImg(row + 600, col + 600, CV_8UC1, cv::Scalar(0));
-    vector<Eigen::Vector2d> distortedp, undistortedp;
+    vector<cv::Point2f> distortedp, undistortedp;
+    distortedp.reserve(col * row);
     for (int i = 0; i < col; i++)
         for (int j = 0; j < row; j++)
-        {
-            Eigen::Vector2d a(i, j);
-            Eigen::Vector3d b;
-            m_camera[0]->liftProjective(a, b);
-            distortedp.push_back(a);
-            undistortedp.push_back(Eigen::Vector2d(b.x() / b.z(), b.y() / b.z()));
-            //printf("%f,%f->%f,%f,%f\n)\n", a.x(), a.y(), b.x(), b.y(), b.z());
-        }
+            distortedp.push_back(cv::Point2f(i, j));
+    m_camera[0]->liftProjectiveBatch(distortedp, undistortedp);
     for (int i = 0; i < int(undistortedp.size()); i++)
     {
         cv::Mat pp(3, 1, CV_32FC1);
-        pp.at<float>(0, 0) = undistortedp[i].x() * FOCAL_LENGTH + col / 2;
-        pp.at<float>(1, 0) = undistortedp[i].y() * FOCAL_LENGTH + row / 2;
+        pp.at<float>(0, 0) = undistortedp[i].x * FOCAL_LENGTH + col / 2;
+        pp.at<float>(1, 0) = undistortedp[i].y * FOCAL_LENGTH + row / 2;
         pp.at<float>(2, 0) = 1.0;
         //cout << trackerData[0].K << endl;
         //printf("%lf %lf\n", p.at<float>(1, 0), p.at<float>(0, 0));
         //printf("%lf %lf\n", pp.at<float>(1, 0), pp.at<float>(0, 0));
         if (pp.at<float>(1, 0) + 300 >= 0 && pp.at<float>(1, 0) + 300 < row + 600 && pp.at<float>(0, 0) + 300 >= 0 && pp.at<float>(0, 0) + 300 < col + 600)
         {
-            undistortedImg.at<uchar>(pp.at<float>(1, 0) + 300, pp.at<float>(0, 0) + 300) = cur_img->at<uchar>(distortedp[i].y(), distortedp[i].x());
+            undistortedImg.at<uchar>(pp.at<float>(1, 0) + 300, pp.at<float>(0, 0) + 300) = cur_img->at<uchar>(distortedp[i].y, distortedp[i].x);
         }
         else
         {
@@ -391,13 +382,7 @@ void FeatureTracker::showUndistortion(const string &name)
 vector<cv::Point2f> FeatureTracker::undistortedPts(vector<cv::Point2f> &pts, camodocal::CameraPtr cam)
 {
     vector<cv::Point2f> un_pts;
-    for (unsigned int i = 0; i < pts.size(); i++)
-    {
-        Eigen::Vector2d a(pts[i].x, pts[i].y);
-        Eigen::Vector3d b;
-        cam->liftProjective(a, b);
-        un_pts.push_back(cv::Point2f(b.x() / b.z(), b.y() / b.z()));
-    }
+    cam->liftProjectiveBatch(pts, un_pts);
     return un_pts;
 }
 
@@ -1,16 +1,11 @@
 #include "gnss_vi_initializer.h"
 
 GNSSVIInitializer::GNSSVIInitializer(const std::vector<std::vector<ObsPtr>> &gnss_meas_buf_, 
-    const std::vector<std::vector<EphemBasePtr>> &gnss_ephem_buf_, const std::vector<double> &iono_params_)
-        : gnss_meas_buf(gnss_meas_buf_), gnss_ephem_buf(gnss_ephem_buf_), iono_params(iono_params_)
+    const std::vector<std::vector<EphemBasePtr>> &gnss_ephem_buf_, 
+    const std::vector<std::vector<SatStatePtr>> &gnss_sat_state_buf_, const std::vector<double> &iono_params_)
+        : gnss_meas_buf(gnss_meas_buf_), gnss_ephem_buf(gnss_ephem_buf_), iono_params(iono_params_), 
+          all_sat_states(gnss_sat_state_buf_)
 {
-    num_all_meas = 0;
-    all_sat_states.clear();
-    for (uint32_t i = 0; i < gnss_meas_buf.size(); ++i)
-    {
-        num_all_meas += gnss_meas_buf[i].size();
-        all_sat_states.push_back(sat_states(gnss_meas_buf[i], gnss_ephem_buf[i]));
-    }
 }
 
 bool GNSSVIInitializer::coarse_localization(Eigen::Matrix<double, 7, 1> &result)
@@ -46,59 +41,127 @@ bool GNSSVIInitializer::yaw_alignment(const std::vector<Eigen::Vector3d> &local_
     aligned_yaw = 0;
     rcv_ddt = 0;
 
-    double est_yaw = 0;
-    double est_rcv_ddt = 0;
-
+    // With the anchor fixed, Doppler residuals are linear in receiver velocity and clock drift,
+    // so every measurement can be written as r = base + cos(yaw)*A + sin(yaw)*B + ddt.
     Eigen::Matrix3d rough_R_ecef_enu = ecef2rotation(rough_anchor_ecef);
-    uint32_t align_iter = 0;
-    double align_dx_norm = 1.0;
-    while (align_iter < MAX_ITERATION && align_dx_norm > CONVERGENCE_EPSILON)
+    uint32_t num_all_meas = 0;
+    for (uint32_t i = 0; i < gnss_meas_buf.size(); ++i)
+        num_all_meas += gnss_meas_buf[i].size();
+    if (num_all_meas < 2)
     {
-        Eigen::MatrixXd align_G(num_all_meas, 2);
-        align_G.setZero();
-        align_G.col(1).setOnes();
-        Eigen::VectorXd align_b(num_all_meas);
-        align_b.setZero();
-        Eigen::Matrix3d align_R_enu_local(Eigen::AngleAxisd(est_yaw, Eigen::Vector3d::UnitZ()));
-        Eigen::Matrix3d align_tmp_M;
-        align_tmp_M << -sin(est_yaw), -cos(est_yaw), 0,
-                        cos(est_yaw), -sin(est_yaw), 0,
-                        0       , 0        , 0;
-        
-        uint32_t align_counter = 0;
-        for (uint32_t i = 0; i < gnss_meas_buf.size(); ++i)
+        std::cerr << "Not enough Doppler measurements for yaw alignment.\n";
+        return false;
+    }
+
+    Eigen::VectorXd dopp_base(num_all_meas), dopp_A(num_all_meas), dopp_B(num_all_meas);
+    uint32_t align_counter = 0;
+    for (uint32_t i = 0; i < gnss_meas_buf.size(); ++i)
+    {
+        const uint32_t num_epoch_meas = gnss_meas_buf[i].size();
+        Eigen::Matrix<double, 4, 1> ecef_vel_ddt;
+        ecef_vel_ddt.head<3>() = rough_R_ecef_enu * local_vs[i];
+        ecef_vel_ddt(3) = 0;
+        Eigen::VectorXd epoch_res;
+        Eigen::MatrixXd epoch_J;
+        dopp_res(ecef_vel_ddt, rough_anchor_ecef, gnss_meas_buf[i], all_sat_states[i], epoch_res, epoch_J);
+        const Eigen::MatrixXd epoch_J_enu = epoch_J.leftCols(3) * rough_R_ecef_enu;
+        const Eigen::Vector3d hor_v(local_vs[i](0), local_vs[i](1), 0);
+        const Eigen::Vector3d hor_v_perp(-local_vs[i](1), local_vs[i](0), 0);
+        dopp_A.segment(align_counter, num_epoch_meas) = epoch_J_enu * hor_v;
+        dopp_B.segment(align_counter, num_epoch_meas) = epoch_J_enu * hor_v_perp;
+        dopp_base.segment(align_counter, num_epoch_meas) = epoch_res - dopp_A.segment(align_counter, num_epoch_meas);
+        align_counter += num_epoch_meas;
+    }
+
+    // 1. coarse search, all yaw hypotheses are evaluated at once with the clock drift solved in closed form
+    Eigen::Matrix<double, 2, YAW_GRID_SIZE> grid_cs;
+    for (uint32_t k = 0; k < YAW_GRID_SIZE; ++k)
+    {
+        const double grid_yaw = -M_PI + 2.0 * M_PI * k / YAW_GRID_SIZE;
+        grid_cs(0, k) = cos(grid_yaw);
+        grid_cs(1, k) = sin(grid_yaw);
+    }
+    Eigen::MatrixX2d dopp_AB(num_all_meas, 2);
+    dopp_AB << dopp_A, dopp_B;
+    Eigen::MatrixXd grid_res = dopp_AB * grid_cs;
+    grid_res.colwise() += dopp_base;
+    const Eigen::RowVectorXd grid_mean = grid_res.colwise().mean();
+    const Eigen::RowVectorXd grid_cost = grid_res.colwise().squaredNorm() - 
+        num_all_meas * grid_mean.cwiseAbs2();
+
+    // keep the local minima on the circular grid as hypotheses, best first
+    std::vector<std::pair<double, uint32_t>> hypotheses;
+    for (uint32_t k = 0; k < YAW_GRID_SIZE; ++k)
+    {
+        const double prev_cost = grid_cost((k + YAW_GRID_SIZE - 1) % YAW_GRID_SIZE);
+        const double next_cost = grid_cost((k + 1) % YAW_GRID_SIZE);
+        if (grid_cost(k) <= prev_cost && grid_cost(k) <= next_cost)
+            hypotheses.emplace_back(grid_cost(k), k);
+    }
+    std::sort(hypotheses.begin(), hypotheses.end());
+    if (hypotheses.size() > NUM_YAW_HYPOTHESES)
+        hypotheses.resize(NUM_YAW_HYPOTHESES);
+
+    // 2. refine the best hypotheses by Gauss-Newton on yaw and clock drift
+    bool found = false;
+    double best_cost = std::numeric_limits<double>::max();
+    double best_yaw = 0, best_ddt = 0;
+    for (const auto &hypothesis : hypotheses)
+    {
+        // early termination, a grid minimum already worse than the refined best one is not refined
+        if (found && hypothesis.first >= best_cost)
+            break;
+
+        const uint32_t k = hypothesis.second;
+        double est_yaw = atan2(grid_cs(1, k), grid_cs(0, k));
+        double est_rcv_ddt = -grid_mean(k);
+        uint32_t align_iter = 0;
+        double align_dx_norm = 1.0;
+        Eigen::VectorXd est_res;
+        while (align_iter < MAX_ITERATION && align_dx_norm > CONVERGENCE_EPSILON)
         {
-            Eigen::Matrix<double, 4, 1> ecef_vel_ddt;
-            ecef_vel_ddt.head<3>() = rough_R_ecef_enu * align_R_enu_local * local_vs[i];
-            ecef_vel_ddt(3) = est_rcv_ddt;
-            Eigen::VectorXd epoch_res;
-            Eigen::MatrixXd epoch_J;
-            dopp_res(ecef_vel_ddt, rough_anchor_ecef, gnss_meas_buf[i], all_sat_states[i], epoch_res, epoch_J);
-            align_b.segment(align_counter, gnss_meas_buf[i].size()) = epoch_res;
-            align_G.block(align_counter, 0, gnss_meas_buf[i].size(), 1) = 
-                epoch_J.leftCols(3)*rough_R_ecef_enu*align_tmp_M*local_vs[i];
-            align_counter += gnss_meas_buf[i].size();
+            const double cos_yaw = cos(est_yaw), sin_yaw = sin(est_yaw);
+            est_res = dopp_base + cos_yaw * dopp_A + sin_yaw * dopp_B;
+            est_res.array() += est_rcv_ddt;
+            const Eigen::VectorXd J_yaw = cos_yaw * dopp_B - sin_yaw * dopp_A;
+            Eigen::Matrix2d align_H;
+            align_H << J_yaw.squaredNorm(), J_yaw.sum(),
+                       J_yaw.sum()        , num_all_meas;
+            const Eigen::Vector2d align_g(J_yaw.dot(est_res), est_res.sum());
+            const Eigen::Vector2d dx = -align_H.inverse() * align_g;
+            est_yaw += dx(0);
+            est_rcv_ddt += dx(1);
+            align_dx_norm = dx.norm();
+            ++ align_iter;
+        }
+        if (align_dx_norm > CONVERGENCE_EPSILON)
+            continue;
+
+        est_res = dopp_base + cos(est_yaw) * dopp_A + sin(est_yaw) * dopp_B;
+        est_res.array() += est_rcv_ddt;
+        const double est_cost = est_res.squaredNorm();
+        if (est_cost < best_cost)
+        {
+            found = true;
+            best_cost = est_cost;
+            best_yaw = est_yaw;
+            best_ddt = est_rcv_ddt;
         }
-        Eigen::VectorXd dx = -(align_G.transpose()*align_G).inverse() * align_G.transpose() * align_b;
-        est_yaw += dx(0);
-        est_rcv_ddt += dx(1);
-        align_dx_norm = dx.norm();
-        ++ align_iter;
     }
 
-    if (align_iter > MAX_ITERATION)
+    if (!found)
     {
         std::cerr << "Fail to initialize yaw offset.\n";
         return false;
     }
 
-    aligned_yaw = est_yaw;
+    aligned_yaw = best_yaw;
     if (aligned_yaw > M_PI)
-        aligned_yaw -= floor(est_yaw/(2.0*M_PI) + 0.5) * (2.0*M_PI);
+        aligned_yaw -= floor(best_yaw/(2.0*M_PI) + 0.5) * (2.0*M_PI);
     else if (aligned_yaw < -M_PI)
-        aligned_yaw -=  ceil(est_yaw/(2.0*M_PI) - 0.5) * (2.0*M_PI);
+        aligned_yaw -=  ceil(best_yaw/(2.0*M_PI) - 0.5) * (2.0*M_PI);
 
-    rcv_ddt = est_rcv_ddt;
+    rcv_ddt = best_ddt;
 
     return true;
 }
@@ -125,11 +188,8 @@ bool GNSSVIInitializer::anchor_refinement(const std::vector<Eigen::Vector3d> &lo
 
     while (refine_iter < MAX_ITERATION && refine_dx_norm > CONVERGENCE_EPSILON)
     {
-        Eigen::MatrixXd refine_G(num_all_meas+unobserved_sys.size(), 7);
-        Eigen::VectorXd refine_b(num_all_meas+unobserved_sys.size());
-        refine_G.setZero();
-        refine_b.setZero();
-        uint32_t refine_counter = 0;
+        Eigen::Matrix<double, 7, 7> refine_H = Eigen::Matrix<double, 7, 7>::Zero();
+        Eigen::Matrix<double, 7, 1> refine_g = Eigen::Matrix<double, 7, 1>::Zero();
         Eigen::Matrix3d refine_R_ecef_enu = ecef2rotation(refine_anchor);
         Eigen::Matrix3d refine_R_ecef_local = refine_R_ecef_enu * aligned_R_enu_local;
         for (uint32_t i = 0; i < gnss_meas_buf.size(); ++i)
@@ -143,18 +203,14 @@ bool GNSSVIInitializer::anchor_refinement(const std::vector<Eigen::Vector3d> &lo
             std::vector<Eigen::Vector2d> tmp_atmos_delay, tmp_sv_azel;
             psr_res(ecef_xyz_dt, gnss_meas_buf[i], all_sat_states[i], iono_params, 
                 epoch_res, epoch_J, tmp_atmos_delay, tmp_sv_azel);
-            refine_b.segment(refine_counter, gnss_meas_buf[i].size()) = epoch_res;
-            refine_G.middleRows(refine_counter, gnss_meas_buf[i].size()) = epoch_J;
-            refine_counter += gnss_meas_buf[i].size();
+            refine_H += epoch_J.transpose() * epoch_J;
+            refine_g += epoch_J.transpose() * epoch_res;
         }
+        // pin clock biases of unobserved systems to zero
         for (uint32_t k : unobserved_sys)
-        {
-            refine_b(refine_counter) = 0;
-            refine_G(refine_counter, k+3) = 1.0;
-            ++ refine_counter;
-        }
+            refine_H(k+3, k+3) += 1.0;
 
-        Eigen::VectorXd dx = -(refine_G.transpose()*refine_G).inverse() * refine_G.transpose() * refine_b;
+        Eigen::Matrix<double, 7, 1> dx = -refine_H.inverse() * refine_g;
         refine_anchor += dx.head<3>();
         refine_dt += dx.tail<4>();
         refine_dx_norm = dx.norm();
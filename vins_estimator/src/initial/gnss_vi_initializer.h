@@ -2,6 +2,8 @@
 #define GNSS_VI_INITIALIZER
 
 #include <vector>
+#include <limits>
+#include <algorithm>
 #include <eigen3/Eigen/Dense>
 
 #include <gnss_comm/gnss_utility.hpp>
@@ -16,6 +18,7 @@ class GNSSVIInitializer
     public:
         GNSSVIInitializer(const std::vector<std::vector<ObsPtr>> &gnss_meas_buf_, 
             const std::vector<std::vector<EphemBasePtr>> &gnss_ephem_buf_, 
+            const std::vector<std::vector<SatStatePtr>> &gnss_sat_state_buf_, 
             const std::vector<double> &iono_params_);
         GNSSVIInitializer(const GNSSVIInitializer&) = delete;
         GNSSVIInitializer& operator=(const GNSSVIInitializer&) = delete;
@@ -34,11 +37,12 @@ class GNSSVIInitializer
         const std::vector<std::vector<EphemBasePtr>> &gnss_ephem_buf;
         const std::vector<double> &iono_params;
 
-        uint32_t num_all_meas;
-        std::vector<std::vector<SatStatePtr>> all_sat_states;
+        const std::vector<std::vector<SatStatePtr>> &all_sat_states;
 
         static constexpr uint32_t MAX_ITERATION = 10;
         static constexpr double   CONVERGENCE_EPSILON = 1e-5;
+        static constexpr uint32_t YAW_GRID_SIZE = 36;           // 10 degree coarse yaw grid
+        static constexpr uint32_t NUM_YAW_HYPOTHESES = 3;
 };
 
 